@@ -0,0 +1,95 @@
+#include "bench.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "util/crypto/sha256.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+template<typename Callback>
+static f64 measureThroughput(const usize p_BytesPerRun, const Callback& p_Callback)
+{
+    // Warm up once, then run for at least half a second
+    p_Callback();
+
+    usize l_Runs = 0;
+    const Clock::time_point l_Start = Clock::now();
+    Clock::time_point l_End;
+    do
+    {
+        p_Callback();
+        ++l_Runs;
+        l_End = Clock::now();
+    } while (l_End - l_Start < std::chrono::milliseconds(500));
+
+    const f64 l_Seconds = std::chrono::duration<f64>(l_End - l_Start).count();
+    return static_cast<f64>(p_BytesPerRun * l_Runs) / l_Seconds / (1024.0 * 1024.0);
+}
+
+void swroo::bench::runSHA256()
+{
+    using crypto::SHA256;
+
+    constexpr usize l_TotalSize = 16 * 1024 * 1024;
+    constexpr std::array<usize, 3> l_BlockSizes = { 0x200, 0x4000, 0x100000 };
+
+    std::vector<u8> l_Data(l_TotalSize);
+    std::mt19937 l_Random(0x5EED);
+    for (u8& l_Byte : l_Data)
+        l_Byte = static_cast<u8>(l_Random());
+
+    const SHA256::Backend l_DefaultBackend = SHA256::getBackend();
+    const SHA256::Backend l_DefaultBatchBackend = SHA256::getBatchBackend();
+    std::cout << "SHA-256 backends, default: " << SHA256::getBackendName(l_DefaultBackend) << ", batch default: " << SHA256::getBackendName(l_DefaultBatchBackend) << '\n';
+
+    std::vector<crypto::SHA256Hash> l_Hashes(l_TotalSize / l_BlockSizes[0]);
+    for (const SHA256::Backend l_Backend : { SHA256::Backend::SCALAR, SHA256::Backend::SHA_NI, SHA256::Backend::AVX2 })
+    {
+        if (!SHA256::isBackendSupported(l_Backend))
+        {
+            std::cout << '\t' << SHA256::getBackendName(l_Backend) << ": not supported" << '\n';
+            continue;
+        }
+
+        for (const usize l_BlockSize : l_BlockSizes)
+        {
+            const usize l_BlockCount = l_TotalSize / l_BlockSize;
+            std::cout << '\t' << SHA256::getBackendName(l_Backend) << ", " << l_BlockSize << " byte blocks:";
+
+            if (SHA256::setBackend(l_Backend))
+            {
+                const f64 l_OneShot = measureThroughput(l_TotalSize, [&]
+                {
+                    for (usize i = 0; i < l_BlockCount; ++i)
+                        l_Hashes[i] = SHA256::hash(l_Data.data() + i * l_BlockSize, l_BlockSize);
+                });
+
+                const f64 l_Streaming = measureThroughput(l_TotalSize, [&]
+                {
+                    SHA256 l_Context;
+                    for (usize i = 0; i < l_BlockCount; ++i)
+                        l_Context.update(l_Data.data() + i * l_BlockSize, l_BlockSize);
+                    l_Hashes[0] = l_Context.finalize();
+                });
+
+                std::cout << " one-shot " << l_OneShot << " MiB/s, streaming " << l_Streaming << " MiB/s,";
+            }
+
+            std::vector<std::span<const u8>> l_Inputs;
+            for (usize i = 0; i < l_BlockCount; ++i)
+                l_Inputs.emplace_back(l_Data.data() + i * l_BlockSize, l_BlockSize);
+
+            SHA256::setBatchBackend(l_Backend);
+            const f64 l_Batch = measureThroughput(l_TotalSize, [&]
+            {
+                SHA256::hashBatch(l_Inputs, l_Hashes);
+            });
+            std::cout << " batch " << l_Batch << " MiB/s" << '\n';
+        }
+    }
+
+    SHA256::setBackend(l_DefaultBackend);
+    SHA256::setBatchBackend(l_DefaultBatchBackend);
+}
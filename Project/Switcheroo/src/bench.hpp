@@ -0,0 +1,7 @@
+#pragma once
+
+namespace swroo::bench
+{
+    // Hashes fixed size blocks with every supported SHA-256 backend and prints the throughput
+    void runSHA256();
+}
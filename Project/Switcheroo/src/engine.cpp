@@ -1,12 +1,296 @@
 #include "engine.hpp"
 
-swroo::Engine::Engine(const std::filesystem::path& p_ProdKeys, const std::filesystem::path& p_TitleKeys)
-    : m_KeyManager(p_ProdKeys, p_TitleKeys)
+#include "util/crypto/aes.hpp"
+
+// Every probe needs its own context, XTS contexts are not thread safe
+static swroo::utils::Expected<std::unique_ptr<swroo::crypto::AES>> makeHeaderAES(const swroo::filesys::KeyManager& p_KeyManager)
+{
+    using namespace swroo;
+
+    if (!p_KeyManager.hasKey(filesys::KeyData::K256, filesys::KeyData::K256Type::HEADER))
+        return utils::Error{ utils::ErrorCode::MISSING_KEY, "header_key" };
+    return std::make_unique<crypto::AES>(p_KeyManager.getKey(filesys::KeyData::K256, filesys::KeyData::K256Type::HEADER).data());
+}
+
+// Probes the NCAs in the PFS0 or HFS0 at p_Offset of p_File. Every header sector is fetched with a single vectored read.
+static swroo::utils::Error probePartition(swroo::FileReader& p_File, const usize p_Offset, swroo::crypto::AES& p_HeaderAES,
+                                          std::vector<swroo::Engine::FileProbe::Content>& p_Contents)
+{
+    using namespace swroo;
+    using filesys::NCA;
+
+    utils::Expected<FileReader*> l_Opened = SubFileReader::tryOpen(p_File, p_Offset, p_File.getFileSize() - p_Offset);
+    if (!l_Opened)
+        return l_Opened.getError();
+    const std::unique_ptr<FileReader> l_Partition(l_Opened.getValue());
+
+    std::vector<filesys::PFS::Entry> l_Entries;
+    for (utils::Expected<filesys::PFS::Entry>& l_Entry : filesys::PFS::enumerate(*l_Partition))
+    {
+        if (!l_Entry)
+            return l_Entry.getError();
+        if (l_Entry.getValue().name.ends_with(".nca") && l_Entry.getValue().size >= NCA::c_ProbeOffset + NCA::c_ProbeSize)
+            l_Entries.push_back(l_Entry.takeValue());
+    }
+
+    std::vector<ByteArray<NCA::c_ProbeSize>> l_Sectors(l_Entries.size());
+    std::vector<FileReader::ReadRequest> l_Requests;
+    l_Requests.reserve(l_Entries.size());
+    for (usize i = 0; i < l_Entries.size(); ++i)
+        l_Requests.push_back({ l_Entries[i].offset + NCA::c_ProbeOffset, std::span<u8>(l_Sectors[i]) });
+
+    try
+    {
+        l_Partition->readv(l_Requests);
+    }
+    catch (const std::exception&)
+    {
+        return { utils::ErrorCode::READ_FAILED, "NCA header" };
+    }
+
+    for (usize i = 0; i < l_Entries.size(); ++i)
+        p_Contents.push_back({ std::move(l_Entries[i].name), p_Offset + l_Entries[i].offset, NCA::probe(l_Sectors[i], p_HeaderAES) });
+    return {};
+}
+
+static swroo::utils::Expected<swroo::Engine::FileProbe> probeFile(const std::filesystem::path& p_Path, swroo::crypto::AES& p_HeaderAES)
 {
+    using namespace swroo;
+    using FileProbe = Engine::FileProbe;
+
+    // XCI fields, the header itself is private to XCI
+    constexpr usize l_XCIMagicOffset = 0x100;
+    constexpr usize l_XCIRootOffset = 0x130;
+
+    utils::Expected<FileReader*> l_Opened = MainFileReader::tryOpen(p_Path);
+    if (!l_Opened)
+        return l_Opened.getError();
+    const std::unique_ptr<FileReader> l_File(l_Opened.getValue());
+
+    // Enough to tell every type apart, and for a bare NCA it already holds the sector to probe
+    ByteArray<filesys::NCA::c_ProbeOffset + filesys::NCA::c_ProbeSize> l_Head;
+    if (const utils::Error l_Error = l_File->tryReadData(l_Head.data(), l_Head.size(), 0, "file header"))
+        return l_Error;
+
+    const u32 l_Magic = utils::loadLE<u32>(l_Head.data());
+    if (l_Magic == utils::MagicFromChars('P', 'F', 'S', '0'))
+    {
+        FileProbe l_Probe{ FileProbe::Type::PFS0, {} };
+        if (const utils::Error l_Error = probePartition(*l_File, 0, p_HeaderAES, l_Probe.contents))
+            return l_Error;
+        return l_Probe;
+    }
+
+    if (utils::loadLE<u32>(l_Head.data() + l_XCIMagicOffset) == utils::MagicFromChars('H', 'E', 'A', 'D'))
+    {
+        const u64 l_RootOffset = utils::loadLE<u64>(l_Head.data() + l_XCIRootOffset);
+        if (l_RootOffset >= l_File->getFileSize())
+            return utils::Error{ utils::ErrorCode::OUT_OF_RANGE, "XCI root partition", l_RootOffset };
+
+        // The root only lists the partitions, NCAs are in the secure one
+        utils::Expected<FileReader*> l_Root = SubFileReader::tryOpen(*l_File, l_RootOffset, l_File->getFileSize() - l_RootOffset);
+        if (!l_Root)
+            return l_Root.getError();
+        const std::unique_ptr<FileReader> l_RootFile(l_Root.getValue());
+
+        std::optional<usize> l_SecureOffset;
+        for (utils::Expected<filesys::PFS::Entry>& l_Entry : filesys::PFS::enumerate(*l_RootFile))
+        {
+            if (!l_Entry)
+                return l_Entry.getError();
+            if (l_Entry.getValue().name == filesys::XCI::getPartitionName(filesys::XCI::Partition::SECURE))
+                l_SecureOffset = l_RootOffset + l_Entry.getValue().offset;
+        }
+
+        FileProbe l_Probe{ FileProbe::Type::XCI, {} };
+        if (l_SecureOffset.has_value())
+        {
+            if (const utils::Error l_Error = probePartition(*l_File, *l_SecureOffset, p_HeaderAES, l_Probe.contents))
+                return l_Error;
+        }
+        return l_Probe;
+    }
+
+    ByteArray<filesys::NCA::c_ProbeSize> l_Sector;
+    std::memcpy(l_Sector.data(), l_Head.data() + filesys::NCA::c_ProbeOffset, l_Sector.size());
+    utils::Expected<filesys::NCA::Probe> l_NCA = filesys::NCA::probe(l_Sector, p_HeaderAES);
+    if (!l_NCA)
+        return l_NCA.getError();
+
+    FileProbe l_Probe{ FileProbe::Type::NCA, {} };
+    l_Probe.contents.push_back({ {}, 0, l_NCA.takeValue() });
+    return l_Probe;
+}
+
+swroo::Engine::Engine(const std::filesystem::path& p_ProdKeys, const std::filesystem::path& p_TitleKeys, const usize p_BlockCacheBudget, const usize p_ThreadCount)
+    : m_KeyManager(p_ProdKeys, p_TitleKeys), m_BlockCache(p_BlockCacheBudget),
+      m_BufferPool(c_WorkBufferSize, utils::BufferPool::c_HugePageSize, 0x10, true), m_BlockCacheLimit(p_BlockCacheBudget), m_FileRegistry(*this),
+      m_Scheduler(p_ThreadCount)
+{
+}
+
+std::shared_ptr<swroo::filesys::PFS> swroo::Engine::loadFPS0(const std::filesystem::path& p_Path, const IOMode p_Mode)
+{
+    utils::Expected<std::shared_ptr<filesys::PFS>> l_PFS = tryLoadPFS0(p_Path, p_Mode);
+    if (!l_PFS)
+        throw std::runtime_error(l_PFS.getError().toString(p_Path));
+    return l_PFS.takeValue();
+}
+
+swroo::utils::Expected<std::shared_ptr<swroo::filesys::PFS>> swroo::Engine::tryLoadPFS0(const std::filesystem::path& p_Path, const IOMode p_Mode)
+{
+    if (p_Mode == IOMode::BUFFERED)
+    {
+        // The registry checked the budget when it opened the file, the parsed PFS is only known now
+        utils::Expected<std::shared_ptr<filesys::PFS>> l_PFS = m_FileRegistry.openPFS0(p_Path);
+        enforceMemoryBudget();
+        return l_PFS;
+    }
+
+    utils::Expected<FileReader*> l_MainFile = MainFileReader::tryOpen(p_Path, p_Mode);
+    if (!l_MainFile)
+        return l_MainFile.getError();
+
+    utils::Expected<filesys::PFS> l_PFS = filesys::PFS::tryOpen(l_MainFile.getValue(), this);
+    if (!l_PFS)
+        return l_PFS.getError();
+    enforceMemoryBudget();
+    return std::make_shared<filesys::PFS>(l_PFS.takeValue());
+}
+
+std::shared_ptr<swroo::filesys::XCI> swroo::Engine::loadXCI(const std::filesystem::path& p_Path, const IOMode p_Mode)
+{
+    if (p_Mode == IOMode::BUFFERED)
+    {
+        utils::Expected<std::shared_ptr<filesys::XCI>> l_XCI = m_FileRegistry.openXCI(p_Path);
+        if (!l_XCI)
+            throw std::runtime_error(l_XCI.getError().toString(p_Path));
+        enforceMemoryBudget();
+        return l_XCI.takeValue();
+    }
+
+    // The XCI only owns the reader once it is constructed
+    std::unique_ptr<FileReader> l_MainFile = std::make_unique<MainFileReader>(p_Path, p_Mode);
+    std::shared_ptr<filesys::XCI> l_XCI = std::make_shared<filesys::XCI>(l_MainFile.get(), this);
+    l_MainFile.release();
+    enforceMemoryBudget();
+    return l_XCI;
+}
+
+swroo::Engine::MemoryUsage swroo::Engine::getMemoryUsage() const
+{
+    return {
+        m_KeyManager.getMemoryUsage(),
+        m_FileRegistry.getMemoryUsage(),
+        m_BlockCache.getMemoryUsage(),
+        m_BufferPool.getMemoryUsage() + getDirectIOPool().getMemoryUsage(),
+        m_ContentIndex.getMemoryUsage(),
+    };
+}
+
+void swroo::Engine::setMemoryBudget(const usize p_Budget)
+{
+    m_MemoryBudget = p_Budget;
+    if (p_Budget == 0)
+    {
+        std::lock_guard l_Lock(m_BudgetMutex);
+        if (m_BlockCache.getBudget() != m_BlockCacheLimit)
+            m_BlockCache.setBudget(m_BlockCacheLimit);
+        return;
+    }
+    enforceMemoryBudget();
+}
+
+bool swroo::Engine::enforceMemoryBudget()
+{
+    const usize l_Budget = getMemoryBudget();
+    if (l_Budget == 0)
+        return true;
+
+    // One pass at a time is enough, whoever comes along meanwhile sees the result of the running one
+    std::unique_lock l_Lock(m_BudgetMutex, std::try_to_lock);
+    if (!l_Lock.owns_lock())
+        return true;
+
+    // Cheapest to give up first: free buffers cost nothing to drop, closed files are reopened with a few reads
+    MemoryUsage l_Usage = getMemoryUsage();
+    if (l_Usage.getTotal() > l_Budget)
+    {
+        m_BufferPool.trim();
+        getDirectIOPool().trim();
+        m_FileRegistry.evictUnused();
+        l_Usage = getMemoryUsage();
+    }
+
+    // The block cache takes up the slack. Resizing drops every cached block, so it only grows again once it gains a
+    // quarter, and only shrinks when the engine is over budget. Bookkeeping adds up to 1/64 to every cached block.
+    const usize l_Other = l_Usage.getTotal() - l_Usage.blockCache;
+    const usize l_Available = l_Budget > l_Other ? l_Budget - l_Other : 0;
+    const usize l_Target = std::min(m_BlockCacheLimit, l_Available - l_Available / 0x40);
+    const usize l_Current = m_BlockCache.getBudget();
+    if ((l_Usage.getTotal() > l_Budget && l_Target < l_Current) || l_Target >= l_Current + std::max(l_Current / 4, BlockCache::c_BlockSize * BlockCache::c_ShardCount))
+    {
+        m_BlockCache.setBudget(l_Target);
+        l_Usage = getMemoryUsage();
+    }
+    return l_Usage.getTotal() <= l_Budget;
+}
+
+swroo::utils::Expected<swroo::filesys::NCA::Probe> swroo::Engine::probeNCA(FileReader& p_File, const usize p_Offset)
+{
+    utils::Expected<std::unique_ptr<crypto::AES>> l_AES = makeHeaderAES(m_KeyManager);
+    if (!l_AES)
+        return l_AES.getError();
+    return filesys::NCA::probe(p_File, p_Offset, *l_AES.getValue());
+}
+
+swroo::utils::Expected<swroo::Engine::FileProbe> swroo::Engine::probeFile(const std::filesystem::path& p_Path)
+{
+    utils::Expected<std::unique_ptr<crypto::AES>> l_AES = makeHeaderAES(m_KeyManager);
+    if (!l_AES)
+        return l_AES.getError();
+    return ::probeFile(p_Path, *l_AES.getValue());
+}
+
+std::vector<swroo::utils::Expected<swroo::Engine::FileProbe>> swroo::Engine::probeFiles(const std::span<const std::filesystem::path> p_Paths)
+{
+    // Files are handed out in batches, each task sets up one header context for its whole batch
+    constexpr usize l_BatchSize = 0x20;
+
+    std::vector<utils::Expected<FileProbe>> l_Results(p_Paths.size(), utils::Error{ utils::ErrorCode::MISSING_KEY, "header_key" });
+    if (!m_KeyManager.hasKey(filesys::KeyData::K256, filesys::KeyData::K256Type::HEADER))
+        return l_Results;
+
+    utils::TaskScheduler::TaskGroup l_Tasks(m_Scheduler);
+    for (usize l_First = 0; l_First < p_Paths.size(); l_First += l_BatchSize)
+    {
+        l_Tasks.run([this, l_First, p_Paths, &l_Results]
+        {
+            const std::unique_ptr<crypto::AES> l_AES = makeHeaderAES(m_KeyManager).takeValue();
+            for (usize i = l_First; i < std::min(l_First + l_BatchSize, p_Paths.size()); ++i)
+            {
+                try
+                {
+                    l_Results[i] = ::probeFile(p_Paths[i], *l_AES);
+                }
+                catch (const std::exception&)
+                {
+                    l_Results[i] = utils::Error{ utils::ErrorCode::READ_FAILED, "file" };
+                }
+            }
+        });
+    }
+    l_Tasks.wait();
+    return l_Results;
 }
 
-swroo::filesys::PFS swroo::Engine::loadFPS0(const std::filesystem::path& p_Path)
+const char* swroo::Engine::FileProbe::getTypeName(const Type p_Type)
 {
-    FileReader* l_MainFile = new MainFileReader(p_Path);
-    return filesys::PFS(l_MainFile, this);
+    switch (p_Type)
+    {
+    case Type::NCA:  return "NCA";
+    case Type::PFS0: return "PFS0";
+    case Type::XCI:  return "XCI";
+    }
+    return "Unknown";
 }
@@ -1,20 +1,106 @@
 #pragma once
 #include "filesys/loader/pfs.hpp"
+#include "filesys/loader/xci.hpp"
+#include "filesys/block_cache.hpp"
+#include "filesys/content_index.hpp"
+#include "filesys/file_registry.hpp"
 #include "filesys/key_manager.hpp"
+#include "util/buffer_pool.hpp"
+#include "util/task_scheduler.hpp"
 
 namespace swroo
 {
     class Engine
     {
     public:
-        Engine(const std::filesystem::path& p_ProdKeys, const std::filesystem::path& p_TitleKeys);
+        static constexpr usize c_DefaultBlockCacheBudget = 0x4000000;
+        // Hashing and verification read in chunks of this size
+        static constexpr usize c_WorkBufferSize = utils::BufferPool::c_HugePageSize;
 
-        [[nodiscard]] filesys::PFS loadFPS0(const std::filesystem::path& p_Path);
+        // Approximate bytes held by each subsystem
+        struct MemoryUsage
+        {
+            usize keys;
+            usize containers;  // Files and parsed containers in the file registry
+            usize blockCache;
+            usize bufferPools; // The process-wide direct I/O pool included
+            usize indexes;
+
+            [[nodiscard]] usize getTotal() const { return keys + containers + blockCache + bufferPools + indexes; }
+        };
+
+        // What probeFile found in a file
+        struct FileProbe
+        {
+            enum class Type : u8 { NCA, PFS0, XCI };
+
+            struct Content
+            {
+                std::string name; // Entry name, empty for a bare NCA
+                usize offset;     // Of the NCA in the file
+                utils::Expected<filesys::NCA::Probe> probe;
+            };
+
+            Type type;
+            std::vector<Content> contents;
+
+            [[nodiscard]] static const char* getTypeName(Type p_Type);
+        };
+
+        // p_ThreadCount sizes the scheduler, 0 for one worker per core
+        Engine(const std::filesystem::path& p_ProdKeys, const std::filesystem::path& p_TitleKeys, usize p_BlockCacheBudget = c_DefaultBlockCacheBudget,
+               usize p_ThreadCount = 0);
+
+        // Buffered files come from the registry, every caller loading the same file shares one reader and one parsed
+        // container. DIRECT keeps a single pass over a whole image, like verification, from evicting everything else
+        // from the page cache, it gets a reader of its own.
+        [[nodiscard]] std::shared_ptr<filesys::PFS> loadFPS0(const std::filesystem::path& p_Path, IOMode p_Mode = IOMode::BUFFERED);
+        // Non-throwing variant for scanning libraries, where unreadable files are expected
+        [[nodiscard]] utils::Expected<std::shared_ptr<filesys::PFS>> tryLoadPFS0(const std::filesystem::path& p_Path, IOMode p_Mode = IOMode::BUFFERED);
+        [[nodiscard]] std::shared_ptr<filesys::XCI> loadXCI(const std::filesystem::path& p_Path, IOMode p_Mode = IOMode::BUFFERED);
+        filesys::FileRegistry& getFileRegistry() { return m_FileRegistry; }
+
+        // See NCA::probe
+        [[nodiscard]] utils::Expected<filesys::NCA::Probe> probeNCA(FileReader& p_File, usize p_Offset = 0);
+        // Tells bare NCAs, PFS0s and XCIs apart and probes every NCA inside, for XCIs those of the secure partition.
+        // Only the package metadata and one header sector per NCA are read, in one vectored read per package.
+        [[nodiscard]] utils::Expected<FileProbe> probeFile(const std::filesystem::path& p_Path);
+        // probeFile for a whole drive, on the scheduler. Results are in p_Paths order.
+        [[nodiscard]] std::vector<utils::Expected<FileProbe>> probeFiles(std::span<const std::filesystem::path> p_Paths);
 
         filesys::KeyManager& getKeyManager() { return m_KeyManager; }
+        // Decrypted blocks of every section reader opened through this engine
+        BlockCache& getBlockCache() { return m_BlockCache; }
+        // NCAs of every PFS loaded through this engine, for finding duplicate content
+        filesys::ContentIndex& getContentIndex() { return m_ContentIndex; }
+        // Huge page backed scratch buffers for hashing and verification, shared by every thread working for this engine
+        utils::BufferPool& getBufferPool() { return m_BufferPool; }
+        // Worker threads for everything this engine does in parallel, loaders submit here instead of starting threads
+        utils::TaskScheduler& getScheduler() { return m_Scheduler; }
+
+        [[nodiscard]] MemoryUsage getMemoryUsage() const;
+        // Caps the memory of the whole engine, 0 lifts the cap. The block cache gets what the other subsystems leave,
+        // up to the budget it was constructed with, and is the first to give memory back when they grow.
+        void setMemoryBudget(usize p_Budget);
+        [[nodiscard]] usize getMemoryBudget() const { return m_MemoryBudget.load(std::memory_order_relaxed); }
+        // Brings the engine back under its budget: free pool buffers are released, files nobody holds are closed and
+        // the block cache is resized to fit. Keys, indexes and held files are never dropped, so this can fall short,
+        // returns whether it did not. Runs on its own whenever a file is opened.
+        bool enforceMemoryBudget();
 
     private:
         filesys::KeyManager m_KeyManager;
+        BlockCache m_BlockCache;
+        filesys::ContentIndex m_ContentIndex;
+        utils::BufferPool m_BufferPool;
+
+        usize m_BlockCacheLimit;
+        std::atomic<usize> m_MemoryBudget = 0;
+        std::mutex m_BudgetMutex;
+        // The containers it keeps alive use everything above when they are closed
+        filesys::FileRegistry m_FileRegistry;
+        // Last, so it finishes queued tasks while everything they use still exists
+        utils::TaskScheduler m_Scheduler;
     };
 }
 
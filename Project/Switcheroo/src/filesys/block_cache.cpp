@@ -0,0 +1,255 @@
+#include "block_cache.hpp"
+
+#include "../util/memory_usage.hpp"
+#include <optional>
+
+std::atomic<u64> swroo::BlockCache::m_NextOwnerID = 0;
+
+f64 swroo::BlockCache::Stats::getHitRate() const
+{
+    const u64 l_Total = hits + misses;
+    return l_Total == 0 ? 0.0 : static_cast<f64>(hits) / static_cast<f64>(l_Total);
+}
+
+swroo::BlockCache::BlockCache(const usize p_Budget)
+    : m_Shards(std::make_unique<Shard[]>(c_ShardCount))
+{
+    setBudget(p_Budget);
+}
+
+void swroo::BlockCache::setBudget(const usize p_Budget)
+{
+    // Every shard gets the same number of blocks, small budgets leave some shards empty rather than going over
+    const usize l_Blocks = p_Budget / c_BlockSize;
+    for (usize i = 0; i < c_ShardCount; ++i)
+    {
+        Shard& l_Shard = m_Shards[i];
+        std::lock_guard l_Lock(l_Shard.mutex);
+
+        const usize l_ShardBlocks = l_Blocks / c_ShardCount + (i < l_Blocks % c_ShardCount ? 1 : 0);
+        // Shrinking has to hand the memory back, which clear and assign do not
+        l_Shard.slots.assign(l_ShardBlocks, Slot{});
+        l_Shard.slots.shrink_to_fit();
+        l_Shard.data.assign(l_ShardBlocks * c_BlockSize, 0);
+        l_Shard.data.shrink_to_fit();
+        std::unordered_map<Key, u32, KeyHash>().swap(l_Shard.index);
+        l_Shard.index.reserve(l_ShardBlocks);
+        l_Shard.hand = 0;
+    }
+    m_Budget = l_Blocks * c_BlockSize;
+}
+
+usize swroo::BlockCache::KeyHash::operator()(const Key& p_Key) const
+{
+    u64 l_Hash = p_Key.owner * 0x9E3779B97F4A7C15ULL;
+    l_Hash ^= (p_Key.block + (static_cast<u64>(p_Key.section) << 56)) * 0xC2B2AE3D27D4EB4FULL;
+    return static_cast<usize>(l_Hash ^ (l_Hash >> 29));
+}
+
+swroo::BlockCache::Shard& swroo::BlockCache::getShard(const Key& p_Key)
+{
+    // Neighbouring blocks land in different shards, so one hot file spreads over all locks
+    return m_Shards[(KeyHash{}(p_Key) >> 7) % c_ShardCount];
+}
+
+bool swroo::BlockCache::lookup(const Key& p_Key, u8* p_Buffer, const usize p_Offset, const usize p_Size)
+{
+    Shard& l_Shard = getShard(p_Key);
+    {
+        std::lock_guard l_Lock(l_Shard.mutex);
+        const auto l_It = l_Shard.index.find(p_Key);
+        if (l_It != l_Shard.index.end())
+        {
+            l_Shard.slots[l_It->second].referenced = true;
+            std::memcpy(p_Buffer, l_Shard.data.data() + l_It->second * c_BlockSize + p_Offset, p_Size);
+            m_Hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    m_Misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool swroo::BlockCache::probe(const Key& p_Key)
+{
+    Shard& l_Shard = getShard(p_Key);
+    {
+        std::lock_guard l_Lock(l_Shard.mutex);
+        if (l_Shard.index.contains(p_Key))
+            return true;
+    }
+
+    m_Misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void swroo::BlockCache::insert(const Key& p_Key, const u8* p_Data, const usize p_Size)
+{
+    if (p_Size > c_BlockSize)
+        throw std::runtime_error("Cached block exceeds the block size");
+
+    Shard& l_Shard = getShard(p_Key);
+    std::lock_guard l_Lock(l_Shard.mutex);
+    if (l_Shard.slots.empty() || l_Shard.index.contains(p_Key))
+        return;
+
+    // CLOCK: referenced slots get a second chance, the first unreferenced one is replaced
+    u32 l_Victim;
+    while (true)
+    {
+        Slot& l_Slot = l_Shard.slots[l_Shard.hand];
+        l_Victim = l_Shard.hand;
+        l_Shard.hand = static_cast<u32>((l_Shard.hand + 1) % l_Shard.slots.size());
+
+        if (!l_Slot.used || !l_Slot.referenced)
+            break;
+        l_Slot.referenced = false;
+    }
+
+    Slot& l_Slot = l_Shard.slots[l_Victim];
+    if (l_Slot.used)
+    {
+        l_Shard.index.erase(l_Slot.key);
+        m_Evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    l_Slot.key = p_Key;
+    l_Slot.used = true;
+    l_Slot.referenced = false;
+    std::memcpy(l_Shard.data.data() + l_Victim * c_BlockSize, p_Data, p_Size);
+    l_Shard.index.emplace(p_Key, l_Victim);
+    m_Insertions.fetch_add(1, std::memory_order_relaxed);
+}
+
+swroo::BlockCache::Stats swroo::BlockCache::getStats() const
+{
+    return Stats{
+        m_Hits.load(std::memory_order_relaxed),
+        m_Misses.load(std::memory_order_relaxed),
+        m_Insertions.load(std::memory_order_relaxed),
+        m_Evictions.load(std::memory_order_relaxed),
+    };
+}
+
+void swroo::BlockCache::resetStats()
+{
+    m_Hits = 0;
+    m_Misses = 0;
+    m_Insertions = 0;
+    m_Evictions = 0;
+}
+
+usize swroo::BlockCache::getMemoryUsage() const
+{
+    usize l_Usage = c_ShardCount * sizeof(Shard);
+    for (usize i = 0; i < c_ShardCount; ++i)
+    {
+        const Shard& l_Shard = m_Shards[i];
+        std::lock_guard l_Lock(l_Shard.mutex);
+        l_Usage += utils::getMemoryUsage(l_Shard.slots) + utils::getMemoryUsage(l_Shard.data) + utils::getHashMapMemoryUsage(l_Shard.index);
+    }
+    return l_Usage;
+}
+
+u64 swroo::BlockCache::makeOwnerID(const crypto::SHA256Hash& p_HeaderHash)
+{
+    u64 l_ID;
+    std::memcpy(&l_ID, p_HeaderHash.data(), sizeof(u64));
+    return l_ID & ~(1ULL << 63);
+}
+
+u64 swroo::BlockCache::makeOwnerID()
+{
+    // The top bit keeps these apart from header hash based owners
+    return m_NextOwnerID.fetch_add(1, std::memory_order_relaxed) | (1ULL << 63);
+}
+
+swroo::CachedFileReader::CachedFileReader(FileReader* p_Section, BlockCache& p_Cache, const u64 p_Owner, const u8 p_SectionIndex, const usize p_Offset, const usize p_Size)
+    : m_Section(p_Section), m_Cache(p_Cache), m_Key{ p_Owner, 0, p_SectionIndex }, m_Offset(p_Offset), m_Size(p_Size)
+{
+    if (p_Offset + p_Size > m_Section->getFileSize())
+    {
+        delete m_Section;
+        throw std::runtime_error("Cached window exceeds section size");
+    }
+}
+
+swroo::CachedFileReader::~CachedFileReader()
+{
+    delete m_Section;
+}
+
+void swroo::CachedFileReader::setCurrentPosition(const usize p_Position)
+{
+    if (p_Position > m_Size)
+        throw std::runtime_error("Cached file position exceeds file size");
+
+    m_Position = p_Position;
+}
+
+u32 swroo::CachedFileReader::readBytes(u8* p_Buffer, const usize p_Size, const usize p_NewOffset)
+{
+    if (p_NewOffset != UINT64_MAX)
+        setCurrentPosition(p_NewOffset);
+
+    if (p_Size > m_Size - m_Position)
+        throw std::runtime_error("Cached read exceeds file size: " + getFilePath().string());
+
+    constexpr usize l_BlockSize = BlockCache::c_BlockSize;
+    const usize l_SectionSize = m_Section->getFileSize();
+    const usize l_Start = m_Offset + m_Position;
+    const usize l_End = l_Start + p_Size;
+
+    FileReader& l_Section = *m_Section;
+    BlockCache::Key l_Key = m_Key;
+
+    usize l_Block = l_Start / l_BlockSize;
+    std::optional<utils::BufferPool::Buffer> l_Run;
+    while (l_Block * l_BlockSize < l_End)
+    {
+        // Part of this block that belongs to the request
+        const usize l_BlockStart = l_Block * l_BlockSize;
+        const usize l_CopyStart = std::max(l_Start, l_BlockStart);
+        const usize l_CopyEnd = std::min(l_End, l_BlockStart + l_BlockSize);
+
+        l_Key.block = l_Block;
+        if (m_Cache.lookup(l_Key, p_Buffer + (l_CopyStart - l_Start), l_CopyStart - l_BlockStart, l_CopyEnd - l_CopyStart))
+        {
+            ++l_Block;
+            continue;
+        }
+
+        // Read the whole run of missing blocks at once, the section reader decrypts it in one go
+        const usize l_LastBlock = (l_End - 1) / l_BlockSize;
+        usize l_RunEnd = l_Block + 1;
+        while (l_RunEnd <= l_LastBlock && l_RunEnd - l_Block < c_MaxMissRun)
+        {
+            l_Key.block = l_RunEnd;
+            if (m_Cache.probe(l_Key))
+                break;
+            ++l_RunEnd;
+        }
+
+        const usize l_RunSize = std::min(l_RunEnd * l_BlockSize, l_SectionSize) - l_BlockStart;
+        if (!l_Run.has_value())
+            l_Run.emplace(getDirectIOPool().acquire());
+        u8* l_RunData = l_Run->getData();
+        l_Section.readBytes(l_RunData, l_RunSize, l_BlockStart);
+
+        for (usize i = l_Block; i < l_RunEnd; ++i)
+        {
+            const usize l_Offset = (i - l_Block) * l_BlockSize;
+            l_Key.block = i;
+            m_Cache.insert(l_Key, l_RunData + l_Offset, std::min(l_BlockSize, l_RunSize - l_Offset));
+        }
+
+        const usize l_RunCopyStart = std::max(l_Start, l_BlockStart);
+        const usize l_RunCopyEnd = std::min(l_End, l_BlockStart + l_RunSize);
+        std::memcpy(p_Buffer + (l_RunCopyStart - l_Start), l_RunData + (l_RunCopyStart - l_BlockStart), l_RunCopyEnd - l_RunCopyStart);
+        l_Block = l_RunEnd;
+    }
+
+    m_Position += p_Size;
+    return static_cast<u32>(p_Size);
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include "file.hpp"
+#include "../util/crypto/sha256.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace swroo
+{
+    // Bounded cache of decrypted section blocks shared by every section reader of an Engine. Blocks are spread over
+    // lock-striped shards, each evicting with the CLOCK algorithm, so concurrent readers rarely contend.
+    class BlockCache
+    {
+    public:
+        static constexpr usize c_BlockSize = 0x4000;
+        static constexpr usize c_ShardCount = 16;
+
+        struct Key
+        {
+            u64 owner; // Identifies the decrypted content, see makeOwnerID
+            u64 block; // Block index within the section
+            u8 section;
+
+            bool operator==(const Key&) const = default;
+        };
+
+        struct Stats
+        {
+            u64 hits;
+            u64 misses;
+            u64 insertions;
+            u64 evictions;
+
+            [[nodiscard]] f64 getHitRate() const;
+        };
+
+        explicit BlockCache(usize p_Budget);
+        BlockCache(const BlockCache&) = delete;
+
+        // Drops every cached block and resizes the cache, a budget of 0 disables it
+        void setBudget(usize p_Budget);
+        [[nodiscard]] usize getBudget() const { return m_Budget.load(std::memory_order_relaxed); }
+        [[nodiscard]] bool isEnabled() const { return getBudget() >= c_BlockSize; }
+
+        // Copies [p_Offset, p_Offset + p_Size) of the block into p_Buffer if it is cached
+        bool lookup(const Key& p_Key, u8* p_Buffer, usize p_Offset, usize p_Size);
+        // Like lookup without the copy, an absent block counts as a miss since the caller is about to read it in
+        [[nodiscard]] bool probe(const Key& p_Key);
+        // p_Size may be below c_BlockSize for the last block of a section
+        void insert(const Key& p_Key, const u8* p_Data, usize p_Size);
+
+        [[nodiscard]] Stats getStats() const;
+        void resetStats();
+        // Bytes held by the cached blocks and their index, which is the budget plus bookkeeping
+        [[nodiscard]] usize getMemoryUsage() const;
+
+        // NCA header hashes make good owners, the header pins the keys and the section hashes so identical copies share
+        // blocks while files that merely carry the same content ID name do not. Anything else gets a unique ID.
+        [[nodiscard]] static u64 makeOwnerID(const crypto::SHA256Hash& p_HeaderHash);
+        [[nodiscard]] static u64 makeOwnerID();
+
+    private:
+        struct KeyHash
+        {
+            usize operator()(const Key& p_Key) const;
+        };
+
+        struct Slot
+        {
+            Key key;
+            bool used = false;
+            bool referenced = false;
+        };
+
+        struct alignas(64) Shard
+        {
+            mutable std::mutex mutex;
+            std::vector<Slot> slots;
+            std::vector<u8> data;
+            std::unordered_map<Key, u32, KeyHash> index;
+            u32 hand = 0;
+        };
+
+        [[nodiscard]] Shard& getShard(const Key& p_Key);
+
+        std::unique_ptr<Shard[]> m_Shards;
+        std::atomic<usize> m_Budget = 0;
+
+        std::atomic<u64> m_Hits = 0;
+        std::atomic<u64> m_Misses = 0;
+        std::atomic<u64> m_Insertions = 0;
+        std::atomic<u64> m_Evictions = 0;
+
+        static std::atomic<u64> m_NextOwnerID;
+    };
+
+    // Serves a window of a decrypted section through a BlockCache. Blocks are keyed by their position in the whole
+    // section, so readers over different windows of the same section share them.
+    class CachedFileReader final : public FileReader
+    {
+    public:
+        // Takes ownership of p_Section, which must cover the whole section
+        explicit CachedFileReader(FileReader* p_Section, BlockCache& p_Cache, u64 p_Owner, u8 p_SectionIndex, usize p_Offset, usize p_Size);
+        ~CachedFileReader() override;
+
+        [[nodiscard]] usize getFileSize() const override { return m_Size; }
+        [[nodiscard]] usize getCurrentPosition() override { return m_Position; }
+        [[nodiscard]] usize getCurrentGlobalPosition() override { return m_Section->getCurrentGlobalPosition() - m_Section->getCurrentPosition() + m_Offset + m_Position; }
+        [[nodiscard]] std::filesystem::path getFilePath() const override { return m_Section->getFilePath(); }
+
+        void setCurrentPosition(usize p_Position) override;
+
+        void addRef() override { m_Section->addRef(); }
+        void release() override { m_Section->release(); }
+
+        bool isOpen() override { return m_Section->isOpen(); }
+
+    private:
+        // Misses are read in runs of up to this many blocks, into one buffer of the direct I/O pool
+        static constexpr usize c_MaxMissRun = 0x40;
+        static_assert(c_MaxMissRun * BlockCache::c_BlockSize <= c_DirectIOChunkSize);
+
+        u32 readBytes(u8* p_Buffer, usize p_Size, usize p_NewOffset) override;
+
+        FileReader* m_Section;
+        BlockCache& m_Cache;
+        BlockCache::Key m_Key;
+
+        usize m_Offset = 0;
+        usize m_Size = 0;
+        usize m_Position = 0;
+    };
+}
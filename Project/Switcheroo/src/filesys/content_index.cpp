@@ -0,0 +1,86 @@
+#include "content_index.hpp"
+
+#include "../util/memory_usage.hpp"
+#include <algorithm>
+
+usize swroo::filesys::ContentIDHash::operator()(const ByteArray<0x10>& p_ContentID) const
+{
+    // Content IDs are SHA-256 prefixes, any eight bytes are as good as a hash
+    u64 l_Hash;
+    std::memcpy(&l_Hash, p_ContentID.data(), sizeof(u64));
+    return static_cast<usize>(l_Hash);
+}
+
+swroo::filesys::ContentIndex::Location swroo::filesys::ContentIndex::getLocation(FileReader& p_File, const usize p_Offset)
+{
+    usize l_Offset = p_Offset;
+    const FileReader& l_Backing = p_File.getBackingFile(l_Offset);
+    return { l_Backing.getFilePath(), l_Offset };
+}
+
+bool swroo::filesys::ContentIndex::add(const ByteArray<0x10>& p_ContentID, const Location& p_Location, const usize p_Size)
+{
+    std::lock_guard l_Lock(m_Mutex);
+    auto [l_It, l_Inserted] = m_Records.try_emplace(p_ContentID);
+    Content& l_Content = l_It->second;
+    if (l_Inserted)
+        l_Content.size = p_Size;
+    else if (l_Content.size != p_Size)
+        return false;
+
+    if (std::ranges::find(l_Content.locations, p_Location) == l_Content.locations.end())
+        l_Content.locations.push_back(p_Location);
+    return true;
+}
+
+void swroo::filesys::ContentIndex::setVerified(const ByteArray<0x10>& p_ContentID, const Location& p_Location, const crypto::SHA256Hash& p_HeaderHash,
+                                               const std::optional<crypto::SHA256Hash>& p_Hash)
+{
+    std::lock_guard l_Lock(m_Mutex);
+    const auto l_It = m_Records.find(p_ContentID);
+    if (l_It == m_Records.end())
+        return;
+
+    Content& l_Content = l_It->second;
+    // A cached result brings no hash, the one of an earlier run may belong to another header and is dropped
+    if (l_Content.headerHash != p_HeaderHash || p_Hash.has_value())
+        l_Content.hash = p_Hash;
+    l_Content.headerHash = p_HeaderHash;
+    l_Content.verifiedLocation = p_Location;
+}
+
+std::optional<swroo::filesys::ContentIndex::Content> swroo::filesys::ContentIndex::find(const ByteArray<0x10>& p_ContentID) const
+{
+    std::lock_guard l_Lock(m_Mutex);
+    const auto l_It = m_Records.find(p_ContentID);
+    if (l_It == m_Records.end())
+        return std::nullopt;
+    return l_It->second;
+}
+
+swroo::filesys::ContentIndex::Stats swroo::filesys::ContentIndex::getStats() const
+{
+    std::lock_guard l_Lock(m_Mutex);
+    Stats l_Stats{ m_Records.size(), 0, 0 };
+    for (const auto& [l_ContentID, l_Content] : m_Records)
+    {
+        l_Stats.copyCount += l_Content.locations.size();
+        l_Stats.reclaimableSize += (l_Content.locations.size() - 1) * l_Content.size;
+    }
+    return l_Stats;
+}
+
+usize swroo::filesys::ContentIndex::getMemoryUsage() const
+{
+    std::lock_guard l_Lock(m_Mutex);
+    usize l_Usage = utils::getHashMapMemoryUsage(m_Records);
+    for (const auto& [l_ContentID, l_Content] : m_Records)
+    {
+        l_Usage += utils::getMemoryUsage(l_Content.locations);
+        for (const Location& l_Location : l_Content.locations)
+            l_Usage += utils::getMemoryUsage(l_Location.file.native());
+        if (l_Content.verifiedLocation.has_value())
+            l_Usage += utils::getMemoryUsage(l_Content.verifiedLocation->file.native());
+    }
+    return l_Usage;
+}
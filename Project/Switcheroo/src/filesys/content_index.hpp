@@ -0,0 +1,74 @@
+#pragma once
+#include "../util/common.hpp"
+#include "../util/crypto/sha256.hpp"
+
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "file.hpp"
+
+namespace swroo::filesys
+{
+    struct ContentIDHash
+    {
+        usize operator()(const ByteArray<0x10>& p_ContentID) const;
+    };
+
+    // Every NCA an Engine has seen, by content ID. Base games, updates and DLC bundles often carry byte-identical NCAs,
+    // the index lets callers skip copies of content that was verified already and tells how much space the rest take.
+    // Copies with the same header share their blocks in the BlockCache, which keys NCAs by header hash. Thread safe.
+    class ContentIndex
+    {
+    public:
+        // Where an NCA is stored, offsets are in the outermost file so copies inside XCIs compare correctly
+        struct Location
+        {
+            std::filesystem::path file;
+            usize offset;
+
+            bool operator==(const Location&) const = default;
+        };
+
+        struct Content
+        {
+            usize size = 0;
+            std::vector<Location> locations;
+
+            // Set once a copy passed verification: SHA-256 of the whole NCA, of its decrypted header, which holds the
+            // master hash of every section, and the copy they were taken from
+            std::optional<crypto::SHA256Hash> hash;
+            std::optional<crypto::SHA256Hash> headerHash;
+            std::optional<Location> verifiedLocation;
+
+            [[nodiscard]] bool isVerified() const { return verifiedLocation.has_value(); }
+        };
+
+        struct Stats
+        {
+            usize contentCount;
+            usize copyCount;
+            usize reclaimableSize; // Bytes taken by every copy but one
+        };
+
+        [[nodiscard]] static Location getLocation(FileReader& p_File, usize p_Offset = 0);
+
+        // Records a copy at p_Location. Returns false if the content ID is already known with another size, the name
+        // cannot be trusted then and the copy is left out.
+        bool add(const ByteArray<0x10>& p_ContentID, const Location& p_Location, usize p_Size);
+        // p_Hash is unknown when the result came from a VerifyCache
+        void setVerified(const ByteArray<0x10>& p_ContentID, const Location& p_Location, const crypto::SHA256Hash& p_HeaderHash,
+                         const std::optional<crypto::SHA256Hash>& p_Hash);
+
+        [[nodiscard]] std::optional<Content> find(const ByteArray<0x10>& p_ContentID) const;
+
+        [[nodiscard]] Stats getStats() const;
+        // Bytes held by the records and their locations
+        [[nodiscard]] usize getMemoryUsage() const;
+
+    private:
+        mutable std::mutex m_Mutex;
+        std::unordered_map<ByteArray<0x10>, Content, ContentIDHash> m_Records;
+    };
+}
@@ -0,0 +1,203 @@
+#include "content_map.hpp"
+
+#include "loader/pfs.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+const swroo::filesys::ContentMap::Content* swroo::filesys::ContentMap::Title::findContent(const CNMT::ContentType p_Type) const
+{
+    for (const Content& l_Content : contents)
+    {
+        if (l_Content.type == p_Type)
+            return &l_Content;
+    }
+    return nullptr;
+}
+
+swroo::filesys::ContentMap::ContentMap(const std::filesystem::path& p_Path)
+{
+    std::ifstream l_File(p_Path, std::ios::binary);
+    if (!l_File.is_open())
+        return;
+
+    FileHeader l_Header{};
+    l_File.read(reinterpret_cast<char*>(&l_Header), sizeof(FileHeader));
+    if (l_File.fail() || l_Header.magic != utils::MagicFromChars('S', 'W', 'C', 'M') || l_Header.version != c_Version)
+    {
+        std::cout << "Ignoring invalid content map: " << p_Path << '\n';
+        return;
+    }
+
+    // The counts are checked against the file before anything is sized from them
+    std::error_code l_Error;
+    const usize l_FileSize = std::filesystem::file_size(p_Path, l_Error);
+    const usize l_RecordsSize = static_cast<usize>(l_Header.titleCount) * sizeof(TitleRecord) + static_cast<usize>(l_Header.contentCount) * sizeof(ContentRecord);
+    if (l_Error || l_FileSize < sizeof(FileHeader) || l_RecordsSize > l_FileSize - sizeof(FileHeader))
+    {
+        std::cout << "Ignoring truncated content map: " << p_Path << '\n';
+        return;
+    }
+
+    std::vector<TitleRecord> l_Titles(l_Header.titleCount);
+    std::vector<ContentRecord> l_Contents(l_Header.contentCount);
+    l_File.read(reinterpret_cast<char*>(l_Titles.data()), static_cast<std::streamsize>(l_Titles.size() * sizeof(TitleRecord)));
+    l_File.read(reinterpret_cast<char*>(l_Contents.data()), static_cast<std::streamsize>(l_Contents.size() * sizeof(ContentRecord)));
+    if (l_File.fail())
+    {
+        std::cout << "Ignoring truncated content map: " << p_Path << '\n';
+        return;
+    }
+
+    // Contents are stored back to back in title order
+    usize l_Next = 0;
+    for (const TitleRecord& l_Record : l_Titles)
+    {
+        if (l_Record.contentCount > l_Contents.size() - l_Next)
+        {
+            std::cout << "Ignoring corrupt content map: " << p_Path << '\n';
+            m_Titles.clear();
+            return;
+        }
+
+        Title l_Title{ l_Record.titleID, l_Record.applicationID, l_Record.version, l_Record.type, {} };
+        for (usize i = 0; i < l_Record.contentCount; ++i, ++l_Next)
+            l_Title.contents.push_back({ l_Contents[l_Next].contentID, l_Contents[l_Next].size, l_Contents[l_Next].type });
+        m_Titles[l_Title.titleID] = std::move(l_Title);
+    }
+}
+
+bool swroo::filesys::ContentMap::add(const CNMT& p_CNMT)
+{
+    const auto l_It = m_Titles.find(p_CNMT.getTitleID());
+    if (l_It != m_Titles.end() && l_It->second.version > p_CNMT.getVersion())
+        return false;
+
+    Title l_Title{ p_CNMT.getTitleID(), p_CNMT.getApplicationID(), p_CNMT.getVersion(), p_CNMT.getType(), {} };
+    l_Title.contents.reserve(p_CNMT.getContents().size());
+    for (const CNMT::ContentRecord& l_Content : p_CNMT.getContents())
+        l_Title.contents.push_back({ l_Content.contentID, l_Content.getSize(), l_Content.type });
+
+    m_Titles[l_Title.titleID] = std::move(l_Title);
+    return true;
+}
+
+usize swroo::filesys::ContentMap::add(PFS& p_PFS)
+{
+    usize l_Count = 0;
+    for (NCA& l_NCA : p_PFS.getNCAs())
+    {
+        if (l_NCA.getContentType() != NCA::ContentType::METADATA)
+            continue;
+
+        const utils::Expected<CNMT> l_CNMT = CNMT::tryOpen(l_NCA);
+        if (!l_CNMT)
+        {
+            std::cout << "Skipping CNMT of title " << std::hex << l_NCA.getTitleID() << std::dec << ": " << l_CNMT.getError().toString() << '\n';
+            continue;
+        }
+
+        add(l_CNMT.getValue());
+        ++l_Count;
+    }
+    return l_Count;
+}
+
+const swroo::filesys::ContentMap::Title* swroo::filesys::ContentMap::find(const u64 p_TitleID) const
+{
+    const auto l_It = m_Titles.find(p_TitleID);
+    return l_It != m_Titles.end() ? &l_It->second : nullptr;
+}
+
+const swroo::filesys::ContentMap::Title* swroo::filesys::ContentMap::findPatch(const u64 p_ApplicationID) const
+{
+    const Title* l_Patch = nullptr;
+    for (const auto& [l_TitleID, l_Title] : m_Titles)
+    {
+        if (l_Title.type == CNMT::MetaType::PATCH && l_Title.applicationID == p_ApplicationID && (l_Patch == nullptr || l_Title.version > l_Patch->version))
+            l_Patch = &l_Title;
+    }
+    return l_Patch;
+}
+
+std::vector<const swroo::filesys::ContentMap::Title*> swroo::filesys::ContentMap::findAddOns(const u64 p_ApplicationID) const
+{
+    std::vector<const Title*> l_AddOns;
+    for (const auto& [l_TitleID, l_Title] : m_Titles)
+    {
+        if (l_Title.type == CNMT::MetaType::ADD_ON_CONTENT && l_Title.applicationID == p_ApplicationID)
+            l_AddOns.push_back(&l_Title);
+    }
+    std::ranges::sort(l_AddOns, {}, &Title::titleID);
+    return l_AddOns;
+}
+
+std::optional<swroo::filesys::ContentMap::Launch> swroo::filesys::ContentMap::resolve(const u64 p_ApplicationID) const
+{
+    const Title* l_Application = find(p_ApplicationID);
+    if (l_Application == nullptr || l_Application->type != CNMT::MetaType::APPLICATION)
+        return std::nullopt;
+
+    const Content* l_Program = l_Application->findContent(CNMT::ContentType::PROGRAM);
+    if (l_Program == nullptr)
+        return std::nullopt;
+
+    Launch l_Launch{ l_Application->version, l_Program->contentID, std::nullopt, std::nullopt };
+    const Content* l_Control = l_Application->findContent(CNMT::ContentType::CONTROL);
+
+    if (const Title* l_Patch = findPatch(p_ApplicationID))
+    {
+        l_Launch.version = l_Patch->version;
+        if (const Content* l_PatchProgram = l_Patch->findContent(CNMT::ContentType::PROGRAM))
+            l_Launch.patchProgram = l_PatchProgram->contentID;
+        // Updates ship the whole control data, titles and icons change with them
+        if (const Content* l_PatchControl = l_Patch->findContent(CNMT::ContentType::CONTROL))
+            l_Control = l_PatchControl;
+    }
+
+    if (l_Control != nullptr)
+        l_Launch.control = l_Control->contentID;
+    return l_Launch;
+}
+
+void swroo::filesys::ContentMap::save(const std::filesystem::path& p_Path) const
+{
+    std::vector<TitleRecord> l_Titles;
+    std::vector<ContentRecord> l_Contents;
+    l_Titles.reserve(m_Titles.size());
+    for (const auto& [l_TitleID, l_Title] : m_Titles)
+    {
+        TitleRecord& l_Record = l_Titles.emplace_back();
+        l_Record.titleID = l_Title.titleID;
+        l_Record.applicationID = l_Title.applicationID;
+        l_Record.version = l_Title.version;
+        l_Record.type = l_Title.type;
+        l_Record.contentCount = static_cast<u16>(l_Title.contents.size());
+        for (const Content& l_Content : l_Title.contents)
+        {
+            ContentRecord& l_ContentRecord = l_Contents.emplace_back();
+            l_ContentRecord.contentID = l_Content.contentID;
+            l_ContentRecord.size = l_Content.size;
+            l_ContentRecord.type = l_Content.type;
+        }
+    }
+
+    // Write next to the map and swap it in, so an interruption never leaves a half written file behind
+    std::filesystem::path l_TempPath = p_Path;
+    l_TempPath += ".tmp";
+    {
+        std::ofstream l_File(l_TempPath, std::ios::binary | std::ios::trunc);
+        if (!l_File.is_open())
+            throw std::runtime_error("Failed to open content map: " + l_TempPath.string());
+
+        const FileHeader l_Header{ utils::MagicFromChars('S', 'W', 'C', 'M'), c_Version, static_cast<u32>(l_Titles.size()), static_cast<u32>(l_Contents.size()) };
+        l_File.write(reinterpret_cast<const char*>(&l_Header), sizeof(FileHeader));
+        l_File.write(reinterpret_cast<const char*>(l_Titles.data()), static_cast<std::streamsize>(l_Titles.size() * sizeof(TitleRecord)));
+        l_File.write(reinterpret_cast<const char*>(l_Contents.data()), static_cast<std::streamsize>(l_Contents.size() * sizeof(ContentRecord)));
+
+        if (l_File.fail())
+            throw std::runtime_error("Failed to write content map: " + l_TempPath.string());
+    }
+
+    std::filesystem::rename(l_TempPath, p_Path);
+}
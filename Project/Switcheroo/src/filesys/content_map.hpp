@@ -0,0 +1,99 @@
+#pragma once
+#include "../util/common.hpp"
+
+#include <filesystem>
+#include <optional>
+#include <unordered_map>
+
+#include "loader/cnmt.hpp"
+
+namespace swroo::filesys
+{
+    class PFS;
+
+    // Titles and their contents as listed by CNMTs, so resolving what to load for a title never opens more than the
+    // META NCAs. Only the newest version of each title ID is kept. Can be saved next to other metadata and loaded back.
+    class ContentMap
+    {
+    public:
+        struct Content
+        {
+            ByteArray<0x10> contentID;
+            u64 size;
+            CNMT::ContentType type;
+        };
+
+        struct Title
+        {
+            u64 titleID;
+            u64 applicationID; // Same as titleID for applications
+            u32 version;
+            CNMT::MetaType type;
+            std::vector<Content> contents;
+
+            [[nodiscard]] const Content* findContent(CNMT::ContentType p_Type) const;
+        };
+
+        // What it takes to run an application at its newest known version
+        struct Launch
+        {
+            u32 version;
+            ByteArray<0x10> program;
+            std::optional<ByteArray<0x10>> patchProgram; // Patches the base program, which is still needed
+            std::optional<ByteArray<0x10>> control; // From the patch when there is one
+        };
+
+        ContentMap() = default;
+        // Loads a saved map, a missing or invalid file leaves the map empty
+        explicit ContentMap(const std::filesystem::path& p_Path);
+
+        // Returns false if a newer version of the title is already known
+        bool add(const CNMT& p_CNMT);
+        // Adds the CNMT of every META NCA in p_PFS, returns how many were read
+        usize add(PFS& p_PFS);
+
+        [[nodiscard]] const Title* find(u64 p_TitleID) const;
+        [[nodiscard]] const Title* findPatch(u64 p_ApplicationID) const;
+        [[nodiscard]] std::vector<const Title*> findAddOns(u64 p_ApplicationID) const;
+        [[nodiscard]] std::optional<Launch> resolve(u64 p_ApplicationID) const;
+
+        [[nodiscard]] usize getTitleCount() const { return m_Titles.size(); }
+
+        void save(const std::filesystem::path& p_Path) const;
+
+    private:
+#pragma pack(push, 1)
+        struct FileHeader
+        {
+            u32 magic;
+            u32 version;
+            u32 titleCount;
+            u32 contentCount;
+        };
+
+        struct TitleRecord
+        {
+            u64 titleID;
+            u64 applicationID;
+            u32 version;
+            CNMT::MetaType type;
+            ZERO_PADDING(0x1);
+            u16 contentCount;
+        };
+
+        struct ContentRecord
+        {
+            ByteArray<0x10> contentID;
+            u64 size;
+            CNMT::ContentType type;
+            ZERO_PADDING(0x7);
+        };
+#pragma pack(pop)
+        static_assert(sizeof(TitleRecord) == 0x18, "Content map title record must be 0x18 bytes");
+        static_assert(sizeof(ContentRecord) == 0x20, "Content map content record must be 0x20 bytes");
+
+        static constexpr u32 c_Version = 1;
+
+        std::unordered_map<u64, Title> m_Titles;
+    };
+}
@@ -0,0 +1,65 @@
+#include "crypto_file.hpp"
+
+swroo::CTRFileReader::CTRFileReader(FileReader& p_Parent, const usize p_Offset, const usize p_Size, const ByteArray<0x10>& p_Key, const ByteArray<0x10>& p_Counter, const usize p_CounterOffset)
+    : m_Storage(p_Parent, p_Offset, p_Size), m_AES(p_Key.data(), crypto::AES::Mode::CTR), m_Counter(p_Counter), m_CounterOffset(p_CounterOffset)
+{
+    if (p_CounterOffset % 0x10 != 0)
+        throw std::runtime_error("CTR region must start on an AES block boundary");
+}
+
+void swroo::CTRFileReader::setCurrentPosition(const usize p_Position)
+{
+    if (p_Position > getFileSize())
+        throw std::runtime_error("CTR file position exceeds file size");
+
+    m_Position = p_Position;
+}
+
+ByteArray<0x10> swroo::CTRFileReader::makeCounter(const ByteArray<0x10>& p_Counter, usize p_Offset)
+{
+    ByteArray<0x10> l_Counter = p_Counter;
+    p_Offset >>= 4;
+    for (i32 i = 0xF; i >= 0x8; i--)
+    {
+        l_Counter[i] = static_cast<u8>(p_Offset & 0xFF);
+        p_Offset >>= 8;
+    }
+    return l_Counter;
+}
+
+bool swroo::CTRFileReader::readDecrypted(FileReader& p_Storage, crypto::AES& p_AES, const ByteArray<0x10>& p_Counter, const usize p_CounterOffset,
+                                         u8* p_Buffer, const usize p_Size, const usize p_Offset)
+{
+    p_Storage.readBytes(p_Buffer, p_Size, p_Offset);
+
+    // Decryption has to start on a block boundary. CTR only XORs the key stream in, so the part of the first block
+    // before the read can be anything.
+    const usize l_Skip = p_Offset & 0xF;
+    usize l_Done = 0;
+    if (l_Skip != 0)
+    {
+        ByteArray<0x10> l_Block{};
+        l_Done = std::min(l_Block.size() - l_Skip, p_Size);
+        std::memcpy(l_Block.data() + l_Skip, p_Buffer, l_Done);
+        if (!p_AES.decryptCTR(l_Block.data(), l_Block.data(), l_Skip + l_Done, makeCounter(p_Counter, p_CounterOffset + p_Offset - l_Skip)))
+            return false;
+        std::memcpy(p_Buffer, l_Block.data() + l_Skip, l_Done);
+    }
+
+    return l_Done == p_Size || p_AES.decryptCTR(p_Buffer + l_Done, p_Buffer + l_Done, p_Size - l_Done, makeCounter(p_Counter, p_CounterOffset + p_Offset + l_Done));
+}
+
+u32 swroo::CTRFileReader::readBytes(u8* p_Buffer, const usize p_Size, const usize p_NewOffset)
+{
+    if (p_NewOffset != UINT64_MAX)
+        setCurrentPosition(p_NewOffset);
+
+    if (p_Size > getFileSize() - m_Position)
+        throw std::runtime_error("CTR read exceeds file size: " + getFilePath().string());
+
+    if (!readDecrypted(m_Storage, m_AES, m_Counter, m_CounterOffset, p_Buffer, p_Size, m_Position))
+        throw std::runtime_error("Failed to decrypt CTR region: " + getFilePath().string());
+
+    m_Position += p_Size;
+    return static_cast<u32>(p_Size);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "file.hpp"
+#include "../util/crypto/aes.hpp"
+
+namespace swroo
+{
+    // Decrypts an AES-CTR region of the parent file on the fly
+    class CTRFileReader final : public FileReader
+    {
+    public:
+        // p_Counter holds the upper half of the counter, p_CounterOffset is the absolute offset of the
+        // region start, which is what the lower half of the counter is derived from
+        explicit CTRFileReader(FileReader& p_Parent, usize p_Offset, usize p_Size, const ByteArray<0x10>& p_Key, const ByteArray<0x10>& p_Counter, usize p_CounterOffset);
+        ~CTRFileReader() override = default;
+
+        [[nodiscard]] usize getFileSize() const override { return m_Storage.getFileSize(); }
+        [[nodiscard]] usize getCurrentPosition() override { return m_Position; }
+        [[nodiscard]] usize getCurrentGlobalPosition() override { return m_Storage.getCurrentGlobalPosition() - m_Storage.getCurrentPosition() + m_Position; }
+        [[nodiscard]] std::filesystem::path getFilePath() const override { return m_Storage.getFilePath(); }
+
+        void setCurrentPosition(usize p_Position) override;
+
+        void addRef() override { m_Storage.addRef(); }
+        void release() override { m_Storage.release(); }
+
+        bool isOpen() override { return m_Storage.isOpen(); }
+
+        [[nodiscard]] static ByteArray<0x10> makeCounter(const ByteArray<0x10>& p_Counter, usize p_Offset);
+        // Reads [p_Offset, p_Offset + p_Size) of p_Storage straight into p_Buffer and decrypts it there, the counter is
+        // derived from p_CounterOffset + p_Offset. False if decryption failed, read errors throw.
+        [[nodiscard]] static bool readDecrypted(FileReader& p_Storage, crypto::AES& p_AES, const ByteArray<0x10>& p_Counter, usize p_CounterOffset,
+                                                u8* p_Buffer, usize p_Size, usize p_Offset);
+
+    private:
+        u32 readBytes(u8* p_Buffer, usize p_Size, usize p_NewOffset) override;
+
+        SubFileReader m_Storage;
+        crypto::AES m_AES;
+
+        ByteArray<0x10> m_Counter;
+        usize m_CounterOffset = 0;
+
+        usize m_Position = 0;
+    };
+}
@@ -0,0 +1,558 @@
+#include "file.hpp"
+
+#include <algorithm>
+#include <optional>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+static constexpr usize alignDown(const usize p_Value)
+{
+    return p_Value & ~(swroo::c_DirectIOAlignment - 1);
+}
+
+static constexpr usize alignUp(const usize p_Value)
+{
+    return alignDown(p_Value + swroo::c_DirectIOAlignment - 1);
+}
+
+#ifdef _WIN32
+using NativeHandle = HANDLE;
+#else
+using NativeHandle = i32;
+#endif
+
+// Stops early at the end of the file, p_Read says how far it got. False on error only.
+static bool readNative(const NativeHandle p_Handle, u8* p_Buffer, usize p_Size, usize p_Offset, usize& p_Read)
+{
+    p_Read = 0;
+    while (p_Size > 0)
+    {
+#ifdef _WIN32
+        // With a synchronous handle the OVERLAPPED offset makes this a positional read, the file pointer is not shared
+        OVERLAPPED l_Overlapped{};
+        l_Overlapped.Offset = static_cast<DWORD>(p_Offset);
+        l_Overlapped.OffsetHigh = static_cast<DWORD>(p_Offset >> 32);
+
+        DWORD l_Read = 0;
+        const DWORD l_Chunk = static_cast<DWORD>(std::min<usize>(p_Size, 0x40000000));
+        if (!ReadFile(p_Handle, p_Buffer, l_Chunk, &l_Read, &l_Overlapped))
+            return GetLastError() == ERROR_HANDLE_EOF;
+#else
+        const ssize_t l_Read = ::pread(p_Handle, p_Buffer, p_Size, static_cast<off_t>(p_Offset));
+        if (l_Read < 0 && errno == EINTR)
+            continue;
+        if (l_Read < 0)
+            return false;
+#endif
+        if (l_Read == 0)
+            return true;
+
+        p_Buffer += l_Read;
+        p_Size -= static_cast<usize>(l_Read);
+        p_Offset += static_cast<usize>(l_Read);
+        p_Read += static_cast<usize>(l_Read);
+    }
+    return true;
+}
+
+static bool writeNative(const NativeHandle p_Handle, const u8* p_Data, usize p_Size, usize p_Offset)
+{
+    while (p_Size > 0)
+    {
+#ifdef _WIN32
+        // Positional like the reads, writes at an offset move the file pointer of a synchronous handle anyway
+        OVERLAPPED l_Overlapped{};
+        l_Overlapped.Offset = static_cast<DWORD>(p_Offset);
+        l_Overlapped.OffsetHigh = static_cast<DWORD>(p_Offset >> 32);
+
+        DWORD l_Written = 0;
+        const DWORD l_Chunk = static_cast<DWORD>(std::min<usize>(p_Size, 0x40000000));
+        if (!WriteFile(p_Handle, p_Data, l_Chunk, &l_Written, &l_Overlapped) || l_Written == 0)
+            return false;
+#else
+        const ssize_t l_Written = ::pwrite(p_Handle, p_Data, p_Size, static_cast<off_t>(p_Offset));
+        if (l_Written < 0 && errno == EINTR)
+            continue;
+        if (l_Written <= 0)
+            return false;
+#endif
+        p_Data += l_Written;
+        p_Size -= static_cast<usize>(l_Written);
+        p_Offset += static_cast<usize>(l_Written);
+    }
+    return true;
+}
+
+swroo::utils::BufferPool& swroo::getDirectIOPool()
+{
+    static utils::BufferPool s_Pool(c_DirectIOChunkSize, c_DirectIOAlignment);
+    return s_Pool;
+}
+
+void swroo::FileReader::readv(const std::span<const ReadRequest> p_Requests)
+{
+    const usize l_Position = getCurrentPosition();
+    for (const ReadRequest& l_Request : p_Requests)
+        readBytes(l_Request.buffer.data(), l_Request.buffer.size(), l_Request.offset);
+    setCurrentPosition(l_Position);
+}
+
+swroo::MainFileReader::MainFileReader(const std::filesystem::path& p_File, const IOMode p_Mode)
+    : MainFileReader(p_Mode)
+{
+    if (const utils::Error l_Error = open(p_File))
+        throw std::runtime_error(l_Error.toString(p_File));
+}
+
+swroo::MainFileReader::~MainFileReader()
+{
+    close();
+}
+
+swroo::utils::Expected<swroo::FileReader*> swroo::MainFileReader::tryOpen(const std::filesystem::path& p_File, const IOMode p_Mode)
+{
+    MainFileReader* l_File = new MainFileReader(p_Mode);
+    if (const utils::Error l_Error = l_File->open(p_File))
+    {
+        delete l_File;
+        return l_Error;
+    }
+    return l_File;
+}
+
+swroo::utils::Error swroo::MainFileReader::open(const std::filesystem::path& p_File)
+{
+    m_FilePath = p_File;
+
+#ifdef _WIN32
+    if (m_Mode == IOMode::DIRECT)
+    {
+        m_Handle = CreateFileW(m_FilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+        if (m_Handle == c_InvalidHandle && GetLastError() == ERROR_INVALID_PARAMETER)
+            m_Mode = IOMode::BUFFERED;
+    }
+    if (m_Mode == IOMode::BUFFERED)
+        m_Handle = CreateFileW(m_FilePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_Handle == c_InvalidHandle)
+        return { utils::ErrorCode::OPEN_FAILED, "file" };
+
+    LARGE_INTEGER l_Size;
+    if (!GetFileSizeEx(m_Handle, &l_Size))
+    {
+        close();
+        return { utils::ErrorCode::OPEN_FAILED, "file" };
+    }
+    m_FileSize = static_cast<usize>(l_Size.QuadPart);
+#else
+#ifdef O_DIRECT
+    if (m_Mode == IOMode::DIRECT)
+    {
+        // tmpfs and some FUSE file systems refuse O_DIRECT outright
+        m_Handle = ::open(m_FilePath.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (m_Handle == c_InvalidHandle && errno == EINVAL)
+            m_Mode = IOMode::BUFFERED;
+    }
+    if (m_Mode == IOMode::BUFFERED)
+        m_Handle = ::open(m_FilePath.c_str(), O_RDONLY | O_CLOEXEC);
+#else
+    m_Handle = ::open(m_FilePath.c_str(), O_RDONLY | O_CLOEXEC);
+#ifdef F_NOCACHE
+    // No alignment rules here, the bounce buffers are harmless
+    if (m_Handle != c_InvalidHandle && m_Mode == IOMode::DIRECT && fcntl(m_Handle, F_NOCACHE, 1) != 0)
+        m_Mode = IOMode::BUFFERED;
+#else
+    m_Mode = IOMode::BUFFERED;
+#endif
+#endif
+    if (m_Handle == c_InvalidHandle)
+        return { utils::ErrorCode::OPEN_FAILED, "file" };
+
+    struct stat l_Stat;
+    if (fstat(m_Handle, &l_Stat) != 0)
+    {
+        close();
+        return { utils::ErrorCode::OPEN_FAILED, "file" };
+    }
+    m_FileSize = static_cast<usize>(l_Stat.st_size);
+#endif
+
+    m_Position = 0;
+    return {};
+}
+
+void swroo::MainFileReader::close()
+{
+    if (m_Handle == c_InvalidHandle)
+        return;
+
+#ifdef _WIN32
+    CloseHandle(m_Handle);
+#else
+    ::close(m_Handle);
+#endif
+    m_Handle = c_InvalidHandle;
+}
+
+void swroo::MainFileReader::setCurrentPosition(const usize p_Position)
+{
+    if (p_Position > m_FileSize)
+        throw std::runtime_error("Failed to set file position: " + m_FilePath.string());
+
+    m_Position = p_Position;
+}
+
+void swroo::MainFileReader::release()
+{
+    if (--m_References != 0)
+        return;
+
+    // Someone may have taken a reference again before the lock was ours
+    std::lock_guard l_Lock(m_HandleMutex);
+    if (m_References == 0)
+        close();
+}
+
+void swroo::MainFileReader::addRef()
+{
+    // While the file is referenced it stays open, only the first reference after the last release needs the lock
+    u32 l_References = m_References;
+    while (l_References != 0)
+    {
+        if (m_References.compare_exchange_weak(l_References, l_References + 1))
+            return;
+    }
+
+    std::lock_guard l_Lock(m_HandleMutex);
+    if (!isOpen() && open(m_FilePath))
+        throw std::runtime_error("Failed to reopen file: " + m_FilePath.string());
+
+    m_References++;
+}
+
+u32 swroo::MainFileReader::readBytes(u8* p_Buffer, const usize p_Size, const usize p_NewOffset)
+{
+    const usize l_Offset = p_NewOffset != UINT64_MAX ? p_NewOffset : m_Position.load();
+    if (!(m_Mode == IOMode::DIRECT ? readDirect(p_Buffer, p_Size, l_Offset) : readAt(p_Buffer, p_Size, l_Offset)))
+        throw std::runtime_error("Failed to read file: " + m_FilePath.string());
+
+    m_Position = l_Offset + p_Size;
+    return static_cast<u32>(p_Size);
+}
+
+bool swroo::MainFileReader::readAt(u8* p_Buffer, const usize p_Size, const usize p_Offset) const
+{
+    usize l_Read = 0;
+    return readNative(m_Handle, p_Buffer, p_Size, p_Offset, l_Read) && l_Read == p_Size;
+}
+
+bool swroo::MainFileReader::readDirect(u8* p_Buffer, usize p_Size, usize p_Offset) const
+{
+    std::optional<utils::BufferPool::Buffer> l_Bounce;
+    while (p_Size > 0)
+    {
+        const usize l_Skip = p_Offset - alignDown(p_Offset);
+        if (l_Skip == 0 && p_Size >= c_DirectIOAlignment && reinterpret_cast<uintptr_t>(p_Buffer) % c_DirectIOAlignment == 0)
+        {
+            // The aligned middle of a large read goes straight into the caller's buffer
+            const usize l_Size = alignDown(p_Size);
+            if (!readAt(p_Buffer, l_Size, p_Offset))
+                return false;
+            p_Buffer += l_Size;
+            p_Size -= l_Size;
+            p_Offset += l_Size;
+            continue;
+        }
+
+        // Unaligned edges are read as whole sectors, the last one may come back short at the end of the file
+        if (!l_Bounce)
+            l_Bounce.emplace(getDirectIOPool().acquire());
+        const usize l_Size = std::min(alignUp(l_Skip + p_Size), l_Bounce->getSize());
+        usize l_Read = 0;
+        if (!readNative(m_Handle, l_Bounce->getData(), l_Size, p_Offset - l_Skip, l_Read) || l_Read <= l_Skip)
+            return false;
+
+        const usize l_Copy = std::min(p_Size, l_Read - l_Skip);
+        std::memcpy(p_Buffer, l_Bounce->getData() + l_Skip, l_Copy);
+        p_Buffer += l_Copy;
+        p_Size -= l_Copy;
+        p_Offset += l_Copy;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+void swroo::MainFileReader::readv(const std::span<const ReadRequest> p_Requests)
+{
+    // ReadFileScatter needs unbuffered, page aligned I/O, so every range is its own read here
+    for (const ReadRequest& l_Request : p_Requests)
+    {
+        u8* l_Buffer = l_Request.buffer.data();
+        const usize l_Size = l_Request.buffer.size();
+        if (!(m_Mode == IOMode::DIRECT ? readDirect(l_Buffer, l_Size, l_Request.offset) : readAt(l_Buffer, l_Size, l_Request.offset)))
+            throw std::runtime_error("Failed to read file: " + m_FilePath.string());
+    }
+}
+#else
+// Keeps calling preadv until every iovec is full, p_IOVecs is consumed in the process
+static bool preadvFully(const i32 p_Handle, iovec* p_IOVecs, i32 p_Count, usize p_Offset)
+{
+    while (p_Count > 0)
+    {
+        ssize_t l_Read = ::preadv(p_Handle, p_IOVecs, p_Count, static_cast<off_t>(p_Offset));
+        if (l_Read < 0 && errno == EINTR)
+            continue;
+        if (l_Read <= 0)
+            return false;
+
+        p_Offset += static_cast<usize>(l_Read);
+        while (p_Count > 0 && static_cast<usize>(l_Read) >= p_IOVecs->iov_len)
+        {
+            l_Read -= static_cast<ssize_t>(p_IOVecs->iov_len);
+            ++p_IOVecs;
+            --p_Count;
+        }
+        if (p_Count > 0)
+        {
+            p_IOVecs->iov_base = static_cast<u8*>(p_IOVecs->iov_base) + l_Read;
+            p_IOVecs->iov_len -= static_cast<usize>(l_Read);
+        }
+    }
+    return true;
+}
+
+void swroo::MainFileReader::readv(const std::span<const ReadRequest> p_Requests)
+{
+    constexpr usize l_MaxIOVecs = 0x100;
+
+    if (m_Mode == IOMode::DIRECT)
+    {
+        // Caller buffers are rarely sector aligned, so there is nothing to scatter into
+        for (const ReadRequest& l_Request : p_Requests)
+        {
+            if (!readDirect(l_Request.buffer.data(), l_Request.buffer.size(), l_Request.offset))
+                throw std::runtime_error("Failed to read file: " + m_FilePath.string());
+        }
+        return;
+    }
+
+    std::vector<ReadRequest> l_Requests;
+    l_Requests.reserve(p_Requests.size());
+    for (const ReadRequest& l_Request : p_Requests)
+    {
+        if (!l_Request.buffer.empty())
+            l_Requests.push_back(l_Request);
+    }
+    std::ranges::sort(l_Requests, {}, &ReadRequest::offset);
+
+    // preadv reads one contiguous range, so requests are grouped into runs with small gaps that are read into scratch
+    std::vector<u8> l_Scratch;
+    std::vector<iovec> l_IOVecs;
+    usize i = 0;
+    while (i < l_Requests.size())
+    {
+        const usize l_Start = l_Requests[i].offset;
+        usize l_End = l_Start;
+        l_IOVecs.clear();
+
+        for (; i < l_Requests.size() && l_IOVecs.size() + 2 <= l_MaxIOVecs; ++i)
+        {
+            const ReadRequest& l_Request = l_Requests[i];
+            // Overlapping ranges cannot share a run, a gap too large is cheaper to seek over
+            if (l_Request.offset < l_End || l_Request.offset - l_End > c_MaxReadvGap)
+                break;
+
+            if (l_Request.offset > l_End)
+            {
+                if (l_Scratch.empty())
+                    l_Scratch.resize(c_MaxReadvGap);
+                l_IOVecs.push_back({ l_Scratch.data(), l_Request.offset - l_End });
+            }
+            l_IOVecs.push_back({ l_Request.buffer.data(), l_Request.buffer.size() });
+            l_End = l_Request.offset + l_Request.buffer.size();
+        }
+
+        if (!preadvFully(m_Handle, l_IOVecs.data(), static_cast<i32>(l_IOVecs.size()), l_Start))
+            throw std::runtime_error("Failed to read file: " + m_FilePath.string());
+    }
+}
+#endif
+
+swroo::FileWriter::FileWriter(const std::filesystem::path& p_File, const IOMode p_Mode)
+    : m_FilePath(p_File), m_Mode(p_Mode), m_Buffer(getDirectIOPool().acquire())
+{
+#ifdef _WIN32
+    m_Handle = INVALID_HANDLE_VALUE;
+    if (m_Mode == IOMode::DIRECT)
+    {
+        m_Handle = CreateFileW(m_FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING, nullptr);
+        if (m_Handle == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER)
+            m_Mode = IOMode::BUFFERED;
+    }
+    if (m_Mode == IOMode::BUFFERED)
+        m_Handle = CreateFileW(m_FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    m_Open = m_Handle != INVALID_HANDLE_VALUE;
+#else
+    // Readable too, patching part of a sector in DIRECT mode means reading the rest of it first
+    constexpr i32 l_Flags = O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC;
+    m_Handle = -1;
+#ifdef O_DIRECT
+    if (m_Mode == IOMode::DIRECT)
+    {
+        m_Handle = ::open(m_FilePath.c_str(), l_Flags | O_DIRECT, 0644);
+        if (m_Handle == -1 && errno == EINVAL)
+            m_Mode = IOMode::BUFFERED;
+    }
+    if (m_Mode == IOMode::BUFFERED)
+        m_Handle = ::open(m_FilePath.c_str(), l_Flags, 0644);
+#else
+    m_Handle = ::open(m_FilePath.c_str(), l_Flags, 0644);
+#ifdef F_NOCACHE
+    if (m_Handle != -1 && m_Mode == IOMode::DIRECT && fcntl(m_Handle, F_NOCACHE, 1) != 0)
+        m_Mode = IOMode::BUFFERED;
+#else
+    m_Mode = IOMode::BUFFERED;
+#endif
+#endif
+    m_Open = m_Handle != -1;
+#endif
+
+    if (!m_Open)
+        throw std::runtime_error("Failed to create file: " + m_FilePath.string());
+}
+
+swroo::FileWriter::~FileWriter()
+{
+    try
+    {
+        finish();
+    }
+    catch (const std::exception&)
+    {
+        close();
+    }
+}
+
+void swroo::FileWriter::write(const u8* p_Data, usize p_Size)
+{
+    if (!m_Open)
+        throw std::runtime_error("Failed to write finished file: " + m_FilePath.string());
+
+    while (p_Size > 0)
+    {
+        const usize l_Copy = std::min(p_Size, m_Buffer.getSize() - m_Staged);
+        std::memcpy(m_Buffer.getData() + m_Staged, p_Data, l_Copy);
+        m_Staged += l_Copy;
+        p_Data += l_Copy;
+        p_Size -= l_Copy;
+
+        if (m_Staged == m_Buffer.getSize())
+            flush(m_Staged);
+    }
+}
+
+void swroo::FileWriter::finish()
+{
+    if (!m_Open)
+        return;
+
+    if (m_Staged > 0)
+    {
+        const usize l_Size = m_Staged;
+        if (m_Mode == IOMode::DIRECT)
+        {
+            const usize l_Padded = alignUp(l_Size);
+            std::memset(m_Buffer.getData() + l_Size, 0, l_Padded - l_Size);
+            flush(l_Padded);
+            // Take the padding back off
+            m_Written -= l_Padded - l_Size;
+#ifdef _WIN32
+            FILE_END_OF_FILE_INFO l_EndOfFile;
+            l_EndOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(m_Written);
+            if (!SetFileInformationByHandle(m_Handle, FileEndOfFileInfo, &l_EndOfFile, sizeof(l_EndOfFile)))
+#else
+            if (ftruncate(m_Handle, static_cast<off_t>(m_Written)) != 0)
+#endif
+                throw std::runtime_error("Failed to truncate file: " + m_FilePath.string());
+        }
+        else
+        {
+            flush(l_Size);
+        }
+    }
+    close();
+}
+
+void swroo::FileWriter::flush(const usize p_Size)
+{
+    if (!writeNative(m_Handle, m_Buffer.getData(), p_Size, m_Written))
+        throw std::runtime_error("Failed to write file: " + m_FilePath.string());
+
+    m_Written += p_Size;
+    m_Staged = 0;
+}
+
+void swroo::FileWriter::rewrite(usize p_Offset, const u8* p_Data, usize p_Size)
+{
+    if (!m_Open || p_Offset > getSize() || p_Size > getSize() - p_Offset)
+        throw std::runtime_error("Rewrite is outside of written data: " + m_FilePath.string());
+
+    // Whatever is still staged is patched in memory
+    if (p_Offset + p_Size > m_Written)
+    {
+        const usize l_Start = std::max(p_Offset, m_Written);
+        std::memcpy(m_Buffer.getData() + (l_Start - m_Written), p_Data + (l_Start - p_Offset), p_Offset + p_Size - l_Start);
+        p_Size = l_Start - p_Offset;
+    }
+    if (p_Size == 0)
+        return;
+
+    if (m_Mode != IOMode::DIRECT)
+    {
+        if (!writeNative(m_Handle, p_Data, p_Size, p_Offset))
+            throw std::runtime_error("Failed to write file: " + m_FilePath.string());
+        return;
+    }
+
+    // Everything flushed so far ends on a sector boundary, so the surrounding sectors can be read, patched and written back
+    const utils::BufferPool::Buffer l_Bounce = getDirectIOPool().acquire();
+    while (p_Size > 0)
+    {
+        const usize l_Skip = p_Offset - alignDown(p_Offset);
+        const usize l_Size = std::min(alignUp(l_Skip + p_Size), l_Bounce.getSize());
+        const usize l_Copy = std::min(p_Size, l_Size - l_Skip);
+
+        usize l_Read = 0;
+        if (!readNative(m_Handle, l_Bounce.getData(), l_Size, p_Offset - l_Skip, l_Read) || l_Read != l_Size)
+            throw std::runtime_error("Failed to read file: " + m_FilePath.string());
+        std::memcpy(l_Bounce.getData() + l_Skip, p_Data, l_Copy);
+        if (!writeNative(m_Handle, l_Bounce.getData(), l_Size, p_Offset - l_Skip))
+            throw std::runtime_error("Failed to write file: " + m_FilePath.string());
+
+        p_Data += l_Copy;
+        p_Size -= l_Copy;
+        p_Offset += l_Copy;
+    }
+}
+
+void swroo::FileWriter::close()
+{
+    if (!m_Open)
+        return;
+
+#ifdef _WIN32
+    CloseHandle(m_Handle);
+#else
+    ::close(m_Handle);
+#endif
+    m_Open = false;
+}
@@ -1,14 +1,37 @@
 #pragma once
 #include "../util/common.hpp"
+#include "../util/buffer_pool.hpp"
+#include "../util/expected.hpp"
 
+#include <atomic>
 #include <filesystem>
-#include <fstream>
+#include <mutex>
 #include <span>
 
 namespace swroo {
+    enum class IOMode : u8
+    {
+        BUFFERED,
+        // Bypasses the page cache, for one-shot passes over more data than should be cached. Transfers go through
+        // aligned bounce buffers, so callers do not need to care about alignment.
+        DIRECT,
+    };
+
+    // Transfer size and alignment of direct I/O, 4 KiB covers both 512 byte and 4K sector drives
+    inline constexpr usize c_DirectIOAlignment = 0x1000;
+    inline constexpr usize c_DirectIOChunkSize = 0x100000;
+
+    [[nodiscard]] utils::BufferPool& getDirectIOPool();
+
     class FileReader
     {
     public:
+        struct ReadRequest
+        {
+            usize offset;
+            std::span<u8> buffer;
+        };
+
         virtual ~FileReader() = default;
 
         template<typename T>
@@ -20,7 +43,18 @@ namespace swroo {
         template<typename T>
         u32 readSpan(std::span<T> p_Vector, usize p_Size, usize p_Offset = UINT64_MAX);
 
+        // Report reads past the end of the file, which is how partial downloads show up, as TRUNCATED instead of
+        // throwing. I/O errors on data that is there still throw.
+        template<typename T>
+        utils::Error tryRead(T& p_Value, usize p_Offset, const char* p_Source);
+
+        template<typename T>
+        utils::Error tryReadData(T* p_Buffer, usize p_Size, usize p_Offset, const char* p_Source);
+
         virtual u32 readBytes(u8* p_Buffer, usize p_Size, usize p_NewOffset) = 0;
+        // Fills every buffer from its offset, leaving the current position alone. Readers that can fetch several ranges
+        // per system call do, the rest go through readBytes one request at a time. Throws like readBytes.
+        virtual void readv(std::span<const ReadRequest> p_Requests);
 
         [[nodiscard]] virtual usize getFileSize() const = 0;
         [[nodiscard]] virtual usize getCurrentPosition() = 0;
@@ -34,18 +68,34 @@ namespace swroo {
 
         virtual bool isOpen() = 0;
 
+        // Maps p_Offset into the reader that holds the bytes as stored, stepping through readers that only window their
+        // parent. Readers that transform what they read (decryption, patching) are their own backing file.
+        [[nodiscard]] virtual FileReader& getBackingFile(usize& /*p_Offset*/) { return *this; }
+
     protected:
-        u32 m_References = 0;
+        // Readers shared between threads are referenced and released from all of them
+        std::atomic<u32> m_References = 0;
     };
 
+    // Positional reads on a native handle, safe to share between threads as long as every read passes an offset
     class MainFileReader final : public FileReader
     {
     public:
-        explicit MainFileReader(const std::filesystem::path& p_File);
-        ~MainFileReader() override = default;
+        explicit MainFileReader(const std::filesystem::path& p_File, IOMode p_Mode = IOMode::BUFFERED);
+        MainFileReader(const MainFileReader&) = delete;
+        MainFileReader& operator=(const MainFileReader&) = delete;
+        ~MainFileReader() override;
 
-        [[nodiscard]] usize getFileSize() const override;
-        [[nodiscard]] usize getCurrentPosition() override;
+        // Returns a new reader, the caller takes ownership
+        [[nodiscard]] static utils::Expected<FileReader*> tryOpen(const std::filesystem::path& p_File, IOMode p_Mode = IOMode::BUFFERED);
+
+        void readv(std::span<const ReadRequest> p_Requests) override;
+
+        // DIRECT falls back to BUFFERED on file systems that cannot do it
+        [[nodiscard]] IOMode getMode() const { return m_Mode; }
+
+        [[nodiscard]] usize getFileSize() const override { return m_FileSize; }
+        [[nodiscard]] usize getCurrentPosition() override { return m_Position; }
         [[nodiscard]] usize getCurrentGlobalPosition() override { return getCurrentPosition(); }
         [[nodiscard]] std::filesystem::path getFilePath() const override { return m_FilePath; }
 
@@ -54,15 +104,40 @@ namespace swroo {
         void addRef() override;
         void release() override;
 
-        bool isOpen() override { return m_File.is_open(); }
+        bool isOpen() override { return m_Handle != c_InvalidHandle; }
 
     private:
+#ifdef _WIN32
+        using Handle = void*;
+        static inline const Handle c_InvalidHandle = reinterpret_cast<Handle>(static_cast<intptr_t>(-1)); // INVALID_HANDLE_VALUE
+#else
+        using Handle = i32;
+        static constexpr Handle c_InvalidHandle = -1;
+#endif
+        // Requests closer than this are fetched with one vectored read, the gap lands in a scratch buffer
+        static constexpr usize c_MaxReadvGap = 0x10000;
+
+        explicit MainFileReader(IOMode p_Mode) : m_Mode(p_Mode) { m_References = 1; }
+        utils::Error open(const std::filesystem::path& p_File);
+        void close();
+
         u32 readBytes(u8* p_Buffer, usize p_Size, usize p_NewOffset) override;
+        // Reads exactly p_Size bytes at p_Offset, false on error or end of file
+        bool readAt(u8* p_Buffer, usize p_Size, usize p_Offset) const;
+        // Same through aligned bounce buffers, unless the request is aligned already
+        bool readDirect(u8* p_Buffer, usize p_Size, usize p_Offset) const;
 
     private:
-        std::ifstream m_File;
+        Handle m_Handle = c_InvalidHandle;
         std::filesystem::path m_FilePath;
         usize m_FileSize = 0;
+        IOMode m_Mode = IOMode::BUFFERED;
+
+        // Only used by reads without an explicit offset
+        std::atomic<usize> m_Position = 0;
+
+        // Held while the handle is closed or reopened
+        std::mutex m_HandleMutex;
     };
 
     class SubFileReader final : public FileReader
@@ -71,6 +146,10 @@ namespace swroo {
         explicit SubFileReader(FileReader& p_MainFile, usize p_Offset, usize p_Size);
         ~SubFileReader() override;
 
+        // Returns a new reader, the caller takes ownership
+        [[nodiscard]] static utils::Expected<FileReader*> tryOpen(FileReader& p_MainFile, usize p_Offset, usize p_Size);
+        [[nodiscard]] static bool isInRange(const FileReader& p_MainFile, usize p_Offset, usize p_Size);
+
         [[nodiscard]] usize getFileSize() const override;
         [[nodiscard]] usize getCurrentPosition() override;
         [[nodiscard]] usize getCurrentGlobalPosition() override { return m_Offset + getCurrentPosition(); }
@@ -81,7 +160,11 @@ namespace swroo {
         void addRef() override;
         void release() override;
 
-        bool isOpen() override { return m_Released; }
+        bool isOpen() override { return m_References != 0; }
+
+        [[nodiscard]] FileReader& getBackingFile(usize& p_Offset) override;
+
+        void readv(std::span<const ReadRequest> p_Requests) override;
 
     private:
         u32 readBytes(u8* p_Buffer, usize p_Size, usize p_NewOffset) override;
@@ -90,9 +173,50 @@ namespace swroo {
         usize m_Offset = 0;
         usize m_Size = 0;
 
-        usize m_InternalOffset = 0;
+        // Only reads without an offset use and advance this. Reads that pass one leave it alone, those are what
+        // threads sharing the reader must use.
+        std::atomic<usize> m_InternalOffset = 0;
+    };
+
+    // Sequential writer that creates or truncates its file. Data is staged in pool buffers and written a chunk at a time,
+    // in DIRECT mode the last chunk is padded to the sector size and the file trimmed back afterwards.
+    class FileWriter
+    {
+    public:
+        explicit FileWriter(const std::filesystem::path& p_File, IOMode p_Mode = IOMode::BUFFERED);
+        FileWriter(const FileWriter&) = delete;
+        FileWriter& operator=(const FileWriter&) = delete;
+        // Finishes the file if finish() was not called, errors are lost at that point
+        ~FileWriter();
+
+        void write(const u8* p_Data, usize p_Size);
+        // Overwrites data that was already written, for headers that are only known once everything after them is
+        void rewrite(usize p_Offset, const u8* p_Data, usize p_Size);
+        // Writes what is still staged and closes the file, nothing can be written afterwards
+        void finish();
+
+        [[nodiscard]] usize getSize() const { return m_Written + m_Staged; }
+        [[nodiscard]] const std::filesystem::path& getFilePath() const { return m_FilePath; }
+        [[nodiscard]] IOMode getMode() const { return m_Mode; }
+
+    private:
+#ifdef _WIN32
+        using Handle = void*;
+#else
+        using Handle = i32;
+#endif
+
+        void flush(usize p_Size);
+        void close();
 
-        bool m_Released = false;
+        Handle m_Handle;
+        std::filesystem::path m_FilePath;
+        IOMode m_Mode;
+        bool m_Open = false;
+
+        utils::BufferPool::Buffer m_Buffer;
+        usize m_Staged = 0;
+        usize m_Written = 0;
     };
 
     template <typename T>
@@ -116,72 +240,45 @@ namespace swroo {
         return readBytes(reinterpret_cast<u8*>(p_Vector.data()), p_Size * sizeof(T), p_Offset);
     }
 
-    inline MainFileReader::MainFileReader(const std::filesystem::path& p_File)
-    {
-        m_FilePath = p_File;
-        m_File.open(m_FilePath, std::ios::binary | std::ios::ate);
-        if (!m_File.is_open())
-            throw std::runtime_error("Failed to open file: " + m_FilePath.string());
-        
-        m_FileSize = static_cast<usize>(MainFileReader::getCurrentPosition());
-        m_File.seekg(0, std::ios::beg);
-
-        m_References = 1;
-    }
-
-    inline usize MainFileReader::getFileSize() const
-    {
-        return m_FileSize;
-    }
-
-    inline usize MainFileReader::getCurrentPosition()
-    {
-        return m_File.tellg();
-    }
-
-    inline void MainFileReader::setCurrentPosition(const usize p_Position)
+    template <typename T>
+    utils::Error FileReader::tryRead(T& p_Value, const usize p_Offset, const char* p_Source)
     {
-        m_File.seekg(p_Position);
-        if (m_File.fail())
-            throw std::runtime_error("Failed to set file position: " + m_FilePath.string());
+        return tryReadData(&p_Value, sizeof(T), p_Offset, p_Source);
     }
 
-    inline void MainFileReader::release()
+    template <typename T>
+    utils::Error FileReader::tryReadData(T* p_Buffer, const usize p_Size, const usize p_Offset, const char* p_Source)
     {
-        m_References--;
+        const usize l_FileSize = getFileSize();
+        if (p_Offset > l_FileSize || p_Size > l_FileSize - p_Offset)
+            return { utils::ErrorCode::TRUNCATED, p_Source, p_Offset + p_Size };
 
-        if (m_References == 0)
-            m_File.close();
+        readBytes(reinterpret_cast<u8*>(p_Buffer), p_Size, p_Offset);
+        return {};
     }
 
-    inline void MainFileReader::addRef()
+    inline SubFileReader::SubFileReader(FileReader& p_MainFile, const usize p_Offset, const usize p_Size)
+        : m_ParentFile(p_MainFile), m_Offset(p_Offset), m_Size(p_Size)
     {
-        if (m_References == 0)
-            m_File.open(m_FilePath, std::ios::binary);
-
-        m_References++;
+        if (!isInRange(p_MainFile, p_Offset, p_Size))
+        {
+            throw std::runtime_error("Subfile size exceeds main file size");
+        }
+        m_ParentFile.addRef();
+        m_References = 1;
     }
 
-    inline u32 MainFileReader::readBytes(u8* p_Buffer, const usize p_Size, const usize p_NewOffset)
+    inline utils::Expected<FileReader*> SubFileReader::tryOpen(FileReader& p_MainFile, const usize p_Offset, const usize p_Size)
     {
-        if (p_NewOffset != UINT64_MAX)
-            setCurrentPosition(p_NewOffset);
-        
-        m_File.read(reinterpret_cast<char*>(p_Buffer), p_Size);
-        if (m_File.fail())
-            throw std::runtime_error("Failed to read file: " + m_FilePath.string());
-        
-        return static_cast<u32>(m_File.gcount());
+        if (!isInRange(p_MainFile, p_Offset, p_Size))
+            return utils::Error{ utils::ErrorCode::OUT_OF_RANGE, "subfile", p_Offset };
+        return new SubFileReader(p_MainFile, p_Offset, p_Size);
     }
 
-    inline SubFileReader::SubFileReader(FileReader& p_MainFile, const usize p_Offset, const usize p_Size)
-        : m_ParentFile(p_MainFile), m_Offset(p_Offset), m_Size(p_Size)
+    inline bool SubFileReader::isInRange(const FileReader& p_MainFile, const usize p_Offset, const usize p_Size)
     {
-        m_ParentFile.addRef();
-        if (p_Offset + p_Size > m_ParentFile.getFileSize())
-        {
-            throw std::runtime_error("Subfile size exceeds main file size");
-        }
+        const usize l_FileSize = p_MainFile.getFileSize();
+        return p_Offset <= l_FileSize && p_Size <= l_FileSize - p_Offset;
     }
 
     inline SubFileReader::~SubFileReader()
@@ -209,33 +306,58 @@ namespace swroo {
 
     inline void SubFileReader::release()
     {
-        if (m_Released)
-            return;
-        m_References--;
-        if (m_References == 0)
+        // The destructor releases too, a reader that was released already must not release its parent again
+        u32 l_References = m_References;
+        do
         {
+            if (l_References == 0)
+                return;
+        } while (!m_References.compare_exchange_weak(l_References, l_References - 1));
+
+        if (l_References == 1)
             m_ParentFile.release();
-            m_Released = true;
-        }
     }
 
     inline void SubFileReader::addRef()
     {
-        if (m_Released)
-        {
+        if (m_References++ == 0)
             m_ParentFile.addRef();
-            m_Released = false;
+    }
+
+    inline FileReader& SubFileReader::getBackingFile(usize& p_Offset)
+    {
+        p_Offset += m_Offset;
+        return m_ParentFile.getBackingFile(p_Offset);
+    }
+
+    inline void SubFileReader::readv(const std::span<const ReadRequest> p_Requests)
+    {
+        std::vector<ReadRequest> l_Requests(p_Requests.begin(), p_Requests.end());
+        for (ReadRequest& l_Request : l_Requests)
+        {
+            if (l_Request.offset > m_Size || l_Request.buffer.size() > m_Size - l_Request.offset)
+                throw std::runtime_error("Subfile read exceeds subfile size");
+            l_Request.offset += m_Offset;
         }
-        m_References++;
+        m_ParentFile.readv(l_Requests);
     }
 
     inline u32 SubFileReader::readBytes(u8* p_Buffer, const usize p_Size, const usize p_NewOffset)
     {
         if (p_NewOffset != UINT64_MAX)
-            setCurrentPosition(p_NewOffset);
+        {
+            if (p_NewOffset > m_Size || p_Size > m_Size - p_NewOffset)
+                throw std::runtime_error("Subfile read exceeds subfile size");
+            return m_ParentFile.readBytes(p_Buffer, p_Size, m_Offset + p_NewOffset);
+        }
 
-        const u32 l_ReadSize = m_ParentFile.readBytes(p_Buffer, p_Size, m_Offset + m_InternalOffset);
-        m_InternalOffset += l_ReadSize;
-        return l_ReadSize;
+        // Claims the range before reading it, so sequential readers on several threads never read the same bytes
+        const usize l_Position = m_InternalOffset.fetch_add(p_Size);
+        if (l_Position > m_Size || p_Size > m_Size - l_Position)
+        {
+            m_InternalOffset -= p_Size;
+            throw std::runtime_error("Subfile read exceeds subfile size");
+        }
+        return m_ParentFile.readBytes(p_Buffer, p_Size, m_Offset + l_Position);
     }
 }
@@ -0,0 +1,233 @@
+#include "file_registry.hpp"
+
+#include "loader/pfs.hpp"
+#include "loader/xci.hpp"
+#include "../engine.hpp"
+#include "../util/memory_usage.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+usize swroo::filesys::FileRegistry::FileIDHash::operator()(const FileID& p_ID) const
+{
+    // Inode numbers alone are already close to unique on one machine
+    return static_cast<usize>(p_ID.index ^ (p_ID.device << 32) ^ p_ID.size ^ static_cast<u64>(p_ID.modified));
+}
+
+bool swroo::filesys::FileRegistry::Record::isHeld() const
+{
+    // The containers hold a reference to the file themselves
+    const long l_Internal = 1 + (pfs ? 1 : 0) + (xci ? 1 : 0);
+    return file.use_count() > l_Internal || (pfs && pfs.use_count() > 1) || (xci && xci.use_count() > 1);
+}
+
+swroo::filesys::FileRegistry::FileRegistry(Engine& p_Engine, const std::chrono::steady_clock::duration p_IdleTime)
+    : m_Engine(p_Engine), m_IdleTime(p_IdleTime), m_LastSweep(std::chrono::steady_clock::now())
+{
+}
+
+swroo::filesys::FileRegistry::~FileRegistry()
+{
+    clear();
+}
+
+std::optional<swroo::filesys::FileRegistry::FileID> swroo::filesys::FileRegistry::getFileID(const std::filesystem::path& p_Path)
+{
+#ifdef _WIN32
+    // No access rights needed to read the file index, and nothing is locked for other openers
+    const HANDLE l_Handle = CreateFileW(p_Path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (l_Handle == INVALID_HANDLE_VALUE)
+        return std::nullopt;
+
+    BY_HANDLE_FILE_INFORMATION l_Info;
+    const bool l_Success = GetFileInformationByHandle(l_Handle, &l_Info);
+    CloseHandle(l_Handle);
+    if (!l_Success)
+        return std::nullopt;
+
+    return FileID{
+        l_Info.dwVolumeSerialNumber,
+        static_cast<u64>(l_Info.nFileIndexHigh) << 32 | l_Info.nFileIndexLow,
+        static_cast<u64>(l_Info.nFileSizeHigh) << 32 | l_Info.nFileSizeLow,
+        static_cast<i64>(static_cast<u64>(l_Info.ftLastWriteTime.dwHighDateTime) << 32 | l_Info.ftLastWriteTime.dwLowDateTime),
+    };
+#else
+    struct stat l_Stat;
+    if (stat(p_Path.c_str(), &l_Stat) != 0 || !S_ISREG(l_Stat.st_mode))
+        return std::nullopt;
+
+#ifdef __APPLE__
+    const timespec& l_Modified = l_Stat.st_mtimespec;
+#else
+    const timespec& l_Modified = l_Stat.st_mtim;
+#endif
+    return FileID{
+        static_cast<u64>(l_Stat.st_dev),
+        static_cast<u64>(l_Stat.st_ino),
+        static_cast<u64>(l_Stat.st_size),
+        static_cast<i64>(l_Modified.tv_sec) * 1000000000 + l_Modified.tv_nsec,
+    };
+#endif
+}
+
+swroo::utils::Expected<std::shared_ptr<swroo::filesys::FileRegistry::Record>> swroo::filesys::FileRegistry::openRecord(const std::filesystem::path& p_Path)
+{
+    const std::optional<FileID> l_ID = getFileID(p_Path);
+    if (!l_ID.has_value())
+        return utils::Error{ utils::ErrorCode::OPEN_FAILED, "file" };
+
+    const std::chrono::steady_clock::time_point l_Now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard l_Lock(m_Mutex);
+        if (l_Now - m_LastSweep >= m_IdleTime)
+            evict(l_Now, m_IdleTime);
+
+        if (const auto l_It = m_Records.find(*l_ID); l_It != m_Records.end())
+        {
+            ++m_Hits;
+            l_It->second->lastUsed = l_Now;
+            return l_It->second;
+        }
+    }
+
+    // Opened outside the lock, a slow disk must not hold up every other lookup
+    utils::Expected<FileReader*> l_File = MainFileReader::tryOpen(p_Path);
+    if (!l_File)
+        return l_File.getError();
+
+    const auto l_Record = std::make_shared<Record>();
+    l_Record->file.reset(l_File.getValue());
+    l_Record->lastUsed = l_Now;
+
+    std::shared_ptr<Record> l_Result;
+    {
+        std::lock_guard l_Lock(m_Mutex);
+        ++m_Misses;
+        // Another thread may have opened the same file meanwhile, its reader wins and this one is dropped
+        l_Result = m_Records.try_emplace(*l_ID, l_Record).first->second;
+    }
+
+    // The new file may have pushed the engine over its budget, the caller's handle keeps it from being evicted
+    m_Engine.enforceMemoryBudget();
+    return l_Result;
+}
+
+swroo::utils::Expected<std::shared_ptr<swroo::FileReader>> swroo::filesys::FileRegistry::openFile(const std::filesystem::path& p_Path)
+{
+    utils::Expected<std::shared_ptr<Record>> l_Record = openRecord(p_Path);
+    if (!l_Record)
+        return l_Record.getError();
+    return l_Record.getValue()->file;
+}
+
+swroo::utils::Expected<std::shared_ptr<swroo::filesys::PFS>> swroo::filesys::FileRegistry::openPFS0(const std::filesystem::path& p_Path)
+{
+    utils::Expected<std::shared_ptr<Record>> l_Record = openRecord(p_Path);
+    if (!l_Record)
+        return l_Record.getError();
+
+    Record& l_Value = *l_Record.getValue();
+    std::lock_guard l_Lock(l_Value.mutex);
+    if (!l_Value.pfs)
+    {
+        utils::Expected<PFS> l_PFS = PFS::tryOpen(l_Value.file.get(), &m_Engine, false);
+        if (!l_PFS)
+            return l_PFS.getError();
+
+        // The PFS only borrows the reader, its deleter keeps the reader alive for as long as the PFS is
+        l_Value.pfs = std::shared_ptr<PFS>(new PFS(l_PFS.takeValue()), [l_File = l_Value.file](const PFS* p_PFS) { delete p_PFS; });
+    }
+    return l_Value.pfs;
+}
+
+swroo::utils::Expected<std::shared_ptr<swroo::filesys::XCI>> swroo::filesys::FileRegistry::openXCI(const std::filesystem::path& p_Path)
+{
+    utils::Expected<std::shared_ptr<Record>> l_Record = openRecord(p_Path);
+    if (!l_Record)
+        return l_Record.getError();
+
+    Record& l_Value = *l_Record.getValue();
+    std::lock_guard l_Lock(l_Value.mutex);
+    if (!l_Value.xci)
+    {
+        try
+        {
+            l_Value.xci = std::shared_ptr<XCI>(new XCI(l_Value.file.get(), &m_Engine, false), [l_File = l_Value.file](const XCI* p_XCI) { delete p_XCI; });
+        }
+        catch (const std::exception&)
+        {
+            return utils::Error{ utils::ErrorCode::READ_FAILED, "XCI" };
+        }
+    }
+    return l_Value.xci;
+}
+
+usize swroo::filesys::FileRegistry::evictIdle()
+{
+    std::lock_guard l_Lock(m_Mutex);
+    return evict(std::chrono::steady_clock::now(), m_IdleTime);
+}
+
+usize swroo::filesys::FileRegistry::evictUnused()
+{
+    std::lock_guard l_Lock(m_Mutex);
+    return evict(std::chrono::steady_clock::now(), std::chrono::steady_clock::duration::zero());
+}
+
+usize swroo::filesys::FileRegistry::evict(const std::chrono::steady_clock::time_point p_Now, const std::chrono::steady_clock::duration p_IdleTime)
+{
+    m_LastSweep = p_Now;
+    const usize l_Evicted = std::erase_if(m_Records, [p_Now, p_IdleTime](const auto& p_Entry)
+    {
+        // Still shared with a caller that is about to open it
+        if (p_Entry.second.use_count() > 1)
+            return false;
+
+        Record& l_Record = *p_Entry.second;
+        if (p_Now - l_Record.lastUsed < p_IdleTime)
+            return false;
+
+        // A record being parsed is in use by definition
+        std::unique_lock l_Lock(l_Record.mutex, std::try_to_lock);
+        return l_Lock.owns_lock() && !l_Record.isHeld();
+    });
+    m_Evictions += l_Evicted;
+    return l_Evicted;
+}
+
+void swroo::filesys::FileRegistry::clear()
+{
+    std::lock_guard l_Lock(m_Mutex);
+    m_Records.clear();
+}
+
+swroo::filesys::FileRegistry::Stats swroo::filesys::FileRegistry::getStats() const
+{
+    std::lock_guard l_Lock(m_Mutex);
+    return { m_Records.size(), m_Hits, m_Misses, m_Evictions };
+}
+
+usize swroo::filesys::FileRegistry::getMemoryUsage() const
+{
+    std::lock_guard l_Lock(m_Mutex);
+    usize l_Usage = utils::getHashMapMemoryUsage(m_Records);
+    for (const auto& [l_ID, l_Record] : m_Records)
+    {
+        l_Usage += sizeof(Record) + sizeof(MainFileReader) + utils::getMemoryUsage(l_Record->file->getFilePath().native());
+
+        // A record being parsed is skipped, its containers are not complete yet
+        std::unique_lock l_RecordLock(l_Record->mutex, std::try_to_lock);
+        if (!l_RecordLock.owns_lock())
+            continue;
+        if (l_Record->pfs)
+            l_Usage += sizeof(PFS) + l_Record->pfs->getMemoryUsage();
+        if (l_Record->xci)
+            l_Usage += sizeof(XCI) + l_Record->xci->getMemoryUsage();
+    }
+    return l_Usage;
+}
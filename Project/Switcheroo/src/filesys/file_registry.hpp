@@ -0,0 +1,113 @@
+#pragma once
+#include "../util/common.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "file.hpp"
+
+namespace swroo
+{
+    class Engine;
+}
+
+namespace swroo::filesys
+{
+    class PFS;
+    class XCI;
+
+    // Files an Engine opened, by physical file. Every path that leads to the same file (links, relative paths, the same
+    // image reached from two library folders) shares one descriptor and one parsed container, so opening a title
+    // again is a map lookup. Files nobody holds any more are closed once they sat idle for the idle time. Thread safe.
+    class FileRegistry
+    {
+    public:
+        // Identifies a file independently of the path used to reach it. Size and modification time are part of it,
+        // a file changed in place gets a new reader instead of the stale one.
+        struct FileID
+        {
+            u64 device;
+            u64 index;
+            u64 size;
+            i64 modified;
+
+            bool operator==(const FileID&) const = default;
+        };
+
+        struct Stats
+        {
+            usize openFiles;
+            u64 hits;
+            u64 misses;
+            u64 evictions;
+        };
+
+        static constexpr std::chrono::seconds c_DefaultIdleTime{ 60 };
+
+        explicit FileRegistry(Engine& p_Engine, std::chrono::steady_clock::duration p_IdleTime = c_DefaultIdleTime);
+        FileRegistry(const FileRegistry&) = delete;
+        FileRegistry& operator=(const FileRegistry&) = delete;
+        ~FileRegistry();
+
+        // Buffered reader over the file, shared by every caller. Direct I/O is for single passes over a file and
+        // goes through MainFileReader directly.
+        [[nodiscard]] utils::Expected<std::shared_ptr<FileReader>> openFile(const std::filesystem::path& p_Path);
+        // Parsed by the first caller, every other caller gets the same PFS
+        [[nodiscard]] utils::Expected<std::shared_ptr<PFS>> openPFS0(const std::filesystem::path& p_Path);
+        // Partitions are parsed on first use
+        [[nodiscard]] utils::Expected<std::shared_ptr<XCI>> openXCI(const std::filesystem::path& p_Path);
+
+        // Closes files that no caller holds and that were not opened again for the idle time, returns how many.
+        // Opening files runs it too, at most once per idle time.
+        usize evictIdle();
+        // Same regardless of the idle time, for when memory runs short
+        usize evictUnused();
+        // Forgets every file, those still held stay open until their last handle goes
+        void clear();
+
+        [[nodiscard]] Stats getStats() const;
+        // Bytes held by the open files and their parsed containers
+        [[nodiscard]] usize getMemoryUsage() const;
+
+        [[nodiscard]] static std::optional<FileID> getFileID(const std::filesystem::path& p_Path);
+
+    private:
+        struct FileIDHash
+        {
+            usize operator()(const FileID& p_ID) const;
+        };
+
+        struct Record
+        {
+            std::shared_ptr<FileReader> file;
+            std::chrono::steady_clock::time_point lastUsed;
+
+            // Held while containers are parsed, parsing one file never blocks opening another
+            std::mutex mutex;
+            std::shared_ptr<PFS> pfs;
+            std::shared_ptr<XCI> xci;
+
+            // Someone other than the registry still has a handle, needs mutex
+            [[nodiscard]] bool isHeld() const;
+        };
+
+        [[nodiscard]] utils::Expected<std::shared_ptr<Record>> openRecord(const std::filesystem::path& p_Path);
+        // Needs m_Mutex
+        usize evict(std::chrono::steady_clock::time_point p_Now, std::chrono::steady_clock::duration p_IdleTime);
+
+        Engine& m_Engine;
+        std::chrono::steady_clock::duration m_IdleTime;
+
+        mutable std::mutex m_Mutex;
+        std::unordered_map<FileID, std::shared_ptr<Record>, FileIDHash> m_Records;
+        std::chrono::steady_clock::time_point m_LastSweep;
+
+        u64 m_Hits = 0;
+        u64 m_Misses = 0;
+        u64 m_Evictions = 0;
+    };
+}
@@ -0,0 +1,85 @@
+#include "io_scheduler.hpp"
+
+#include <algorithm>
+
+swroo::IOScheduler::IOScheduler(const usize p_MaxGap, const usize p_MaxReadSize)
+    : m_MaxGap(p_MaxGap), m_MaxReadSize(p_MaxReadSize)
+{
+}
+
+void swroo::IOScheduler::enqueue(FileReader& p_File, const usize p_Offset, const usize p_Size, Callback p_Callback)
+{
+    add(p_File, p_Offset, p_Size, std::move(p_Callback), nullptr);
+}
+
+void swroo::IOScheduler::enqueue(FileReader& p_File, const usize p_Offset, const usize p_Size, u8* p_Destination)
+{
+    add(p_File, p_Offset, p_Size, nullptr, p_Destination);
+}
+
+void swroo::IOScheduler::add(FileReader& p_File, const usize p_Offset, const usize p_Size, Callback p_Callback, u8* p_Destination)
+{
+    if (p_Offset > p_File.getFileSize() || p_Size > p_File.getFileSize() - p_Offset)
+        throw std::runtime_error("Scheduled read is out of range: " + p_File.getFilePath().string());
+
+    usize l_Offset = p_Offset;
+    FileReader& l_Backing = p_File.getBackingFile(l_Offset);
+    m_Requests.push_back({ &l_Backing, l_Offset, p_Size, std::move(p_Callback), p_Destination });
+}
+
+void swroo::IOScheduler::complete(const Request& p_Request, const u8* p_Data)
+{
+    if (p_Request.destination != nullptr)
+        std::memcpy(p_Request.destination, p_Data, p_Request.size);
+    else
+        p_Request.callback(p_Data, p_Request.size);
+}
+
+void swroo::IOScheduler::run()
+{
+    std::vector<Request> l_Requests = std::move(m_Requests);
+    m_Requests.clear();
+
+    // Grouped by backing file, ascending offsets within each
+    std::ranges::sort(l_Requests, [](const Request& p_Left, const Request& p_Right)
+    {
+        if (p_Left.file != p_Right.file)
+            return std::less<FileReader*>()(p_Left.file, p_Right.file);
+        return p_Left.offset < p_Right.offset;
+    });
+
+    usize i = 0;
+    while (i < l_Requests.size())
+    {
+        const Request& l_First = l_Requests[i];
+        const usize l_Start = l_First.offset;
+        usize l_End = l_First.offset + l_First.size;
+
+        usize l_Next = i + 1;
+        for (; l_Next < l_Requests.size(); ++l_Next)
+        {
+            const Request& l_Request = l_Requests[l_Next];
+            const usize l_RequestEnd = l_Request.offset + l_Request.size;
+            if (l_Request.file != l_First.file || l_Request.offset > l_End + m_MaxGap || std::max(l_End, l_RequestEnd) - l_Start > m_MaxReadSize)
+                break;
+            l_End = std::max(l_End, l_RequestEnd);
+        }
+
+        ++m_ReadCount;
+        if (l_Next == i + 1 && l_First.destination != nullptr)
+        {
+            // Nothing to merge, skip the copy
+            l_First.file->readData(l_First.destination, l_First.size, l_First.offset);
+        }
+        else
+        {
+            if (m_Buffer.size() < l_End - l_Start)
+                m_Buffer.resize(l_End - l_Start);
+            l_First.file->readData(m_Buffer.data(), l_End - l_Start, l_Start);
+
+            for (usize j = i; j < l_Next; ++j)
+                complete(l_Requests[j], m_Buffer.data() + (l_Requests[j].offset - l_Start));
+        }
+        i = l_Next;
+    }
+}
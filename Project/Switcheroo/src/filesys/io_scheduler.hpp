@@ -0,0 +1,53 @@
+#pragma once
+#include "../util/common.hpp"
+
+#include "file.hpp"
+
+namespace swroo
+{
+    // Collects reads against any number of readers and issues them ordered by where the bytes sit in the backing file,
+    // with neighbouring requests merged into one larger read. For operations that touch many entries or sections at
+    // once, whose logical order rarely matches the on-disk one. Not thread safe.
+    class IOScheduler
+    {
+    public:
+        // The data is only valid for the duration of the call
+        using Callback = std::function<void(const u8* p_Data, usize p_Size)>;
+
+        static constexpr usize c_DefaultMaxGap = 0x10000; // Reading and dropping this much is cheaper than a seek
+        static constexpr usize c_DefaultMaxReadSize = 0x800000;
+
+        explicit IOScheduler(usize p_MaxGap = c_DefaultMaxGap, usize p_MaxReadSize = c_DefaultMaxReadSize);
+
+        void enqueue(FileReader& p_File, usize p_Offset, usize p_Size, Callback p_Callback);
+        // p_Destination must stay valid until run() returns
+        void enqueue(FileReader& p_File, usize p_Offset, usize p_Size, u8* p_Destination);
+
+        // Issues and completes every queued request in backing file order, then clears the queue. A failed read throws
+        // like FileReader does and drops whatever was still pending.
+        void run();
+
+        [[nodiscard]] usize getPendingCount() const { return m_Requests.size(); }
+        [[nodiscard]] usize getReadCount() const { return m_ReadCount; }
+
+    private:
+        struct Request
+        {
+            FileReader* file; // Backing file, p_File of enqueue resolved through its sub readers
+            usize offset;
+            usize size;
+            Callback callback;
+            u8* destination;
+        };
+
+        void add(FileReader& p_File, usize p_Offset, usize p_Size, Callback p_Callback, u8* p_Destination);
+        static void complete(const Request& p_Request, const u8* p_Data);
+
+        std::vector<Request> m_Requests;
+        std::vector<u8> m_Buffer;
+
+        usize m_MaxGap;
+        usize m_MaxReadSize;
+        usize m_ReadCount = 0;
+    };
+}
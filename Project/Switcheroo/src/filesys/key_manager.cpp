@@ -1,8 +1,14 @@
 #include "key_manager.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 
+#include "ticket.hpp"
+#include "../util/crypto/aes.hpp"
+#include "../util/crypto/rsa.hpp"
+#include "../util/memory_usage.hpp"
+
 std::unordered_map<std::string, swroo::filesys::KeyData> swroo::filesys::KeyManager::m_KeyNames{
     {"eticket_rsa_kek_source",          {KeyData::K128, KeyData::K128Type::SOURCE,          11, 0}},
     {"eticket_rsa_kekek_source",        {KeyData::K128, KeyData::K128Type::SOURCE,          12, 0}},
@@ -206,6 +212,8 @@ swroo::filesys::KeyManager::KeyManager(const std::filesystem::path& p_ProdKeys,
     }
 }
 
+swroo::filesys::KeyManager::~KeyManager() = default;
+
 const ByteArray<0x20>& swroo::filesys::KeyManager::getKey(const KeyData::KeySize p_Size, const u8 p_KeyType, const u64 p_First, const u64 p_Second) const
 {
     const KeyData l_KeyData{
@@ -214,9 +222,10 @@ const ByteArray<0x20>& swroo::filesys::KeyManager::getKey(const KeyData::KeySize
         .first = p_First,
         .second = p_Second
     };
-    if (m_Keys.contains(l_KeyData))
+    std::shared_lock l_Lock(m_KeyMutex);
+    if (const auto l_It = m_Keys.find(l_KeyData); l_It != m_Keys.end())
     {
-        return m_Keys.at(l_KeyData);
+        return l_It->second;
     }
     throw std::runtime_error("Key not found: " + std::to_string(p_Size) + ", " + std::to_string(p_KeyType) + ", " + std::to_string(p_First) + ", " + std::to_string(p_Second));
 }
@@ -229,6 +238,7 @@ bool swroo::filesys::KeyManager::hasKey(const KeyData::KeySize p_Size, const u8
         .first = p_First,
         .second = p_Second
     };
+    std::shared_lock l_Lock(m_KeyMutex);
     return m_Keys.contains(l_KeyData);
 }
 
@@ -254,3 +264,109 @@ const ByteArray<0x240>& swroo::filesys::KeyManager::getExtendedETicket() const
 {
     return m_ExtendedETicket;
 }
+
+static swroo::filesys::KeyData makeTitleKeyData(const ByteArray<0x10>& p_RightsID)
+{
+    swroo::filesys::KeyData l_KeyData{ .keySize = swroo::filesys::KeyData::K128, .keyType = swroo::filesys::KeyData::K128Type::TITLE_KEY, .first = 0, .second = 0 };
+    std::memcpy(&l_KeyData.first, p_RightsID.data(), sizeof(u64));
+    std::memcpy(&l_KeyData.second, p_RightsID.data() + sizeof(u64), sizeof(u64));
+    return l_KeyData;
+}
+
+swroo::crypto::RSA& swroo::filesys::KeyManager::getETicketRSA()
+{
+    if (m_ETicketRSA)
+        return *m_ETicketRSA;
+
+    // The extended kek is a CTR counter followed by the encrypted private exponent, modulus and public exponent
+    if (utils::isZero(m_ExtendedETicket.data(), m_ExtendedETicket.size()))
+        throw std::runtime_error("Personalized tickets need eticket_extended_kek");
+
+    const ByteArray<0x20>& l_Kek = getKey(KeyData::K128, KeyData::K128Type::ETICKET_RSA_KEK);
+    ByteArray<0x10> l_Counter;
+    std::memcpy(l_Counter.data(), m_ExtendedETicket.data(), l_Counter.size());
+
+    ByteArray<0x230> l_Decrypted;
+    crypto::AES l_AES(l_Kek.data(), crypto::AES::Mode::CTR);
+    if (!l_AES.decryptCTR(m_ExtendedETicket.data() + 0x10, l_Decrypted.data(), l_Decrypted.size(), l_Counter))
+        throw std::runtime_error("Failed to decrypt eticket_extended_kek");
+
+    ByteArray<crypto::RSA::c_KeySize> l_PrivateExponent, l_Modulus;
+    ByteArray<crypto::RSA::c_PublicExponentSize> l_PublicExponent;
+    std::memcpy(l_PrivateExponent.data(), l_Decrypted.data(), l_PrivateExponent.size());
+    std::memcpy(l_Modulus.data(), l_Decrypted.data() + 0x100, l_Modulus.size());
+    std::memcpy(l_PublicExponent.data(), l_Decrypted.data() + 0x200, l_PublicExponent.size());
+
+    m_ETicketRSA = std::make_unique<crypto::RSA>(l_Modulus, l_PrivateExponent, l_PublicExponent);
+    return *m_ETicketRSA;
+}
+
+bool swroo::filesys::KeyManager::importTicket(const Ticket& p_Ticket)
+{
+    const KeyData l_KeyData = makeTitleKeyData(p_Ticket.getRightsID());
+    if (hasKey(KeyData::K128, KeyData::K128Type::TITLE_KEY, l_KeyData.first, l_KeyData.second))
+        return true;
+
+    ByteArray<0x20> l_TitleKey{};
+    if (!p_Ticket.isPersonalized())
+    {
+        std::memcpy(l_TitleKey.data(), p_Ticket.getData().titleKeyBlock.data(), 0x10);
+        std::unique_lock l_Lock(m_KeyMutex);
+        m_Keys.try_emplace(l_KeyData, l_TitleKey);
+        return true;
+    }
+
+    // The RSA context is created on first use and is not safe to share. The key is stored before the lock is
+    // released, so when several threads import the same ticket only the first one unwraps it
+    std::lock_guard l_RSALock(m_ETicketMutex);
+    if (hasKey(KeyData::K128, KeyData::K128Type::TITLE_KEY, l_KeyData.first, l_KeyData.second))
+        return true;
+
+    const std::optional<std::vector<u8>> l_Unwrapped = getETicketRSA().decryptOAEP(p_Ticket.getData().titleKeyBlock.data());
+    if (!l_Unwrapped.has_value() || l_Unwrapped->size() < 0x10)
+        return false;
+    std::memcpy(l_TitleKey.data(), l_Unwrapped->data(), 0x10);
+
+    std::unique_lock l_Lock(m_KeyMutex);
+    m_Keys.try_emplace(l_KeyData, l_TitleKey);
+    return true;
+}
+
+ByteArray<0x10> swroo::filesys::KeyManager::getTitleKey(const ByteArray<0x10>& p_RightsID, const u8 p_KeyGeneration)
+{
+    // The rights ID already encodes the key generation, so it alone identifies the decrypted key
+    const KeyData l_KeyData = makeTitleKeyData(p_RightsID);
+
+    std::lock_guard l_Lock(m_TitleKeyMutex);
+    const auto l_It = m_DecryptedTitleKeys.find(l_KeyData);
+    if (l_It != m_DecryptedTitleKeys.end())
+        return l_It->second;
+
+    const ByteArray<0x20>& l_TitleKey = getKey(KeyData::K128, KeyData::K128Type::TITLE_KEY, l_KeyData.first, l_KeyData.second);
+    const ByteArray<0x20>& l_TitleKek = getKey(KeyData::KVAR, KeyData::K128Type::TITLE_KEK, p_KeyGeneration);
+
+    ByteArray<0x10> l_Key;
+    crypto::AES l_AES(l_TitleKek.data(), crypto::AES::Mode::ECB);
+    if (!l_AES.decryptECB(l_TitleKey.data(), l_Key.data(), l_Key.size()))
+        throw std::runtime_error("Failed to decrypt title key");
+
+    m_DecryptedTitleKeys.emplace(l_KeyData, l_Key);
+    return l_Key;
+}
+
+usize swroo::filesys::KeyManager::getMemoryUsage() const
+{
+    usize l_Usage = utils::getHashMapMemoryUsage(m_Keyblobs) + utils::getHashMapMemoryUsage(m_EncryptedKeyblobs);
+    {
+        std::shared_lock l_Lock(m_KeyMutex);
+        l_Usage += utils::getHashMapMemoryUsage(m_Keys);
+    }
+    {
+        std::lock_guard l_Lock(m_ETicketMutex);
+        if (m_ETicketRSA)
+            l_Usage += sizeof(crypto::RSA);
+    }
+
+    std::lock_guard l_Lock(m_TitleKeyMutex);
+    return l_Usage + utils::getHashMapMemoryUsage(m_DecryptedTitleKeys);
+}
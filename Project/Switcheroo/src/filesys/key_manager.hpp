@@ -3,6 +3,9 @@
 
 #include <unordered_map>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 
 namespace swroo::filesys
 {
@@ -64,12 +67,20 @@ struct std::hash<swroo::filesys::KeyData>
     }
 };
 
+namespace swroo::crypto
+{
+    class RSA;
+}
+
 namespace swroo::filesys
 {
+    class Ticket;
+
     class KeyManager
     {
     public:
         explicit KeyManager(const std::filesystem::path& p_ProdKeys, const std::filesystem::path& p_TitleKeys);
+        ~KeyManager();
 
         [[nodiscard]] const ByteArray<0x20>& getKey(KeyData::KeySize p_Size, u8 p_KeyType, u64 p_First = 0, u64 p_Second = 0) const;
         [[nodiscard]] bool hasKey(KeyData::KeySize p_Size, u8 p_KeyType, u64 p_First = 0, u64 p_Second = 0) const;
@@ -77,13 +88,31 @@ namespace swroo::filesys
         [[nodiscard]] const ByteArray<0xB0>& getEncryptedKeyblob(u32 p_KeyblobID) const;
         [[nodiscard]] const ByteArray<0x240>& getExtendedETicket() const;
 
+        // Adds the title key of a ticket to the store, like an entry of title.keys. Personalized keys are RSA unwrapped,
+        // which only happens the first time a rights ID is seen. Safe to run while other threads look keys up.
+        bool importTicket(const Ticket& p_Ticket);
+        // Title key for the rights ID, decrypted with the title KEK of p_KeyGeneration and remembered afterwards
+        [[nodiscard]] ByteArray<0x10> getTitleKey(const ByteArray<0x10>& p_RightsID, u8 p_KeyGeneration);
+
+        // Bytes held by the key tables, title keys included
+        [[nodiscard]] usize getMemoryUsage() const;
+
     private:
+        [[nodiscard]] crypto::RSA& getETicketRSA();
+
         static std::unordered_map<std::string, KeyData> m_KeyNames;
 
+        // Tickets add keys while other threads read them. Entries are never removed, so references outlive the lock.
         std::unordered_map<KeyData, ByteArray<0x20>> m_Keys{};
+        mutable std::shared_mutex m_KeyMutex;
         std::unordered_map<u32,     ByteArray<0x90>> m_Keyblobs{};
         std::unordered_map<u32,     ByteArray<0xB0>> m_EncryptedKeyblobs{};
 
         ByteArray<0x240> m_ExtendedETicket;
+        std::unique_ptr<crypto::RSA> m_ETicketRSA;
+        mutable std::mutex m_ETicketMutex;
+
+        std::unordered_map<KeyData, ByteArray<0x10>> m_DecryptedTitleKeys{};
+        mutable std::mutex m_TitleKeyMutex;
     };
 }
@@ -0,0 +1,205 @@
+#include "bktr.hpp"
+
+#include "../crypto_file.hpp"
+#include <algorithm>
+
+static constexpr usize c_BucketSize = 0x4000;
+
+template<typename Entry, typename Callback>
+static u64 readBucketTree(swroo::FileReader& p_Table, const Callback& p_Callback)
+{
+    const usize l_TableSize = p_Table.getFileSize();
+    if (l_TableSize < c_BucketSize)
+        throw std::runtime_error("BKTR table is too small");
+
+    // The whole table is read at once, it is only a few buckets in practice
+    std::vector<u8> l_Data(l_TableSize);
+    p_Table.readData(l_Data.data(), l_Data.size(), 0);
+
+    u32 l_BucketCount;
+    u64 l_TotalSize;
+    std::memcpy(&l_BucketCount, l_Data.data() + 0x4, sizeof(u32));
+    std::memcpy(&l_TotalSize, l_Data.data() + 0x8, sizeof(u64));
+
+    constexpr usize l_MaxEntries = (c_BucketSize - 0x10) / sizeof(Entry);
+    if (c_BucketSize * (static_cast<usize>(l_BucketCount) + 1) > l_TableSize)
+        throw std::runtime_error("BKTR bucket count exceeds table size");
+
+    for (u32 l_Bucket = 0; l_Bucket < l_BucketCount; ++l_Bucket)
+    {
+        const u8* l_BucketData = l_Data.data() + c_BucketSize * (l_Bucket + 1);
+
+        u32 l_EntryCount;
+        std::memcpy(&l_EntryCount, l_BucketData + 0x4, sizeof(u32));
+        if (l_EntryCount > l_MaxEntries)
+            throw std::runtime_error("BKTR bucket entry count exceeds bucket size");
+
+        for (u32 l_EntryIdx = 0; l_EntryIdx < l_EntryCount; ++l_EntryIdx)
+        {
+            Entry l_Entry;
+            std::memcpy(&l_Entry, l_BucketData + 0x10 + l_EntryIdx * sizeof(Entry), sizeof(Entry));
+            p_Callback(l_Entry);
+        }
+    }
+
+    return l_TotalSize;
+}
+
+// Index of the interval containing p_Value, p_Starts holding p_Count + 1 sorted bounds. The loop
+// body compiles to a conditional move, the trip count only depends on p_Count.
+static usize searchIntervals(const u64* p_Starts, const usize p_Count, const u64 p_Value)
+{
+    const u64* l_Base = p_Starts;
+    usize l_Length = p_Count;
+    while (l_Length > 1)
+    {
+        const usize l_Half = l_Length / 2;
+        l_Base = l_Base[l_Half] <= p_Value ? l_Base + l_Half : l_Base;
+        l_Length -= l_Half;
+    }
+    return static_cast<usize>(l_Base - p_Starts);
+}
+
+static usize findInterval(const std::vector<u64>& p_Starts, const u64 p_Value, usize& p_Hint)
+{
+    const usize l_Count = p_Starts.size() - 1;
+    if (p_Value < p_Starts.front() || p_Value >= p_Starts.back())
+        throw std::runtime_error("BKTR offset out of range: " + std::to_string(p_Value));
+
+    if (p_Hint < l_Count && p_Starts[p_Hint] <= p_Value)
+    {
+        if (p_Value < p_Starts[p_Hint + 1])
+            return p_Hint;
+        if (p_Hint + 1 < l_Count && p_Value < p_Starts[p_Hint + 2])
+            return ++p_Hint;
+    }
+
+    p_Hint = searchIntervals(p_Starts.data(), l_Count, p_Value);
+    return p_Hint;
+}
+
+swroo::filesys::BKTR::BKTR(FileReader& p_RelocationTable, FileReader& p_SubsectionTable, const u64 p_TablesOffset, const u32 p_TablesCounter)
+{
+    const u64 l_VirtualSize = readBucketTree<RelocationEntry>(p_RelocationTable, [this](const RelocationEntry& p_Entry)
+    {
+        m_RelocationStarts.push_back(p_Entry.virtualOffset);
+        m_RelocationPhysical.push_back(p_Entry.physicalOffset);
+        m_RelocationPatched.push_back(p_Entry.isPatch != 0);
+    });
+
+    readBucketTree<SubsectionEntry>(p_SubsectionTable, [this](const SubsectionEntry& p_Entry)
+    {
+        m_SubsectionStarts.push_back(p_Entry.offset);
+        m_SubsectionCounters.push_back(p_Entry.counter);
+    });
+
+    if (m_RelocationStarts.empty() || m_RelocationStarts.front() != 0)
+        throw std::runtime_error("BKTR relocation table does not start at offset 0");
+
+    // The tables themselves sit after the last subsection and use the regular section counter
+    m_SubsectionStarts.push_back(p_TablesOffset);
+    m_SubsectionCounters.push_back(p_TablesCounter);
+
+    m_RelocationStarts.push_back(l_VirtualSize);
+    m_SubsectionStarts.push_back(p_TablesOffset + p_RelocationTable.getFileSize() + p_SubsectionTable.getFileSize());
+
+    if (!std::ranges::is_sorted(m_RelocationStarts) || !std::ranges::is_sorted(m_SubsectionStarts))
+        throw std::runtime_error("BKTR tables are not sorted");
+}
+
+usize swroo::filesys::BKTR::findRelocation(const u64 p_VirtualOffset, Cursor& p_Cursor) const
+{
+    return findInterval(m_RelocationStarts, p_VirtualOffset, p_Cursor.relocation);
+}
+
+usize swroo::filesys::BKTR::findSubsection(const u64 p_PhysicalOffset, Cursor& p_Cursor) const
+{
+    return findInterval(m_SubsectionStarts, p_PhysicalOffset, p_Cursor.subsection);
+}
+
+ByteArray<0x10> swroo::filesys::BKTR::makeCounter(const ByteArray<0x10>& p_SectionCounter, u32 p_SubsectionCounter)
+{
+    ByteArray<0x10> l_Counter = p_SectionCounter;
+    for (i32 i = 0x7; i >= 0x4; i--)
+    {
+        l_Counter[i] = static_cast<u8>(p_SubsectionCounter & 0xFF);
+        p_SubsectionCounter >>= 8;
+    }
+    return l_Counter;
+}
+
+swroo::filesys::BKTRFileReader::BKTRFileReader(FileReader* p_BaseSection, FileReader& p_PatchFile, const usize p_SectionOffset, const usize p_SectionSize, BKTR&& p_Table,
+                                               const ByteArray<0x10>& p_Key, const ByteArray<0x10>& p_SectionCounter, const usize p_Offset, const usize p_Size)
+    : m_BaseSection(p_BaseSection), m_Storage(p_PatchFile, p_SectionOffset, p_SectionSize), m_SectionOffset(p_SectionOffset), m_Table(std::move(p_Table)),
+      m_AES(p_Key.data(), crypto::AES::Mode::CTR), m_SectionCounter(p_SectionCounter), m_Offset(p_Offset)
+{
+    if (p_SectionOffset % 0x10 != 0)
+        throw std::runtime_error("BKTR section must start on an AES block boundary");
+
+    if (p_Offset > m_Table.getVirtualSize())
+        throw std::runtime_error("Offset exceeds BKTR virtual size");
+
+    m_Size = std::min(p_Size, static_cast<usize>(m_Table.getVirtualSize()) - p_Offset);
+}
+
+swroo::filesys::BKTRFileReader::~BKTRFileReader()
+{
+    delete m_BaseSection;
+}
+
+void swroo::filesys::BKTRFileReader::setCurrentPosition(const usize p_Position)
+{
+    if (p_Position > m_Size)
+        throw std::runtime_error("BKTR file position exceeds file size");
+
+    m_Position = p_Position;
+}
+
+u32 swroo::filesys::BKTRFileReader::readBytes(u8* p_Buffer, const usize p_Size, const usize p_NewOffset)
+{
+    if (p_NewOffset != UINT64_MAX)
+        setCurrentPosition(p_NewOffset);
+
+    if (p_Size > m_Size - m_Position)
+        throw std::runtime_error("BKTR read exceeds file size: " + getFilePath().string());
+
+    usize l_Done = 0;
+    while (l_Done < p_Size)
+    {
+        const u64 l_Virtual = m_Offset + m_Position + l_Done;
+        const usize l_Entry = m_Table.findRelocation(l_Virtual, m_Cursor);
+
+        const usize l_Chunk = std::min(p_Size - l_Done, static_cast<usize>(m_Table.getRelocationEnd(l_Entry) - l_Virtual));
+        const u64 l_Physical = m_Table.getRelocationPhysical(l_Entry) + (l_Virtual - m_Table.getRelocationStart(l_Entry));
+
+        if (m_Table.isRelocationPatched(l_Entry))
+            readPatch(p_Buffer + l_Done, l_Chunk, l_Physical);
+        else
+            m_BaseSection->readData(p_Buffer + l_Done, l_Chunk, l_Physical);
+
+        l_Done += l_Chunk;
+    }
+
+    m_Position += p_Size;
+    return static_cast<u32>(p_Size);
+}
+
+void swroo::filesys::BKTRFileReader::readPatch(u8* p_Buffer, const usize p_Size, const u64 p_PhysicalOffset)
+{
+    FileReader& l_Storage = m_Storage;
+
+    usize l_Done = 0;
+    while (l_Done < p_Size)
+    {
+        const u64 l_Physical = p_PhysicalOffset + l_Done;
+        const usize l_Subsection = m_Table.findSubsection(l_Physical, m_Cursor);
+        const usize l_Chunk = std::min(p_Size - l_Done, static_cast<usize>(m_Table.getSubsectionEnd(l_Subsection) - l_Physical));
+
+        // Same key schedule for every subsection, only the counter changes
+        const ByteArray<0x10> l_Counter = BKTR::makeCounter(m_SectionCounter, m_Table.getSubsectionCounter(l_Subsection));
+        if (!CTRFileReader::readDecrypted(l_Storage, m_AES, l_Counter, m_SectionOffset, p_Buffer + l_Done, l_Chunk, l_Physical))
+            throw std::runtime_error("Failed to decrypt BKTR subsection: " + getFilePath().string());
+
+        l_Done += l_Chunk;
+    }
+}
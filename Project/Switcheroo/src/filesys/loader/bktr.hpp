@@ -0,0 +1,133 @@
+#pragma once
+#include "../../util/common.hpp"
+
+#include "../file.hpp"
+#include "../../util/crypto/aes.hpp"
+
+namespace swroo::filesys
+{
+    // Relocation and subsection tables of an update (BKTR) section, flattened into sorted interval
+    // arrays. Interval i covers [starts[i], starts[i + 1]), the last start being a sentinel.
+    class BKTR
+    {
+    public:
+        // Per-reader lookup hints, sequential reads almost always hit the last interval or the next one
+        struct Cursor
+        {
+            usize relocation = 0;
+            usize subsection = 0;
+        };
+
+        // Both readers must cover their table decrypted with the regular section counter. p_TablesOffset
+        // is where the tables start inside the patch section, the data after it uses p_TablesCounter.
+        explicit BKTR(FileReader& p_RelocationTable, FileReader& p_SubsectionTable, u64 p_TablesOffset, u32 p_TablesCounter);
+
+        [[nodiscard]] u64 getVirtualSize() const { return m_RelocationStarts.back(); }
+
+        [[nodiscard]] usize findRelocation(u64 p_VirtualOffset, Cursor& p_Cursor) const;
+        [[nodiscard]] u64 getRelocationStart(const usize p_Index) const { return m_RelocationStarts[p_Index]; }
+        [[nodiscard]] u64 getRelocationEnd(const usize p_Index) const { return m_RelocationStarts[p_Index + 1]; }
+        [[nodiscard]] u64 getRelocationPhysical(const usize p_Index) const { return m_RelocationPhysical[p_Index]; }
+        [[nodiscard]] bool isRelocationPatched(const usize p_Index) const { return m_RelocationPatched[p_Index] != 0; }
+        [[nodiscard]] usize getRelocationCount() const { return m_RelocationPhysical.size(); }
+
+        [[nodiscard]] usize findSubsection(u64 p_PhysicalOffset, Cursor& p_Cursor) const;
+        [[nodiscard]] u64 getSubsectionStart(const usize p_Index) const { return m_SubsectionStarts[p_Index]; }
+        [[nodiscard]] u64 getSubsectionEnd(const usize p_Index) const { return m_SubsectionStarts[p_Index + 1]; }
+        [[nodiscard]] u32 getSubsectionCounter(const usize p_Index) const { return m_SubsectionCounters[p_Index]; }
+        [[nodiscard]] usize getSubsectionCount() const { return m_SubsectionCounters.size(); }
+
+        // Replaces the generation half of the section counter with the subsection one
+        [[nodiscard]] static ByteArray<0x10> makeCounter(const ByteArray<0x10>& p_SectionCounter, u32 p_SubsectionCounter);
+
+    private:
+#pragma pack(push, 1)
+        struct TableHeader
+        {
+            PADDING(0x4);
+            u32 bucketCount;
+            u64 totalSize;
+            std::array<u64, 0x7FE> bucketOffsets;
+        };
+
+        struct BucketHeader
+        {
+            PADDING(0x4);
+            u32 entryCount;
+            u64 endOffset;
+        };
+
+        struct RelocationEntry
+        {
+            u64 virtualOffset;
+            u64 physicalOffset;
+            u32 isPatch;
+        };
+
+        struct SubsectionEntry
+        {
+            u64 offset;
+            PADDING(0x4);
+            u32 counter;
+        };
+#pragma pack(pop)
+        static_assert(sizeof(TableHeader) == 0x4000);
+        static_assert(sizeof(BucketHeader) == 0x10);
+        static_assert(sizeof(RelocationEntry) == 0x14);
+        static_assert(sizeof(SubsectionEntry) == 0x10);
+
+        std::vector<u64> m_RelocationStarts;
+        std::vector<u64> m_RelocationPhysical;
+        std::vector<u8> m_RelocationPatched;
+
+        std::vector<u64> m_SubsectionStarts;
+        std::vector<u32> m_SubsectionCounters;
+    };
+
+    // Virtual view of a patched section: every read is routed per relocation entry either to the
+    // decrypted base section or to the patch section, decrypted with the subsection counters.
+    // Nothing is materialized on disk.
+    class BKTRFileReader final : public FileReader
+    {
+    public:
+        // Takes ownership of p_BaseSection, which must cover the whole base section. p_PatchFile is the
+        // raw update NCA, the patch section being [p_SectionOffset, p_SectionOffset + p_SectionSize).
+        // The reader exposes [p_Offset, p_Offset + p_Size) of the virtual section.
+        explicit BKTRFileReader(FileReader* p_BaseSection, FileReader& p_PatchFile, usize p_SectionOffset, usize p_SectionSize, BKTR&& p_Table,
+                                const ByteArray<0x10>& p_Key, const ByteArray<0x10>& p_SectionCounter, usize p_Offset = 0, usize p_Size = UINT64_MAX);
+        ~BKTRFileReader() override;
+
+        [[nodiscard]] usize getFileSize() const override { return m_Size; }
+        [[nodiscard]] usize getCurrentPosition() override { return m_Position; }
+        [[nodiscard]] usize getCurrentGlobalPosition() override { return m_Offset + m_Position; }
+        [[nodiscard]] std::filesystem::path getFilePath() const override { return m_Storage.getFilePath(); }
+
+        void setCurrentPosition(usize p_Position) override;
+
+        void addRef() override { m_Storage.addRef(); }
+        void release() override { m_Storage.release(); }
+
+        bool isOpen() override { return m_Storage.isOpen(); }
+
+        [[nodiscard]] const BKTR& getTable() const { return m_Table; }
+
+    private:
+        u32 readBytes(u8* p_Buffer, usize p_Size, usize p_NewOffset) override;
+
+        void readPatch(u8* p_Buffer, usize p_Size, u64 p_PhysicalOffset);
+
+        FileReader* m_BaseSection;
+        SubFileReader m_Storage;
+        usize m_SectionOffset;
+
+        BKTR m_Table;
+        BKTR::Cursor m_Cursor;
+
+        crypto::AES m_AES;
+        ByteArray<0x10> m_SectionCounter;
+
+        usize m_Offset;
+        usize m_Size;
+        usize m_Position = 0;
+    };
+}
@@ -0,0 +1,123 @@
+#include "cnmt.hpp"
+
+#include "nca.hpp"
+#include "pfs.hpp"
+
+u64 swroo::filesys::CNMT::ContentRecord::getSize() const
+{
+    u64 l_Size = 0;
+    for (usize i = 0; i < size.size(); ++i)
+        l_Size |= static_cast<u64>(size[i]) << (i * 8);
+    return l_Size;
+}
+
+swroo::filesys::CNMT::CNMT(FileReader& p_File)
+{
+    p_File.read(m_Header, 0);
+
+    const usize l_ContentsOffset = sizeof(Header) + m_Header.extendedHeaderSize;
+    const usize l_MetasOffset = l_ContentsOffset + m_Header.contentCount * sizeof(ContentRecord);
+    if (l_MetasOffset + m_Header.contentMetaCount * sizeof(MetaRecord) > p_File.getFileSize())
+        throw std::runtime_error("CNMT is too small: " + p_File.getFilePath().string());
+
+    // Every extended header that names an application starts with it, data patches put the data ID first
+    std::vector<u8> l_Extended(m_Header.extendedHeaderSize);
+    p_File.readData(l_Extended.data(), l_Extended.size(), sizeof(Header));
+    const auto l_ReadExtended = [&l_Extended](auto& p_Value, const usize p_Offset)
+    {
+        if (p_Offset + sizeof(p_Value) <= l_Extended.size())
+            std::memcpy(&p_Value, l_Extended.data() + p_Offset, sizeof(p_Value));
+    };
+
+    switch (m_Header.type)
+    {
+    case MetaType::APPLICATION:
+        m_ApplicationID = m_Header.titleID;
+        l_ReadExtended(m_PatchID, 0x0);
+        l_ReadExtended(m_RequiredSystemVersion, 0x8);
+        break;
+    case MetaType::PATCH:
+        l_ReadExtended(m_ApplicationID, 0x0);
+        l_ReadExtended(m_RequiredSystemVersion, 0x8);
+        break;
+    case MetaType::ADD_ON_CONTENT:
+    case MetaType::DELTA:
+        l_ReadExtended(m_ApplicationID, 0x0);
+        break;
+    case MetaType::DATA_PATCH:
+        l_ReadExtended(m_ApplicationID, 0x8);
+        break;
+    default:
+        break;
+    }
+
+    m_Contents.resize(m_Header.contentCount);
+    m_Metas.resize(m_Header.contentMetaCount);
+    const FileReader::ReadRequest l_Requests[] = {
+        { l_ContentsOffset, std::span(reinterpret_cast<u8*>(m_Contents.data()), m_Contents.size() * sizeof(ContentRecord)) },
+        { l_MetasOffset, std::span(reinterpret_cast<u8*>(m_Metas.data()), m_Metas.size() * sizeof(MetaRecord)) },
+    };
+    p_File.readv(l_Requests);
+}
+
+swroo::utils::Expected<swroo::filesys::CNMT> swroo::filesys::CNMT::tryOpen(NCA& p_NCA)
+{
+    if (p_NCA.getContentType() != NCA::ContentType::METADATA)
+        return utils::Error{ utils::ErrorCode::UNSUPPORTED, "CNMT content type", static_cast<u64>(p_NCA.getContentType()) };
+    if (!p_NCA.isPFSSection(0))
+        return utils::Error{ utils::ErrorCode::UNSUPPORTED, "CNMT section" };
+
+    try
+    {
+        FileReader* l_Section = p_NCA.openPFSSection(0);
+        utils::CallOnDestroy l_DeleteSection([l_Section] { delete l_Section; });
+
+        for (utils::Expected<PFS::Entry>& l_Entry : PFS::enumerate(*l_Section))
+        {
+            if (!l_Entry)
+                return l_Entry.getError();
+            if (!l_Entry.getValue().name.ends_with(".cnmt"))
+                continue;
+
+            utils::Expected<FileReader*> l_File = SubFileReader::tryOpen(*l_Section, l_Entry.getValue().offset, l_Entry.getValue().size);
+            if (!l_File)
+                return l_File.getError();
+
+            utils::CallOnDestroy l_DeleteFile([l_Value = l_File.getValue()] { delete l_Value; });
+            return CNMT(*l_File.getValue());
+        }
+    }
+    catch (const std::exception&)
+    {
+        return utils::Error{ utils::ErrorCode::READ_FAILED, "CNMT" };
+    }
+    return utils::Error{ utils::ErrorCode::OPEN_FAILED, "CNMT" };
+}
+
+const swroo::filesys::CNMT::ContentRecord* swroo::filesys::CNMT::findContent(const ContentType p_Type) const
+{
+    for (const ContentRecord& l_Content : m_Contents)
+    {
+        if (l_Content.type == p_Type)
+            return &l_Content;
+    }
+    return nullptr;
+}
+
+const char* swroo::filesys::CNMT::getMetaTypeName(const MetaType p_Type)
+{
+    switch (p_Type)
+    {
+    case MetaType::SYSTEM_PROGRAM: return "system program";
+    case MetaType::SYSTEM_DATA: return "system data";
+    case MetaType::SYSTEM_UPDATE: return "system update";
+    case MetaType::BOOT_IMAGE_PACKAGE: return "boot image package";
+    case MetaType::BOOT_IMAGE_PACKAGE_SAFE: return "boot image package (safe)";
+    case MetaType::APPLICATION: return "application";
+    case MetaType::PATCH: return "patch";
+    case MetaType::ADD_ON_CONTENT: return "add-on content";
+    case MetaType::DELTA: return "delta";
+    case MetaType::DATA_PATCH: return "data patch";
+    }
+    return "unknown";
+}
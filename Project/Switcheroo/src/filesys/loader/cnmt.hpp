@@ -0,0 +1,115 @@
+#pragma once
+#include "../../util/common.hpp"
+
+#include <optional>
+#include <span>
+
+#include "../file.hpp"
+
+namespace swroo::filesys
+{
+    class NCA;
+
+    // Packaged content meta, the .cnmt file in the PFS0 of a META NCA. Lists every NCA of one title and, for updates
+    // and add-ons, the application they belong to.
+    class CNMT
+    {
+    public:
+        enum class MetaType : u8 {
+            SYSTEM_PROGRAM = 0x01,
+            SYSTEM_DATA = 0x02,
+            SYSTEM_UPDATE = 0x03,
+            BOOT_IMAGE_PACKAGE = 0x04,
+            BOOT_IMAGE_PACKAGE_SAFE = 0x05,
+            APPLICATION = 0x80,
+            PATCH = 0x81,
+            ADD_ON_CONTENT = 0x82,
+            DELTA = 0x83,
+            DATA_PATCH = 0x84,
+        };
+
+        enum class ContentType : u8 {
+            META,
+            PROGRAM,
+            DATA,
+            CONTROL,
+            HTML_DOCUMENT,
+            LEGAL_INFORMATION,
+            DELTA_FRAGMENT,
+        };
+
+#pragma pack(push, 1)
+        struct Header
+        {
+            u64 titleID;
+            u32 version;
+            MetaType type;
+            ZERO_PADDING(0x1);
+            u16 extendedHeaderSize;
+            u16 contentCount;
+            u16 contentMetaCount;
+            u8 attributes;
+            u8 storageID;
+            u8 installType;
+            ZERO_PADDING(0x1);
+            u32 requiredDownloadSystemVersion;
+            ZERO_PADDING(0x4);
+        };
+
+        struct ContentRecord
+        {
+            ByteArray<0x20> hash; // SHA-256 of the whole NCA
+            ByteArray<0x10> contentID;
+            std::array<u8, 6> size;
+            ContentType type;
+            u8 idOffset;
+
+            [[nodiscard]] u64 getSize() const;
+        };
+
+        // Other titles this one depends on, only used by system updates
+        struct MetaRecord
+        {
+            u64 titleID;
+            u32 version;
+            MetaType type;
+            u8 attributes;
+            ZERO_PADDING(0x2);
+        };
+#pragma pack(pop)
+        static_assert(sizeof(Header) == 0x20, "CNMT header must be 0x20 bytes");
+        static_assert(sizeof(ContentRecord) == 0x38, "CNMT content record must be 0x38 bytes");
+        static_assert(sizeof(MetaRecord) == 0x10, "CNMT meta record must be 0x10 bytes");
+
+        explicit CNMT(FileReader& p_File);
+        // Reads the .cnmt out of a META NCA, which only means decrypting its small PFS0 section
+        [[nodiscard]] static utils::Expected<CNMT> tryOpen(NCA& p_NCA);
+
+        [[nodiscard]] const Header& getHeader() const { return m_Header; }
+        [[nodiscard]] u64 getTitleID() const { return m_Header.titleID; }
+        [[nodiscard]] u32 getVersion() const { return m_Header.version; }
+        [[nodiscard]] MetaType getType() const { return m_Header.type; }
+
+        // The application a patch or add-on belongs to, applications return their own ID
+        [[nodiscard]] u64 getApplicationID() const { return m_ApplicationID; }
+        // Applications name the title ID their updates use, 0 otherwise
+        [[nodiscard]] u64 getPatchID() const { return m_PatchID; }
+        [[nodiscard]] u32 getRequiredSystemVersion() const { return m_RequiredSystemVersion; }
+
+        [[nodiscard]] std::span<const ContentRecord> getContents() const { return m_Contents; }
+        [[nodiscard]] std::span<const MetaRecord> getMetas() const { return m_Metas; }
+        // The first content of that type, titles have at most one of most types
+        [[nodiscard]] const ContentRecord* findContent(ContentType p_Type) const;
+
+        [[nodiscard]] static const char* getMetaTypeName(MetaType p_Type);
+
+    private:
+        Header m_Header{};
+        u64 m_ApplicationID = 0;
+        u64 m_PatchID = 0;
+        u32 m_RequiredSystemVersion = 0;
+
+        std::vector<ContentRecord> m_Contents;
+        std::vector<MetaRecord> m_Metas;
+    };
+}
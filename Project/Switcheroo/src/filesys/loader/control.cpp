@@ -0,0 +1,379 @@
+#include "control.hpp"
+
+#include "cnmt.hpp"
+#include "nca.hpp"
+#include "pfs.hpp"
+#include "xci.hpp"
+#include "../ticket.hpp"
+#include "../../engine.hpp"
+#include <cctype>
+#include <iostream>
+
+namespace
+{
+    // An NSP, or the secure partition of an XCI, with its entries listed and nothing opened yet. The file and the XCI
+    // come from the engine's registry.
+    struct Package
+    {
+        std::shared_ptr<swroo::FileReader> file;
+        std::shared_ptr<swroo::filesys::XCI> xci;
+        std::unique_ptr<swroo::FileReader> partition;
+        std::vector<swroo::filesys::PFS::Entry> entries;
+
+        [[nodiscard]] swroo::FileReader& getContainer() const { return partition ? *partition : *file; }
+    };
+}
+
+static std::string_view toStringView(const std::span<const char> p_Chars)
+{
+    return { p_Chars.data(), strnlen(p_Chars.data(), p_Chars.size()) };
+}
+
+// NCA names start with their content ID in hex, in either case
+static bool isContentEntry(const std::string_view p_Name, const ByteArray<0x10>& p_ContentID)
+{
+    constexpr char l_Digits[] = "0123456789abcdef";
+    if (p_Name.size() <= p_ContentID.size() * 2 || p_Name[p_ContentID.size() * 2] != '.')
+        return false;
+
+    for (usize i = 0; i < p_ContentID.size(); ++i)
+    {
+        if (std::tolower(p_Name[i * 2]) != l_Digits[p_ContentID[i] >> 4] || std::tolower(p_Name[i * 2 + 1]) != l_Digits[p_ContentID[i] & 0xF])
+            return false;
+    }
+    return true;
+}
+
+static swroo::utils::Expected<Package> openPackage(swroo::Engine& p_Engine, const std::filesystem::path& p_Path)
+{
+    using namespace swroo;
+
+    filesys::FileRegistry& l_Registry = p_Engine.getFileRegistry();
+    utils::Expected<std::shared_ptr<FileReader>> l_File = l_Registry.openFile(p_Path);
+    if (!l_File)
+        return l_File.getError();
+
+    Package l_Package;
+    l_Package.file = l_File.takeValue();
+
+    u32 l_Magic = 0;
+    if (const utils::Error l_Error = l_Package.file->tryRead(l_Magic, 0, "package magic"))
+        return l_Error;
+
+    // XCIs start with their header signature, only the small root partition is parsed to find the secure one
+    if (l_Magic != utils::MagicFromChars('P', 'F', 'S', '0'))
+    {
+        utils::Expected<std::shared_ptr<filesys::XCI>> l_XCI = l_Registry.openXCI(p_Path);
+        if (!l_XCI)
+            return utils::Error{ utils::ErrorCode::BAD_MAGIC, "package header", l_Magic };
+        l_Package.xci = l_XCI.takeValue();
+
+        try
+        {
+            const filesys::PFS& l_Root = l_Package.xci->getRootPartition();
+            const filesys::PFS::Entry* l_Secure = l_Root.findEntry(filesys::XCI::getPartitionName(filesys::XCI::Partition::SECURE));
+            if (l_Secure == nullptr)
+                return utils::Error{ utils::ErrorCode::OPEN_FAILED, "XCI secure partition" };
+            l_Package.partition.reset(l_Root.openEntry(*l_Secure));
+        }
+        catch (const std::exception&)
+        {
+            return utils::Error{ utils::ErrorCode::BAD_MAGIC, "package header", l_Magic };
+        }
+    }
+
+    for (utils::Expected<filesys::PFS::Entry>& l_Entry : filesys::PFS::enumerate(l_Package.getContainer()))
+    {
+        if (!l_Entry)
+            return l_Entry.getError();
+        l_Package.entries.push_back(l_Entry.takeValue());
+    }
+    return l_Package;
+}
+
+static void importTickets(swroo::Engine& p_Engine, const Package& p_Package)
+{
+    using namespace swroo;
+
+    for (const filesys::PFS::Entry& l_Entry : p_Package.entries)
+    {
+        if (!l_Entry.name.ends_with(".tik"))
+            continue;
+
+        utils::Expected<FileReader*> l_File = SubFileReader::tryOpen(p_Package.getContainer(), l_Entry.offset, l_Entry.size);
+        if (!l_File)
+            continue;
+
+        try
+        {
+            const filesys::Ticket l_Ticket(*l_File.getValue());
+            if (!p_Engine.getKeyManager().importTicket(l_Ticket))
+                std::cout << "Failed to unwrap title key of " << l_Entry.name << '\n';
+        }
+        catch (const std::exception& l_Exception)
+        {
+            std::cout << "Skipping ticket " << l_Entry.name << ": " << l_Exception.what() << '\n';
+        }
+        delete l_File.getValue();
+    }
+}
+
+static swroo::utils::Expected<swroo::filesys::NCA> openNCA(swroo::Engine& p_Engine, const Package& p_Package, const swroo::filesys::PFS::Entry& p_Entry)
+{
+    using namespace swroo;
+
+    utils::Expected<FileReader*> l_File = SubFileReader::tryOpen(p_Package.getContainer(), p_Entry.offset, p_Entry.size);
+    if (!l_File)
+        return l_File.getError();
+    return filesys::NCA::tryOpen(l_File.getValue(), &p_Engine);
+}
+
+// Expects the tickets of the package to be imported already, so it only ever reads keys and can run on any thread
+static swroo::utils::Expected<swroo::filesys::ControlData> readControl(swroo::Engine& p_Engine, const Package& p_Package, const swroo::filesys::ControlData::Language p_Language)
+{
+    using namespace swroo;
+    using filesys::CNMT;
+
+    // Bundles can hold several titles, the newest application or patch ships the control data that is shown
+    std::optional<ByteArray<0x10>> l_ControlID;
+    u32 l_ControlVersion = 0;
+    for (const filesys::PFS::Entry& l_Entry : p_Package.entries)
+    {
+        if (!l_Entry.name.ends_with(".cnmt.nca"))
+            continue;
+
+        utils::Expected<filesys::NCA> l_Meta = openNCA(p_Engine, p_Package, l_Entry);
+        if (!l_Meta)
+            continue;
+
+        const utils::Expected<CNMT> l_CNMT = CNMT::tryOpen(l_Meta.getValue());
+        if (!l_CNMT || (l_CNMT.getValue().getType() != CNMT::MetaType::APPLICATION && l_CNMT.getValue().getType() != CNMT::MetaType::PATCH))
+            continue;
+
+        const CNMT::ContentRecord* l_Control = l_CNMT.getValue().findContent(CNMT::ContentType::CONTROL);
+        if (l_Control != nullptr && (!l_ControlID.has_value() || l_CNMT.getValue().getVersion() > l_ControlVersion))
+        {
+            l_ControlID = l_Control->contentID;
+            l_ControlVersion = l_CNMT.getValue().getVersion();
+        }
+    }
+
+    if (l_ControlID.has_value())
+    {
+        for (const filesys::PFS::Entry& l_Entry : p_Package.entries)
+        {
+            if (!isContentEntry(l_Entry.name, *l_ControlID))
+                continue;
+
+            utils::Expected<filesys::NCA> l_NCA = openNCA(p_Engine, p_Package, l_Entry);
+            if (!l_NCA)
+                return l_NCA.getError();
+            return filesys::ControlData::tryOpen(l_NCA.getValue(), p_Language);
+        }
+    }
+
+    // No usable CNMT, or it names an NCA that is not there. Every header is small, checking them all is still cheap.
+    for (const filesys::PFS::Entry& l_Entry : p_Package.entries)
+    {
+        if (!l_Entry.name.ends_with(".nca") || l_Entry.name.ends_with(".cnmt.nca"))
+            continue;
+
+        utils::Expected<filesys::NCA> l_NCA = openNCA(p_Engine, p_Package, l_Entry);
+        if (l_NCA && l_NCA.getValue().getContentType() == filesys::NCA::ContentType::CONTROL)
+            return filesys::ControlData::tryOpen(l_NCA.getValue(), p_Language);
+    }
+    return utils::Error{ utils::ErrorCode::OPEN_FAILED, "control NCA" };
+}
+
+swroo::utils::Expected<swroo::filesys::ControlData> swroo::filesys::ControlData::tryOpen(NCA& p_NCA, const Language p_Language)
+{
+    if (p_NCA.getContentType() != NCA::ContentType::CONTROL)
+        return utils::Error{ utils::ErrorCode::UNSUPPORTED, "control content type", static_cast<u64>(p_NCA.getContentType()) };
+
+    u8 l_Section = 0;
+    while (l_Section < 4 && !p_NCA.isRomFSSection(l_Section))
+        ++l_Section;
+    if (l_Section == 4)
+        return utils::Error{ utils::ErrorCode::UNSUPPORTED, "control section" };
+
+    try
+    {
+        // Nothing here is read twice, caching it would only push out blocks of content that is actually in use
+        const RomFS l_RomFS = p_NCA.openRomFS(l_Section, false);
+
+        const RomFS::Index::File* l_NACPFile = l_RomFS.findFile("/control.nacp");
+        if (l_NACPFile == nullptr)
+            return utils::Error{ utils::ErrorCode::OPEN_FAILED, "control.nacp" };
+        if (l_NACPFile->size < sizeof(NACP))
+            return utils::Error{ utils::ErrorCode::TRUNCATED, "control.nacp", sizeof(NACP) };
+
+        ControlData l_Control;
+        l_Control.m_TitleID = p_NCA.getTitleID();
+
+        const auto l_NACP = std::make_shared<NACP>();
+        FileReader* l_NACPReader = l_RomFS.openFile(*l_NACPFile);
+        utils::CallOnDestroy l_DeleteNACP([l_NACPReader] { delete l_NACPReader; });
+        l_NACPReader->read(*l_NACP, 0);
+        l_Control.m_NACP = l_NACP;
+
+        // The requested language first, then whichever language has both a title and an icon
+        const RomFS::Index::File* l_IconFile = nullptr;
+        const auto l_FindIcon = [&](const Language p_IconLanguage)
+        {
+            l_IconFile = l_RomFS.findFile(std::string("/icon_") + getLanguageName(p_IconLanguage) + ".dat");
+            if (l_IconFile != nullptr)
+                l_Control.m_IconLanguage = p_IconLanguage;
+            return l_IconFile != nullptr;
+        };
+
+        if (!l_FindIcon(p_Language))
+        {
+            for (u8 i = 0; i < static_cast<u8>(Language::COUNT); ++i)
+            {
+                const Language l_Language = static_cast<Language>(i);
+                if (l_NACP->titles[i].name[0] != '\0' && l_FindIcon(l_Language))
+                    break;
+            }
+        }
+
+        if (l_IconFile != nullptr)
+        {
+            if (l_IconFile->size > c_MaxIconSize)
+                return utils::Error{ utils::ErrorCode::OUT_OF_RANGE, "control icon", l_IconFile->size };
+
+            FileReader* l_IconReader = l_RomFS.openFile(*l_IconFile);
+            utils::CallOnDestroy l_DeleteIcon([l_IconReader] { delete l_IconReader; });
+            l_Control.m_Icon.resize(l_IconFile->size);
+            l_IconReader->readData(l_Control.m_Icon.data(), l_Control.m_Icon.size(), 0);
+        }
+        return l_Control;
+    }
+    catch (const std::exception&)
+    {
+        return utils::Error{ utils::ErrorCode::READ_FAILED, "control data" };
+    }
+}
+
+swroo::utils::Expected<swroo::filesys::ControlData> swroo::filesys::ControlData::tryLoad(Engine& p_Engine, const std::filesystem::path& p_Path, const Language p_Language)
+{
+    utils::Expected<Package> l_Package = openPackage(p_Engine, p_Path);
+    if (!l_Package)
+        return l_Package.getError();
+
+    try
+    {
+        importTickets(p_Engine, l_Package.getValue());
+        return readControl(p_Engine, l_Package.getValue(), p_Language);
+    }
+    catch (const std::exception&)
+    {
+        return utils::Error{ utils::ErrorCode::READ_FAILED, "control data" };
+    }
+}
+
+std::vector<swroo::utils::Expected<swroo::filesys::ControlData>> swroo::filesys::ControlData::loadAll(Engine& p_Engine, const std::span<const std::filesystem::path> p_Paths,
+                                                                                                    const Language p_Language)
+{
+    std::vector<utils::Expected<ControlData>> l_Results(p_Paths.size(), utils::Error{ utils::ErrorCode::OPEN_FAILED, "control data" });
+
+    // Tickets are imported in a first pass, so the workers only ever look keys up. Both passes open the packages
+    // through the registry, the workers find them still open and XCIs already parsed. The registry closes them
+    // again once idle.
+    std::vector<bool> l_Opened(p_Paths.size(), false);
+    for (usize i = 0; i < p_Paths.size(); ++i)
+    {
+        utils::Expected<Package> l_Package = openPackage(p_Engine, p_Paths[i]);
+        if (!l_Package)
+        {
+            l_Results[i] = l_Package.getError();
+            continue;
+        }
+
+        try
+        {
+            importTickets(p_Engine, l_Package.getValue());
+            l_Opened[i] = true;
+        }
+        catch (const std::exception&)
+        {
+            l_Results[i] = utils::Error{ utils::ErrorCode::READ_FAILED, "ticket" };
+        }
+    }
+
+    p_Engine.getScheduler().parallelFor(p_Paths.size(), [&](const usize i)
+    {
+        if (!l_Opened[i])
+            return;
+
+        utils::Expected<Package> l_Package = openPackage(p_Engine, p_Paths[i]);
+        if (!l_Package)
+        {
+            l_Results[i] = l_Package.getError();
+            return;
+        }
+
+        try
+        {
+            l_Results[i] = readControl(p_Engine, l_Package.getValue(), p_Language);
+        }
+        catch (const std::exception&)
+        {
+            l_Results[i] = utils::Error{ utils::ErrorCode::READ_FAILED, "control data" };
+        }
+    });
+    return l_Results;
+}
+
+const swroo::filesys::ControlData::NACP::Title& swroo::filesys::ControlData::getTitle(const Language p_Language) const
+{
+    const NACP::Title& l_Title = m_NACP->titles[static_cast<u8>(p_Language)];
+    if (l_Title.name[0] != '\0')
+        return l_Title;
+
+    for (const NACP::Title& l_Other : m_NACP->titles)
+    {
+        if (l_Other.name[0] != '\0')
+            return l_Other;
+    }
+    return l_Title;
+}
+
+std::string_view swroo::filesys::ControlData::getName(const Language p_Language) const
+{
+    return toStringView(getTitle(p_Language).name);
+}
+
+std::string_view swroo::filesys::ControlData::getPublisher(const Language p_Language) const
+{
+    return toStringView(getTitle(p_Language).publisher);
+}
+
+std::string_view swroo::filesys::ControlData::getDisplayVersion() const
+{
+    return toStringView(m_NACP->displayVersion);
+}
+
+const char* swroo::filesys::ControlData::getLanguageName(const Language p_Language)
+{
+    // As used in the icon file names
+    switch (p_Language)
+    {
+    case Language::AMERICAN_ENGLISH: return "AmericanEnglish";
+    case Language::BRITISH_ENGLISH: return "BritishEnglish";
+    case Language::JAPANESE: return "Japanese";
+    case Language::FRENCH: return "French";
+    case Language::GERMAN: return "German";
+    case Language::LATIN_AMERICAN_SPANISH: return "LatinAmericanSpanish";
+    case Language::SPANISH: return "Spanish";
+    case Language::ITALIAN: return "Italian";
+    case Language::DUTCH: return "Dutch";
+    case Language::CANADIAN_FRENCH: return "CanadianFrench";
+    case Language::PORTUGUESE: return "Portuguese";
+    case Language::RUSSIAN: return "Russian";
+    case Language::KOREAN: return "Korean";
+    case Language::TRADITIONAL_CHINESE: return "TraditionalChinese";
+    case Language::SIMPLIFIED_CHINESE: return "SimplifiedChinese";
+    case Language::BRAZILIAN_PORTUGUESE: return "BrazilianPortuguese";
+    default: return "";
+    }
+}
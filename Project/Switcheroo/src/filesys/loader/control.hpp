@@ -0,0 +1,114 @@
+#pragma once
+#include "../../util/common.hpp"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include "../../util/expected.hpp"
+
+namespace swroo
+{
+    class Engine;
+}
+
+namespace swroo::filesys
+{
+    class NCA;
+
+    // Title names, version and icon of an application, from the control.nacp and icon_*.dat in the RomFS of its
+    // CONTROL NCA. Loading only decrypts the RomFS tables and those two files, which is all a library listing needs.
+    class ControlData
+    {
+    public:
+        enum class Language : u8 {
+            AMERICAN_ENGLISH,
+            BRITISH_ENGLISH,
+            JAPANESE,
+            FRENCH,
+            GERMAN,
+            LATIN_AMERICAN_SPANISH,
+            SPANISH,
+            ITALIAN,
+            DUTCH,
+            CANADIAN_FRENCH,
+            PORTUGUESE,
+            RUSSIAN,
+            KOREAN,
+            TRADITIONAL_CHINESE,
+            SIMPLIFIED_CHINESE,
+            BRAZILIAN_PORTUGUESE,
+            COUNT
+        };
+
+#pragma pack(push, 1)
+        struct NACP
+        {
+            struct Title
+            {
+                std::array<char, 0x200> name;
+                std::array<char, 0x100> publisher;
+            };
+
+            std::array<Title, 0x10> titles; // Indexed by Language
+            std::array<char, 0x25> isbn;
+            u8 startupUserAccount;
+            u8 userAccountSwitchLock;
+            u8 addOnContentRegistrationType;
+            u32 attributeFlag;
+            u32 supportedLanguageFlag;
+            u32 parentalControlFlag;
+            u8 screenshot;
+            u8 videoCapture;
+            u8 dataLossConfirmation;
+            u8 playLogPolicy;
+            u64 presenceGroupID;
+            std::array<u8, 0x20> ratingAge;
+            std::array<char, 0x10> displayVersion;
+            u64 addOnContentBaseID;
+            u64 saveDataOwnerID;
+            PADDING(0xF80);
+        };
+#pragma pack(pop)
+        static_assert(sizeof(NACP) == 0x4000, "NACP must be 0x4000 bytes");
+
+        // Icons are JPEGs of a few dozen KiB, anything past this is a corrupt entry
+        static constexpr usize c_MaxIconSize = 0x100000;
+
+        // Reads a CONTROL NCA. The icon is the one of p_Language, or of the first language that has one.
+        [[nodiscard]] static utils::Expected<ControlData> tryOpen(NCA& p_NCA, Language p_Language = Language::AMERICAN_ENGLISH);
+        // Finds the control NCA of an NSP or XCI through its CNMT, or by reading NCA headers when that fails, and opens
+        // nothing else. Tickets of an NSP are imported first.
+        [[nodiscard]] static utils::Expected<ControlData> tryLoad(Engine& p_Engine, const std::filesystem::path& p_Path, Language p_Language = Language::AMERICAN_ENGLISH);
+        // tryLoad for a whole library, spread over the workers of the engine's scheduler. Results are in p_Paths order.
+        [[nodiscard]] static std::vector<utils::Expected<ControlData>> loadAll(Engine& p_Engine, std::span<const std::filesystem::path> p_Paths,
+                                                                               Language p_Language = Language::AMERICAN_ENGLISH);
+
+        [[nodiscard]] u64 getTitleID() const { return m_TitleID; }
+        [[nodiscard]] const NACP& getNACP() const { return *m_NACP; }
+
+        // Falls back to the first language that has a name
+        [[nodiscard]] std::string_view getName(Language p_Language = Language::AMERICAN_ENGLISH) const;
+        [[nodiscard]] std::string_view getPublisher(Language p_Language = Language::AMERICAN_ENGLISH) const;
+        [[nodiscard]] std::string_view getDisplayVersion() const;
+
+        // Empty if the RomFS has no icon
+        [[nodiscard]] std::span<const u8> getIcon() const { return m_Icon; }
+        [[nodiscard]] std::optional<Language> getIconLanguage() const { return m_IconLanguage; }
+
+        [[nodiscard]] static const char* getLanguageName(Language p_Language);
+
+    private:
+        ControlData() = default;
+
+        [[nodiscard]] const NACP::Title& getTitle(Language p_Language) const;
+
+        u64 m_TitleID = 0;
+        // 16 KiB, kept on the heap so results stay cheap to move around
+        std::shared_ptr<const NACP> m_NACP;
+        std::vector<u8> m_Icon;
+        std::optional<Language> m_IconLanguage;
+    };
+}
@@ -1,7 +1,13 @@
 #include "nca.hpp"
 
+#include "../block_cache.hpp"
+#include "../crypto_file.hpp"
+#include "../verify_cache.hpp"
 #include "../../engine.hpp"
 #include "../../util/crypto/aes.hpp"
+#include "../../util/crypto/sha256.hpp"
+
+#include <chrono>
 
 static ByteArray<0x10> getNintendoTweak(u64 p_SectorNumber) {
     ByteArray<0x10> l_Tweak{};
@@ -35,31 +41,190 @@ u8 swroo::filesys::NCA::Header::getEntryCount() const
     return l_Count;
 }
 
-swroo::filesys::NCA::NCA(FileReader* p_MainFile, Engine* p_Engine, const bool p_ShouldOwnFile)
-    : m_File(p_MainFile), m_FileOwned(p_ShouldOwnFile), m_Engine(p_Engine)
+u8 swroo::filesys::NCA::Header::getKeyGeneration() const
+{
+    const u8 l_KeyGen = std::max(KeyGenOld, KeyGen);
+    return l_KeyGen > 0 ? l_KeyGen - 1 : l_KeyGen;
+}
+
+bool swroo::filesys::NCA::Header::hasRightsID() const
+{
+    return !utils::isZero(rightsID.data(), rightsID.size());
+}
+
+ByteArray<0x10> swroo::filesys::NCA::FSEntry::getCounter() const
+{
+    // The generation and secure value live right after the patch info, stored little endian
+    const u8* l_Raw = reinterpret_cast<const u8*>(this) + 0x140;
+
+    ByteArray<0x10> l_Counter{};
+    for (u32 i = 0; i < 0x8; i++)
+        l_Counter[i] = l_Raw[0x7 - i];
+    return l_Counter;
+}
+
+u32 swroo::filesys::NCA::FSEntry::getGeneration() const
+{
+    u32 l_Generation;
+    std::memcpy(&l_Generation, reinterpret_cast<const u8*>(this) + 0x140, sizeof(u32));
+    return l_Generation;
+}
+
+swroo::filesys::NCA::NCA(FileReader* p_MainFile, Engine* p_Engine, const bool p_ShouldOwnFile, const std::optional<ByteArray<0x10>>& p_ContentID)
+    : NCA(Unloaded{}, p_MainFile, p_Engine, p_ShouldOwnFile, p_ContentID)
+{
+    if (const utils::Error l_Error = load())
+        throw std::runtime_error(l_Error.toString(m_File->getFilePath()));
+}
+
+swroo::filesys::NCA::NCA(Unloaded, FileReader* p_MainFile, Engine* p_Engine, const bool p_ShouldOwnFile, const std::optional<ByteArray<0x10>>& p_ContentID)
+    : m_File(p_MainFile), m_FileOwned(p_ShouldOwnFile), m_RawHeader(std::make_unique<ByteArray<c_HeaderSize>>()), m_Header(m_RawHeader->data()),
+      m_ContentID(p_ContentID), m_Engine(p_Engine)
+{
+    // Keys, caches and the scheduler all come from the engine, nothing past the header works without one. The
+    // destructor does not run for a throwing constructor, an owned file is freed here.
+    if (m_Engine == nullptr)
+    {
+        if (m_FileOwned)
+            delete m_File;
+        throw std::invalid_argument("NCA needs an engine");
+    }
+
+    for (usize i = 0; i < m_Entries.size(); ++i)
+        m_Entries[i] = utils::HeaderView<FSEntry, 0x200>(m_RawHeader->data() + sizeof(Header) + i * sizeof(FSEntry));
+}
+
+swroo::utils::Expected<swroo::filesys::NCA> swroo::filesys::NCA::tryOpen(FileReader* p_MainFile, Engine* p_Engine, const bool p_ShouldOwnFile,
+                                                                         const std::optional<ByteArray<0x10>>& p_ContentID)
+{
+    return tryOpen(p_MainFile, nullptr, p_Engine, p_ShouldOwnFile, p_ContentID);
+}
+
+swroo::utils::Expected<swroo::filesys::NCA> swroo::filesys::NCA::tryOpen(FileReader* p_MainFile, const ByteArray<c_HeaderSize>& p_RawHeader, Engine* p_Engine,
+                                                                         const bool p_ShouldOwnFile, const std::optional<ByteArray<0x10>>& p_ContentID)
+{
+    return tryOpen(p_MainFile, &p_RawHeader, p_Engine, p_ShouldOwnFile, p_ContentID);
+}
+
+swroo::utils::Expected<swroo::filesys::NCA> swroo::filesys::NCA::tryOpen(FileReader* p_MainFile, const ByteArray<c_HeaderSize>* p_RawHeader, Engine* p_Engine,
+                                                                         const bool p_ShouldOwnFile, const std::optional<ByteArray<0x10>>& p_ContentID)
 {
-    ByteArray<0xC00> l_InitialData;
-    m_File->readData(l_InitialData.data(), l_InitialData.size(), 0);
+    if (p_Engine == nullptr)
+    {
+        if (p_ShouldOwnFile)
+            delete p_MainFile;
+        return utils::Error{ utils::ErrorCode::OPEN_FAILED, "NCA engine" };
+    }
 
-    const ByteArray<0x20> l_HeaderKey = m_Engine->getKeyManager().getKey(KeyData::K256, KeyData::K256Type::HEADER);
+    NCA l_NCA(Unloaded{}, p_MainFile, p_Engine, p_ShouldOwnFile, p_ContentID);
+    try
+    {
+        if (const utils::Error l_Error = l_NCA.load(p_RawHeader))
+            return l_Error;
+    }
+    catch (const std::exception&)
+    {
+        // Everything a scan runs into is checked up front, only real I/O errors still throw
+        return utils::Error{ utils::ErrorCode::READ_FAILED, "NCA" };
+    }
+    return l_NCA;
+}
+
+swroo::utils::Error swroo::filesys::NCA::load(const ByteArray<c_HeaderSize>* p_RawHeader)
+{
+    // Batched callers hand in their buffer, it is decrypted from in place instead of being copied first
+    ByteArray<c_HeaderSize> l_ReadData;
+    const ByteArray<c_HeaderSize>* l_InitialData = p_RawHeader;
+    if (l_InitialData == nullptr)
+    {
+        if (const utils::Error l_Error = m_File->tryReadData(l_ReadData.data(), l_ReadData.size(), 0, "NCA header"))
+            return l_Error;
+        l_InitialData = &l_ReadData;
+    }
+
+    const KeyManager& l_KeyManager = m_Engine->getKeyManager();
+    if (!l_KeyManager.hasKey(KeyData::K256, KeyData::K256Type::HEADER))
+        return { utils::ErrorCode::MISSING_KEY, "header_key" };
+
+    const ByteArray<0x20> l_HeaderKey = l_KeyManager.getKey(KeyData::K256, KeyData::K256Type::HEADER);
     crypto::AES l_AES(l_HeaderKey.data());
 
-    const utils::DecryptResult l_HeaderResult = decryptHeader(l_InitialData, l_AES);
+    // Anything that is not an NCA ends up here too, its "decrypted" magic is garbage
+    const utils::DecryptResult l_HeaderResult = decryptHeader(*l_InitialData, l_AES);
     if (l_HeaderResult == utils::DecryptResult::FAILURE)
-        throw std::runtime_error("Invalid NCA Header");
+        return { utils::ErrorCode::BAD_MAGIC, "NCA header" };
+    m_IsEncrypted = l_HeaderResult != utils::DecryptResult::NOT_ENCRYPTED;
 
     if (m_MagicType == Header::MagicType::NCA0)
-        throw std::runtime_error("NCA0 is not implemented yet"); // TODO?
+        return { utils::ErrorCode::UNSUPPORTED, "NCA0" }; // TODO?
 
-    const utils::DecryptResult l_EntriesResult = decryptFSEntries(l_InitialData, l_AES, l_HeaderResult != utils::DecryptResult::NOT_ENCRYPTED);
+    if (VIEW_FIELD(m_Header, size) > m_File->getFileSize())
+        return { utils::ErrorCode::TRUNCATED, "NCA", VIEW_FIELD(m_Header, size) };
+
+    const utils::DecryptResult l_EntriesResult = decryptFSEntries(*l_InitialData, l_AES, m_IsEncrypted);
     if (l_EntriesResult == utils::DecryptResult::FAILURE)
-        throw std::runtime_error("Failed to decrypt NCA entries");
+        return { utils::ErrorCode::DECRYPT_FAILED, "NCA FS headers" };
 
+    m_CacheOwner = BlockCache::makeOwnerID(getHeaderHash());
+    return {};
+}
 
+swroo::utils::Expected<swroo::filesys::NCA::Probe> swroo::filesys::NCA::probe(FileReader& p_File, const usize p_Offset, crypto::AES& p_HeaderAES)
+{
+    ByteArray<c_ProbeSize> l_Sector;
+    if (const utils::Error l_Error = p_File.tryReadData(l_Sector.data(), l_Sector.size(), p_Offset + c_ProbeOffset, "NCA header"))
+        return l_Error;
+    return probe(l_Sector, p_HeaderAES);
+}
+
+swroo::utils::Expected<swroo::filesys::NCA::Probe> swroo::filesys::NCA::probe(const ByteArray<c_ProbeSize>& p_Sector, crypto::AES& p_HeaderAES)
+{
+    // The sector goes where it belongs in an otherwise empty header, so the header struct can be used as is
+    alignas(Header) ByteArray<sizeof(Header)> l_Raw{};
+    u8* l_Sector = l_Raw.data() + c_ProbeOffset;
+    const utils::HeaderView<Header, 0x400> l_Header(l_Raw.data());
+
+    std::memcpy(l_Sector, p_Sector.data(), c_ProbeSize);
+    MagicType l_Magic = l_Header->getMagicType();
+    const bool l_Encrypted = l_Magic == MagicType::INVALID;
+    if (l_Encrypted)
+    {
+        if (!p_HeaderAES.decryptXTS(p_Sector.data(), l_Sector, c_ProbeSize, getNintendoTweak, 0x200, c_ProbeOffset / 0x200))
+            return utils::Error{ utils::ErrorCode::DECRYPT_FAILED, "NCA header" };
+
+        l_Magic = l_Header->getMagicType();
+        if (l_Magic == MagicType::INVALID)
+            return utils::Error{ utils::ErrorCode::BAD_MAGIC, "NCA header" };
+    }
+
+    return Probe{
+        l_Magic,
+        l_Encrypted,
+        VIEW_FIELD(l_Header, distType),
+        VIEW_FIELD(l_Header, contentType),
+        VIEW_FIELD(l_Header, size),
+        VIEW_FIELD(l_Header, titleID),
+        l_Header->getKeyGeneration(),
+        l_Header->rightsID,
+    };
+}
+
+const char* swroo::filesys::NCA::getContentTypeName(const ContentType p_Type)
+{
+    switch (p_Type)
+    {
+    case ContentType::PROGRAM: return "Program";
+    case ContentType::METADATA: return "Meta";
+    case ContentType::CONTROL: return "Control";
+    case ContentType::MANUAL: return "Manual";
+    case ContentType::DATA: return "Data";
+    case ContentType::PUBLIC_DATA: return "PublicData";
+    }
+    return "Unknown";
 }
 
 swroo::filesys::NCA::NCA(NCA&& other) noexcept
-    : m_File(other.m_File), m_FileOwned(other.m_FileOwned), m_Header(other.m_Header), m_MagicType(other.m_MagicType), m_Entries(other.m_Entries), m_Engine(other.m_Engine)
+    : m_File(other.m_File), m_FileOwned(other.m_FileOwned), m_RawHeader(std::move(other.m_RawHeader)), m_Header(other.m_Header), m_MagicType(other.m_MagicType), m_IsEncrypted(other.m_IsEncrypted), m_Entries(other.m_Entries), m_ContentKey(other.m_ContentKey), m_ContentID(other.m_ContentID), m_CacheOwner(other.m_CacheOwner), m_Engine(other.m_Engine)
 {
     other.m_File = nullptr;
     other.m_FileOwned = false;
@@ -74,16 +239,16 @@ swroo::filesys::NCA::~NCA()
 
 swroo::utils::DecryptResult swroo::filesys::NCA::decryptHeader(const ByteArray<0xC00>& p_RawData, crypto::AES& p_AES)
 {
-    m_MagicType = reinterpret_cast<const Header*>(&p_RawData)->getMagicType();
+    u8* l_Header = m_RawHeader->data();
+    std::memcpy(l_Header, p_RawData.data(), sizeof(Header));
+    m_MagicType = m_Header->getMagicType();
     if (m_MagicType != Header::MagicType::INVALID)
         return utils::DecryptResult::NOT_ENCRYPTED;
-    
-    Header l_DecryptedHeader;
-    if (!p_AES.decryptXTS(reinterpret_cast<const u8*>(&p_RawData), reinterpret_cast<u8*>(&l_DecryptedHeader), sizeof(Header), getNintendoTweak, 0x200))
+
+    if (!p_AES.decryptXTS(p_RawData.data(), l_Header, sizeof(Header), getNintendoTweak, 0x200))
         return utils::DecryptResult::FAILURE;
 
-    m_Header = l_DecryptedHeader;
-    m_MagicType = m_Header.getMagicType();
+    m_MagicType = m_Header->getMagicType();
     if (m_MagicType == Header::MagicType::INVALID)
         return utils::DecryptResult::FAILURE;
     return utils::DecryptResult::SUCCESS;
@@ -91,52 +256,625 @@ swroo::utils::DecryptResult swroo::filesys::NCA::decryptHeader(const ByteArray<0
 
 swroo::utils::DecryptResult swroo::filesys::NCA::decryptFSEntries(const ByteArray<0xC00>& p_RawData, crypto::AES& p_AES, const bool p_IsHeaderEnctrypted)
 {
+    const u8* l_EntryPtr = p_RawData.data() + sizeof(Header);
+    u8* l_Entries = m_RawHeader->data() + sizeof(Header);
     if (!p_IsHeaderEnctrypted)
+    {
+        std::memcpy(l_Entries, l_EntryPtr, sizeof(FSEntry) * m_Entries.size());
         return utils::DecryptResult::NOT_ENCRYPTED;
-
-    const u8* l_EntryPtr = p_RawData.data() + sizeof(Header);
+    }
     if (m_MagicType == Header::MagicType::NCA3)
     {
-        std::array<FSEntry, 4> l_Entries{};
-        if (!p_AES.decryptXTS(l_EntryPtr, reinterpret_cast<u8*>(l_Entries.data()), sizeof(FSEntry) * m_Entries.size(), getNintendoTweak, 0x200, 2))
+        if (!p_AES.decryptXTS(l_EntryPtr, l_Entries, sizeof(FSEntry) * m_Entries.size(), getNintendoTweak, 0x200, 2))
             return utils::DecryptResult::FAILURE;
-        
-        m_Entries = l_Entries;
     }
     else if (m_MagicType == Header::MagicType::NCA2)
     {
-        for (FSEntry& l_Entry : m_Entries)
+        // Every FS header is encrypted on its own, as sector 0
+        for (usize i = 0; i < m_Entries.size(); ++i)
         {
-            FSEntry l_DecEntry{};
-            if (!p_AES.decryptXTS(l_EntryPtr, reinterpret_cast<u8*>(&l_DecEntry), sizeof(FSEntry), getNintendoTweak, 0x200, 0))
+            if (!p_AES.decryptXTS(l_EntryPtr + i * sizeof(FSEntry), l_Entries + i * sizeof(FSEntry), sizeof(FSEntry), getNintendoTweak, 0x200, 0))
                 return utils::DecryptResult::FAILURE;
-            
-            l_Entry = l_DecEntry;
-            l_EntryPtr += sizeof(FSEntry);
         }
     }
 
-    for (u32 i = 0; i < m_Header.getEntryCount(); i++)
+    for (u32 i = 0; i < m_Header->getEntryCount(); i++)
     {
-        if (m_Entries[i].header.version != 2)
+        if (m_Entries[i]->header.version != 2)
             return utils::DecryptResult::FAILURE;
     }
 
     return utils::DecryptResult::SUCCESS;
 }
 
-swroo::utils::DecryptResult swroo::filesys::NCA::decryptFSData(bool p_IsHeaderEnctrypted)
+const ByteArray<0x10>& swroo::filesys::NCA::getContentKey()
 {
-    for (u32 i = 0; i < m_Header.getEntryCount(); i++)
+    if (m_ContentKey.has_value())
+        return *m_ContentKey;
+
+    KeyManager& l_KeyManager = m_Engine->getKeyManager();
+    const u8 l_KeyGen = m_Header->getKeyGeneration();
+
+    ByteArray<0x10> l_Key{};
+    if (m_Header->hasRightsID())
+    {
+        l_Key = l_KeyManager.getTitleKey(m_Header->rightsID, l_KeyGen);
+    }
+    else
     {
-        const FSEntry& l_Entry = m_Entries[i];
-        if (l_Entry.header.fsFype == FSEntry::Header::FILE_ROMFS)
+        const ByteArray<0x20>& l_KeyAreaKey = l_KeyManager.getKey(KeyData::K128, KeyData::K128Type::KEY_AREA, l_KeyGen, m_Header->keyIndex);
+
+        ByteArray<0x40> l_KeyArea;
+        crypto::AES l_AES(l_KeyAreaKey.data(), crypto::AES::Mode::ECB);
+        if (!l_AES.decryptECB(m_Header->keyArea.data(), l_KeyArea.data(), l_KeyArea.size()))
+            throw std::runtime_error("Failed to decrypt NCA key area");
+
+        // Slot 2 holds the AES-CTR key
+        std::memcpy(l_Key.data(), l_KeyArea.data() + 0x20, l_Key.size());
+    }
+
+    m_ContentKey = l_Key;
+    return *m_ContentKey;
+}
+
+bool swroo::filesys::NCA::hasSection(const u8 p_Index) const
+{
+    return p_Index < m_Entries.size() && m_Header->entries[p_Index].isValid();
+}
+
+bool swroo::filesys::NCA::isPFSSection(const u8 p_Index) const
+{
+    return hasSection(p_Index) && m_Entries[p_Index]->header.fsFype == FSEntry::Header::FILE_PFS0;
+}
+
+bool swroo::filesys::NCA::isRomFSSection(const u8 p_Index) const
+{
+    return hasSection(p_Index) && m_Entries[p_Index]->header.fsFype == FSEntry::Header::FILE_ROMFS;
+}
+
+bool swroo::filesys::NCA::isPatchSection(const u8 p_Index) const
+{
+    return hasSection(p_Index) && m_IsEncrypted && m_Entries[p_Index]->header.cryptType == FSEntry::Header::BKTR;
+}
+
+void swroo::filesys::NCA::getSectionRegion(const u8 p_Index, const usize p_Offset, const usize p_Size, usize& p_RegionOffset, usize& p_RegionSize) const
+{
+    if (!hasSection(p_Index))
+        throw std::runtime_error("NCA section does not exist: " + std::to_string(p_Index));
+
+    const Header::FSEntry& l_Bounds = m_Header->entries[p_Index];
+    const usize l_SectionOffset = static_cast<usize>(l_Bounds.beginOffset) * 0x200;
+    const usize l_SectionSize = static_cast<usize>(l_Bounds.endOffset - l_Bounds.beginOffset) * 0x200;
+    if (p_Offset > l_SectionSize)
+        throw std::runtime_error("Offset exceeds NCA section size");
+
+    p_RegionOffset = l_SectionOffset + p_Offset;
+    p_RegionSize = std::min(p_Size, l_SectionSize - p_Offset);
+}
+
+swroo::FileReader* swroo::filesys::NCA::openSection(const u8 p_Index, const usize p_Offset, const usize p_Size)
+{
+    usize l_Offset, l_Size;
+    getSectionRegion(p_Index, p_Offset, p_Size, l_Offset, l_Size);
+
+    BlockCache& l_Cache = m_Engine->getBlockCache();
+    if (!m_IsEncrypted || !l_Cache.isEnabled() || m_Entries[p_Index]->header.cryptType != FSEntry::Header::CTR)
+        return openUncachedSection(p_Index, p_Offset, p_Size);
+
+    // Blocks are keyed by their place in the section, so the cache always sits on top of a whole section reader
+    FileReader* l_Section = openUncachedSection(p_Index);
+    return new CachedFileReader(l_Section, l_Cache, m_CacheOwner, p_Index, p_Offset, l_Size);
+}
+
+swroo::FileReader* swroo::filesys::NCA::openUncachedSection(const u8 p_Index, const usize p_Offset, const usize p_Size)
+{
+    usize l_Offset, l_Size;
+    getSectionRegion(p_Index, p_Offset, p_Size, l_Offset, l_Size);
+
+    if (!m_IsEncrypted)
+        return new SubFileReader(*m_File, l_Offset, l_Size);
+
+    const FSEntry& l_Entry = *m_Entries[p_Index];
+    switch (l_Entry.header.cryptType)
+    {
+    case FSEntry::Header::NONE:
+        return new SubFileReader(*m_File, l_Offset, l_Size);
+    case FSEntry::Header::CTR:
+        return new CTRFileReader(*m_File, l_Offset, l_Size, getContentKey(), l_Entry.getCounter(), l_Offset);
+    case FSEntry::Header::BKTR:
+        throw std::runtime_error("BKTR sections can only be read on top of their base NCA");
+    default:
+        throw std::runtime_error("Unsupported NCA section encryption: " + std::to_string(l_Entry.header.cryptType));
+    }
+}
+
+swroo::FileReader* swroo::filesys::NCA::openPFSSection(const u8 p_Index)
+{
+    if (!isPFSSection(p_Index))
+        throw std::runtime_error("NCA section is not a PFS0: " + std::to_string(p_Index));
+
+    const FSEntry::PFS0SuperBlock& l_SuperBlock = m_Entries[p_Index]->pfs0;
+    return openSection(p_Index, l_SuperBlock.pfsOffset, l_SuperBlock.pfsSize);
+}
+
+swroo::filesys::RomFS swroo::filesys::NCA::openRomFS(const u8 p_Index, const bool p_UseCache)
+{
+    if (!isRomFSSection(p_Index))
+        throw std::runtime_error("NCA section is not a RomFS: " + std::to_string(p_Index));
+
+    // The last IVFC level holds the actual RomFS, the others are only hash data
+    const FSEntry::IVFCHeader::IVFCLevel& l_Level = m_Entries[p_Index]->romfs.ivfcHeader.levels[5];
+    return RomFS(p_UseCache ? openSection(p_Index, l_Level.offset, l_Level.size) : openUncachedSection(p_Index, l_Level.offset, l_Level.size));
+}
+
+swroo::filesys::BKTR swroo::filesys::NCA::loadBKTR(const u8 p_Index)
+{
+    if (!isPatchSection(p_Index))
+        throw std::runtime_error("NCA section is not a BKTR section: " + std::to_string(p_Index));
+
+    const FSEntry& l_Entry = *m_Entries[p_Index];
+    const FSEntry::BKRTSuperBlock& l_SuperBlock = l_Entry.bkrts;
+    constexpr u32 l_Magic = utils::MagicFromChars('B', 'K', 'T', 'R');
+    if (l_SuperBlock.relocationHeader.magic != l_Magic || l_SuperBlock.subsectionHeader.magic != l_Magic)
+        throw std::runtime_error("Invalid BKTR table magic");
+
+    // The tables are encrypted with the regular section counter
+    usize l_Offset, l_Size;
+    getSectionRegion(p_Index, l_SuperBlock.relocationHeader.offset, l_SuperBlock.relocationHeader.size, l_Offset, l_Size);
+    CTRFileReader l_RelocationTable(*m_File, l_Offset, l_Size, getContentKey(), l_Entry.getCounter(), l_Offset);
+
+    getSectionRegion(p_Index, l_SuperBlock.subsectionHeader.offset, l_SuperBlock.subsectionHeader.size, l_Offset, l_Size);
+    CTRFileReader l_SubsectionTable(*m_File, l_Offset, l_Size, getContentKey(), l_Entry.getCounter(), l_Offset);
+
+    return BKTR(l_RelocationTable, l_SubsectionTable, l_SuperBlock.relocationHeader.offset, l_Entry.getGeneration());
+}
+
+swroo::FileReader* swroo::filesys::NCA::openPatchedSection(const u8 p_Index, NCA& p_Base, const u8 p_BaseIndex, const usize p_Offset, const usize p_Size)
+{
+    BKTR l_Table = loadBKTR(p_Index);
+
+    usize l_SectionOffset, l_SectionSize;
+    getSectionRegion(p_Index, 0, UINT64_MAX, l_SectionOffset, l_SectionSize);
+
+    FileReader* l_BaseSection = p_Base.openSection(p_BaseIndex);
+    try
+    {
+        return new BKTRFileReader(l_BaseSection, *m_File, l_SectionOffset, l_SectionSize, std::move(l_Table),
+                                  getContentKey(), m_Entries[p_Index]->getCounter(), p_Offset, p_Size);
+    }
+    catch (...)
+    {
+        delete l_BaseSection;
+        throw;
+    }
+}
+
+swroo::filesys::RomFS swroo::filesys::NCA::openPatchedRomFS(const u8 p_Index, NCA& p_Base, const u8 p_BaseIndex)
+{
+    if (!p_Base.isRomFSSection(p_BaseIndex))
+        throw std::runtime_error("Base NCA section is not a RomFS: " + std::to_string(p_BaseIndex));
+
+    // The update carries the IVFC header of the patched image
+    const FSEntry::IVFCHeader::IVFCLevel& l_Level = m_Entries[p_Index]->bkrts.ivfcHeader.levels[5];
+    return RomFS(openPatchedSection(p_Index, p_Base, p_BaseIndex, l_Level.offset, l_Level.size));
+}
+
+bool swroo::filesys::NCA::VerifyResult::isValid() const
+{
+    const auto l_IsBad = [](const Status p_Status) { return p_Status == Status::MISMATCH || p_Status == Status::READ_FAILED; };
+    for (const Section& l_Section : sections)
+    {
+        if (l_IsBad(l_Section.headerHash) || l_IsBad(l_Section.hashTree))
+            return false;
+    }
+    return !l_IsBad(contentHash);
+}
+
+f64 swroo::filesys::NCA::VerifyResult::getThroughput() const
+{
+    if (seconds <= 0.0)
+        return 0.0;
+    return static_cast<f64>(bytesProcessed) / seconds / (1024.0 * 1024.0);
+}
+
+const char* swroo::filesys::NCA::VerifyResult::getStatusName(const Status p_Status)
+{
+    switch (p_Status)
+    {
+    case Status::SKIPPED: return "skipped";
+    case Status::OK: return "ok";
+    case Status::MISMATCH: return "mismatch";
+    case Status::READ_FAILED: return "read failed";
+    }
+    return "unknown";
+}
+
+// Scratch memory for the hash loops, taken from the engine's pool when it fits in a pool buffer and from the heap
+// otherwise
+class ScratchBuffer
+{
+public:
+    ScratchBuffer(swroo::utils::BufferPool* p_Pool, const usize p_Size)
+    {
+        if (p_Pool != nullptr && p_Size <= p_Pool->getBufferSize())
+            m_Pooled.emplace(p_Pool->acquire());
+        else
+            m_Heap.resize(p_Size);
+    }
+
+    [[nodiscard]] u8* getData() { return m_Pooled.has_value() ? m_Pooled->getData() : m_Heap.data(); }
+
+private:
+    std::optional<swroo::utils::BufferPool::Buffer> m_Pooled;
+    std::vector<u8> m_Heap;
+};
+
+// Streams [p_Offset + p_Done, p_Offset + p_Size) of p_Reader into p_SHA in p_Budget sized chunks, no larger than a
+// p_Pool buffer. p_OnChunk gets the number of bytes hashed so far after every chunk but the last, when p_SHA is on a
+// block boundary.
+static void hashRange(swroo::FileReader& p_Reader, const usize p_Offset, const usize p_Size, const usize p_Budget, swroo::utils::BufferPool* p_Pool,
+                      std::atomic<usize>& p_Processed, swroo::crypto::SHA256& p_SHA, usize p_Done = 0, const std::function<void(usize)>& p_OnChunk = {})
+{
+    usize l_BufferSize = std::min(p_Size, std::max<usize>(p_Budget & ~static_cast<usize>(0x1FF), 0x200));
+    if (p_Pool != nullptr)
+        l_BufferSize = std::min(l_BufferSize, p_Pool->getBufferSize());
+
+    ScratchBuffer l_Buffer(p_Pool, l_BufferSize);
+    while (p_Done < p_Size)
+    {
+        const usize l_ChunkSize = std::min(l_BufferSize, p_Size - p_Done);
+        p_Reader.readData(l_Buffer.getData(), l_ChunkSize, p_Offset + p_Done);
+        p_SHA.update(l_Buffer.getData(), l_ChunkSize);
+        p_Done += l_ChunkSize;
+        p_Processed += l_ChunkSize;
+
+        if (p_OnChunk && p_Done < p_Size)
+            p_OnChunk(p_Done);
+    }
+}
+
+// Checks every p_BlockSize block of the data region, starting at p_FirstBlock, against its hash. The hashes either come
+// from p_InlineHashes or are read from p_HashOffset. IVFC zero pads the last block to the full block size, hierarchical
+// SHA-256 does not. Blocks are read into p_Pool buffers, several at a time when they fit. p_OnChunk gets the index of
+// the next block to check after every chunk.
+// Returns the index of the first bad block, or UINT64_MAX if every block matched.
+static usize verifyHashLevel(swroo::FileReader& p_Reader, const usize p_DataOffset, const usize p_DataSize, const usize p_BlockSize,
+                             const std::span<const u8> p_InlineHashes, const usize p_HashOffset, const bool p_PadLastBlock,
+                             const usize p_Budget, swroo::utils::BufferPool* p_Pool, std::atomic<usize>& p_Processed, const usize p_FirstBlock = 0,
+                             const std::function<void(usize)>& p_OnChunk = {})
+{
+    const usize l_BlockCount = (p_DataSize + p_BlockSize - 1) / p_BlockSize;
+    if (!p_InlineHashes.empty() && p_InlineHashes.size() < l_BlockCount * sizeof(swroo::crypto::SHA256Hash))
+        return 0;
+    if (p_FirstBlock >= l_BlockCount)
+        return UINT64_MAX;
+
+    usize l_BlocksPerChunk = p_Budget / (p_BlockSize + sizeof(swroo::crypto::SHA256Hash));
+    if (p_Pool != nullptr)
+        l_BlocksPerChunk = std::min(l_BlocksPerChunk, p_Pool->getBufferSize() / p_BlockSize);
+    l_BlocksPerChunk = std::clamp<usize>(l_BlocksPerChunk, 1, l_BlockCount - p_FirstBlock);
+
+    ScratchBuffer l_Buffer(p_Pool, l_BlocksPerChunk * p_BlockSize);
+    u8* l_Data = l_Buffer.getData();
+    std::vector<swroo::crypto::SHA256Hash> l_Expected(l_BlocksPerChunk);
+    std::vector<swroo::crypto::SHA256Hash> l_Actual(l_BlocksPerChunk);
+    std::vector<std::span<const u8>> l_Inputs(l_BlocksPerChunk);
+
+    for (usize l_Block = p_FirstBlock; l_Block < l_BlockCount; l_Block += l_BlocksPerChunk)
+    {
+        const usize l_Count = std::min(l_BlocksPerChunk, l_BlockCount - l_Block);
+        const usize l_ChunkOffset = l_Block * p_BlockSize;
+        const usize l_ChunkSize = std::min(l_Count * p_BlockSize, p_DataSize - l_ChunkOffset);
+
+        p_Reader.readData(l_Data, l_ChunkSize, p_DataOffset + l_ChunkOffset);
+        p_Processed += l_ChunkSize;
+
+        const usize l_HashesSize = l_Count * sizeof(swroo::crypto::SHA256Hash);
+        if (p_InlineHashes.empty())
+            p_Reader.readData(l_Expected.data(), l_HashesSize, p_HashOffset + l_Block * sizeof(swroo::crypto::SHA256Hash));
+        else
+            std::memcpy(l_Expected.data(), p_InlineHashes.data() + l_Block * sizeof(swroo::crypto::SHA256Hash), l_HashesSize);
+
+        for (usize i = 0; i < l_Count; ++i)
         {
-            
+            const usize l_Start = i * p_BlockSize;
+            usize l_Size = std::min(p_BlockSize, l_ChunkSize - l_Start);
+            if (p_PadLastBlock && l_Size < p_BlockSize)
+            {
+                std::memset(l_Data + l_Start + l_Size, 0, p_BlockSize - l_Size);
+                l_Size = p_BlockSize;
+            }
+            l_Inputs[i] = std::span<const u8>(l_Data + l_Start, l_Size);
         }
-        else
+
+        swroo::crypto::SHA256::hashBatch(std::span(l_Inputs.data(), l_Count), std::span(l_Actual.data(), l_Count));
+        for (usize i = 0; i < l_Count; ++i)
         {
-            
+            if (l_Actual[i] != l_Expected[i])
+                return l_Block + i;
         }
+
+        if (p_OnChunk)
+            p_OnChunk(l_Block + l_Count);
     }
+    return UINT64_MAX;
+}
+
+void swroo::filesys::NCA::verifySectionTree(const u8 p_Index, FileReader& p_Section, const usize p_Budget, const usize p_ResumeSize,
+                                            const std::function<void(usize)>& p_OnProgress, VerifyResult::Section& p_Result, std::atomic<usize>& p_Processed) const
+{
+    using Status = VerifyResult::Status;
+    const FSEntry& l_Entry = *m_Entries[p_Index];
+    utils::BufferPool* l_Pool = &m_Engine->getBufferPool();
+
+    if (l_Entry.header.fsFype == FSEntry::Header::FILE_PFS0)
+    {
+        const FSEntry::PFS0SuperBlock& l_SuperBlock = l_Entry.pfs0;
+        if (l_SuperBlock.size == 0 || l_SuperBlock.hashSize % sizeof(crypto::SHA256Hash) != 0)
+        {
+            p_Result.hashTree = Status::MISMATCH;
+            p_Result.error = "Invalid hierarchical SHA-256 header";
+            return;
+        }
+
+        // The master hash covers the whole hash table, which in turn covers the PFS0 blocks
+        crypto::SHA256 l_MasterSHA;
+        hashRange(p_Section, l_SuperBlock.hashOffset, l_SuperBlock.hashSize, p_Budget, l_Pool, p_Processed, l_MasterSHA);
+        if (l_MasterSHA.finalize() != l_SuperBlock.masterHash)
+        {
+            p_Result.hashTree = Status::MISMATCH;
+            p_Result.error = "Master hash mismatch";
+            return;
+        }
+
+        const usize l_BlockSize = l_SuperBlock.size;
+        const usize l_BadBlock = verifyHashLevel(p_Section, l_SuperBlock.pfsOffset, l_SuperBlock.pfsSize, l_BlockSize, {}, l_SuperBlock.hashOffset, false,
+                                                 p_Budget, l_Pool, p_Processed, p_ResumeSize / l_BlockSize, [&](const usize p_NextBlock)
+                                                 {
+                                                     p_OnProgress(std::min<usize>(p_NextBlock * l_BlockSize, l_SuperBlock.pfsSize));
+                                                 });
+        if (l_BadBlock != UINT64_MAX)
+        {
+            p_Result.hashTree = Status::MISMATCH;
+            p_Result.error = "PFS0 block " + std::to_string(l_BadBlock) + " mismatch";
+            p_Result.verifiedSize = l_BadBlock * l_BlockSize;
+            return;
+        }
+
+        p_Result.hashTree = Status::OK;
+        p_Result.verifiedSize = l_SuperBlock.pfsSize;
+        return;
+    }
+
+    if (l_Entry.header.fsFype == FSEntry::Header::FILE_ROMFS)
+    {
+        const FSEntry::IVFCHeader& l_IVFC = l_Entry.romfs.ivfcHeader;
+        if (l_IVFC.magic != utils::MagicFromChars('I', 'V', 'F', 'C'))
+        {
+            p_Result.hashTree = Status::MISMATCH;
+            p_Result.error = "Invalid IVFC magic";
+            return;
+        }
+
+        // Level 0 is covered by the master hash, every other level by the one before it. Only the data level is
+        // resumed, the levels above it are tiny.
+        for (u32 i = 0; i < l_IVFC.levels.size(); ++i)
+        {
+            const FSEntry::IVFCHeader::IVFCLevel& l_Level = l_IVFC.levels[i];
+            if (l_Level.blockSize == 0 || l_Level.blockSize >= 32)
+            {
+                p_Result.hashTree = Status::MISMATCH;
+                p_Result.error = "Invalid IVFC block size at level " + std::to_string(i);
+                return;
+            }
+
+            const bool l_IsDataLevel = i == l_IVFC.levels.size() - 1;
+            const usize l_BlockSize = static_cast<usize>(1) << l_Level.blockSize;
+            const std::span<const u8> l_InlineHashes = i == 0 ? std::span<const u8>(l_IVFC.masterHash.data(), std::min<usize>(l_IVFC.masterHashSize, l_IVFC.masterHash.size())) : std::span<const u8>();
+            const usize l_HashOffset = i == 0 ? 0 : l_IVFC.levels[i - 1].offset;
+
+            const usize l_BadBlock = verifyHashLevel(p_Section, l_Level.offset, l_Level.size, l_BlockSize, l_InlineHashes, l_HashOffset, true,
+                                                     p_Budget, l_Pool, p_Processed, l_IsDataLevel ? p_ResumeSize / l_BlockSize : 0, [&](const usize p_NextBlock)
+                                                     {
+                                                         if (l_IsDataLevel)
+                                                             p_OnProgress(std::min<usize>(p_NextBlock * l_BlockSize, l_Level.size));
+                                                     });
+            if (l_BadBlock != UINT64_MAX)
+            {
+                p_Result.hashTree = Status::MISMATCH;
+                p_Result.error = "IVFC level " + std::to_string(i) + " block " + std::to_string(l_BadBlock) + " mismatch";
+                if (l_IsDataLevel)
+                    p_Result.verifiedSize = l_BadBlock * l_BlockSize;
+                return;
+            }
+        }
+
+        p_Result.hashTree = Status::OK;
+        p_Result.verifiedSize = l_IVFC.levels.back().size;
+        return;
+    }
+
+    p_Result.error = "Unknown hash type: " + std::to_string(l_Entry.header.fsFype);
+}
+
+std::optional<swroo::filesys::ContentIndex::Location> swroo::filesys::NCA::findVerifiedCopy()
+{
+    if (!m_ContentID.has_value())
+        return std::nullopt;
+
+    const std::optional<ContentIndex::Content> l_Content = m_Engine->getContentIndex().find(*m_ContentID);
+    if (!l_Content.has_value() || !l_Content->isVerified() || l_Content->size != m_File->getFileSize() || l_Content->headerHash != getHeaderHash())
+        return std::nullopt;
+    if (l_Content->verifiedLocation == ContentIndex::getLocation(*m_File))
+        return std::nullopt;
+    return l_Content->verifiedLocation;
+}
+
+swroo::crypto::SHA256Hash swroo::filesys::NCA::getHeaderHash() const
+{
+    return crypto::SHA256::hash(m_RawHeader->data(), c_HeaderSize);
+}
+
+swroo::filesys::NCA::VerifyResult swroo::filesys::NCA::verify(const usize p_MemoryBudget, VerifyCache* p_Cache)
+{
+    using Status = VerifyResult::Status;
+
+    VerifyResult l_Result;
+    std::atomic<usize> l_Processed = 0;
+    const std::chrono::steady_clock::time_point l_Start = std::chrono::steady_clock::now();
+
+    // The FS headers are already decrypted, hash them as they are stored
+    for (u8 i = 0; i < m_Entries.size(); ++i)
+    {
+        if (!hasSection(i))
+            continue;
+        const crypto::SHA256Hash l_Hash = crypto::SHA256::hash(m_Entries[i].getData().data(), sizeof(FSEntry));
+        l_Result.sections[i].headerHash = l_Hash == m_Header->hashTables[i] ? Status::OK : Status::MISMATCH;
+    }
+
+    // Pick up where a previous run left off, results are only trusted while the file is unchanged
+    std::optional<VerifyCache::Record> l_Record;
+    if (p_Cache != nullptr && m_ContentID.has_value())
+    {
+        const std::optional<VerifyCache::Identity> l_Identity = VerifyCache::getIdentity(m_File->getFilePath(), m_File->getFileSize());
+        if (l_Identity.has_value())
+            l_Record = p_Cache->begin(*m_ContentID, *l_Identity);
+    }
+
+    const auto l_IsFinal = [](const u8 p_Status)
+    {
+        return static_cast<Status>(p_Status) == Status::OK || static_cast<Status>(p_Status) == Status::MISMATCH;
+    };
+    const auto l_Checkpoint = [this, p_Cache, &l_Record](const std::function<void(VerifyCache::Record&)>& p_Update, const bool p_Flush = false)
+    {
+        if (l_Record.has_value())
+            p_Cache->update(*m_ContentID, p_Update, p_Flush);
+    };
+
+    // Open everything up front, key derivation and reference counting are not thread safe
+    std::array<FileReader*, 4> l_Sections{};
+    utils::CallOnDestroy l_DeleteSections([&l_Sections]
+    {
+        for (const FileReader* l_Section : l_Sections)
+            delete l_Section;
+    });
+
+    const bool l_HashContent = m_ContentID.has_value() && !(l_Record.has_value() && l_IsFinal(l_Record->contentStatus));
+    if (m_ContentID.has_value() && !l_HashContent)
+        l_Result.contentHash = static_cast<Status>(l_Record->contentStatus);
+
+    usize l_StreamCount = l_HashContent ? 1 : 0;
+    for (u8 i = 0; i < m_Entries.size(); ++i)
+    {
+        // Patch sections are hashed over the patched image, which needs the base NCA
+        if (!hasSection(i) || isPatchSection(i))
+            continue;
+
+        if (l_Record.has_value() && l_IsFinal(l_Record->sections[i].status))
+        {
+            l_Result.sections[i].hashTree = static_cast<Status>(l_Record->sections[i].status);
+            l_Result.sections[i].verifiedSize = l_Record->sections[i].progress;
+            l_Result.fromCache = true;
+            continue;
+        }
+
+        try
+        {
+            l_Sections[i] = openUncachedSection(i);
+            ++l_StreamCount;
+        }
+        catch (const std::exception& l_Exception)
+        {
+            l_Result.sections[i].hashTree = Status::READ_FAILED;
+            l_Result.sections[i].error = l_Exception.what();
+        }
+    }
+    l_Result.fromCache |= m_ContentID.has_value() && !l_HashContent;
+
+    // Verification is background work, interactive reads on the same scheduler go first
+    const usize l_StreamBudget = p_MemoryBudget / std::max<usize>(l_StreamCount, 1);
+    utils::TaskScheduler::TaskGroup l_Streams(m_Engine->getScheduler(), utils::TaskScheduler::Priority::BACKGROUND);
+
+    for (u8 i = 0; i < l_Sections.size(); ++i)
+    {
+        if (l_Sections[i] == nullptr)
+            continue;
+
+        const usize l_ResumeSize = l_Record.has_value() ? l_Record->sections[i].progress : 0;
+        l_Streams.run([this, i, l_ResumeSize, &l_Sections, &l_Result, &l_Processed, &l_Checkpoint, l_StreamBudget]
+        {
+            VerifyResult::Section& l_Section = l_Result.sections[i];
+            try
+            {
+                verifySectionTree(i, *l_Sections[i], l_StreamBudget, l_ResumeSize, [i, &l_Checkpoint](const usize p_Progress)
+                {
+                    l_Checkpoint([i, p_Progress](VerifyCache::Record& p_Record) { p_Record.sections[i].progress = p_Progress; });
+                }, l_Section, l_Processed);
+            }
+            catch (const std::exception& l_Exception)
+            {
+                l_Section.hashTree = Status::READ_FAILED;
+                l_Section.error = l_Exception.what();
+            }
+
+            l_Checkpoint([i, &l_Section](VerifyCache::Record& p_Record)
+            {
+                p_Record.sections[i].status = static_cast<u8>(l_Section.hashTree);
+                if (l_Section.hashTree != Status::READ_FAILED)
+                    p_Record.sections[i].progress = l_Section.verifiedSize;
+            });
+        });
+    }
+
+    std::optional<crypto::SHA256Hash> l_ContentHash;
+    if (l_HashContent)
+    {
+        const crypto::SHA256::State l_ResumeState = l_Record.has_value() ? l_Record->contentState : crypto::SHA256::State{};
+        l_Streams.run([this, l_ResumeState, &l_Result, &l_ContentHash, &l_Processed, &l_Checkpoint, l_StreamBudget]
+        {
+            try
+            {
+                crypto::SHA256 l_SHA;
+                if (l_ResumeState.size > 0)
+                    l_SHA.setState(l_ResumeState);
+
+                // The content ID is the first half of the SHA-256 of the whole NCA
+                hashRange(*m_File, 0, m_File->getFileSize(), l_StreamBudget, &m_Engine->getBufferPool(), l_Processed, l_SHA, l_ResumeState.size, [&l_SHA, &l_Checkpoint](usize)
+                {
+                    const crypto::SHA256::State l_State = l_SHA.getState();
+                    l_Checkpoint([&l_State](VerifyCache::Record& p_Record) { p_Record.contentState = l_State; });
+                });
+
+                const crypto::SHA256Hash l_Hash = l_SHA.finalize();
+                l_ContentHash = l_Hash;
+                l_Result.contentHash = std::equal(m_ContentID->begin(), m_ContentID->end(), l_Hash.begin()) ? Status::OK : Status::MISMATCH;
+            }
+            catch (const std::exception&)
+            {
+                l_Result.contentHash = Status::READ_FAILED;
+            }
+
+            l_Checkpoint([&l_Result](VerifyCache::Record& p_Record) { p_Record.contentStatus = static_cast<u8>(l_Result.contentHash); });
+        });
+    }
+
+    l_Streams.wait();
+
+    // Read failures are retried next time, everything else is final
+    bool l_Complete = l_Result.contentHash != Status::READ_FAILED;
+    for (const VerifyResult::Section& l_Section : l_Result.sections)
+        l_Complete &= l_Section.hashTree != Status::READ_FAILED;
+
+    l_Checkpoint([l_Complete](VerifyCache::Record& p_Record)
+    {
+        p_Record.verifiedAt = l_Complete ? std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count() : 0;
+    }, true);
+
+    // Lets other copies of the same content be skipped
+    if (m_ContentID.has_value() && l_Result.contentHash == Status::OK && l_Result.isValid())
+        m_Engine->getContentIndex().setVerified(*m_ContentID, ContentIndex::getLocation(*m_File), getHeaderHash(), l_ContentHash);
+
+    l_Result.bytesProcessed = l_Processed;
+    l_Result.seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - l_Start).count();
+    return l_Result;
 }
@@ -1,5 +1,15 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "bktr.hpp"
+#include "romfs.hpp"
+#include "../content_index.hpp"
 #include "../file.hpp"
+#include "../../util/header_view.hpp"
 
 namespace swroo
 {
@@ -9,6 +19,11 @@ namespace swroo
     }
 
     class Engine;
+
+    namespace filesys
+    {
+        class VerifyCache;
+    }
 }
 
 namespace swroo::filesys
@@ -47,6 +62,7 @@ namespace swroo::filesys
             ZERO_PADDING(0x4);
             u32 sdkVersion;
             u8 KeyGen;
+            u8 signatureKeyGen; // Easy to miss, everything after it up to the FS entries moves by one byte without it
             ZERO_PADDING(0xE);
             ByteArray<0x10> rightsID;
             std::array<FSEntry, 0x4> entries;
@@ -58,6 +74,8 @@ namespace swroo::filesys
             [[nodiscard]] MagicType getMagicType() const;
 
             [[nodiscard]] u8 getEntryCount() const;
+            [[nodiscard]] u8 getKeyGeneration() const;
+            [[nodiscard]] bool hasRightsID() const;
         };
 
         struct FSEntry
@@ -99,9 +117,11 @@ namespace swroo::filesys
 
                 u32 magic;
                 u32 magicNumber;
-                PADDING(0x8);
-                std::array<IVFCLevel, 0x6> levels;
-                PADDING(0x40);
+                u32 masterHashSize;
+                u32 levelCount;
+                std::array<IVFCLevel, 0x6> levels; // blockSize is stored as log2
+                PADDING(0x20);
+                ByteArray<0x20> masterHash;
             };
 
             struct PFS0SuperBlock
@@ -146,28 +166,167 @@ namespace swroo::filesys
                 RomFSuperBlock romfs;
                 BKRTSuperBlock bkrts;
             };
+
+            // Upper half of the AES-CTR counter, built from the section generation and secure value
+            [[nodiscard]] ByteArray<0x10> getCounter() const;
+            [[nodiscard]] u32 getGeneration() const;
         };
+        static_assert(sizeof(Header) == 0x400, "NCA header must be 0x400 bytes");
+        // The size alone does not catch a field in the wrong place, the key fields are pinned too
+        static_assert(offsetof(Header, signatureKeyGen) == 0x221, "NCA signature key generation must be at 0x221");
+        static_assert(offsetof(Header, rightsID) == 0x230, "NCA rights ID must be at 0x230");
+        static_assert(offsetof(Header, keyArea) == 0x300, "NCA key area must be at 0x300");
+        static_assert(sizeof(FSEntry::IVFCHeader) == 0xE0, "IVFC header must be 0xE0 bytes");
+        static_assert(sizeof(FSEntry::PFS0SuperBlock) == 0x1F8, "PFS0 superblock must be 0x1F8 bytes");
+        static_assert(sizeof(FSEntry::RomFSuperBlock) == 0x1F8, "RomFS superblock must be 0x1F8 bytes");
+        static_assert(sizeof(FSEntry::BKRTSuperBlock) == 0x1F8, "BKTR superblock must be 0x1F8 bytes");
+        static_assert(sizeof(FSEntry) == 0x200, "NCA FS header must be 0x200 bytes");
 
     public:
-        explicit NCA(FileReader* p_MainFile, Engine* p_Engine, bool p_ShouldOwnFile = true);
+        using ContentType = Header::ContentType;
+        using MagicType = Header::MagicType;
+
+        // What an NCA is, as told by its header alone
+        struct Probe
+        {
+            MagicType magic;
+            bool encrypted;
+            u8 distributionType; // 0 for downloaded content, 1 for game cards
+            ContentType contentType;
+            u64 size;
+            u64 titleID;
+            u8 keyGeneration;
+            ByteArray<0x10> rightsID;
+
+            [[nodiscard]] bool hasRightsID() const { return !utils::isZero(rightsID.data(), rightsID.size()); }
+        };
+
+        struct VerifyResult
+        {
+            enum class Status : u8 {
+                SKIPPED,
+                OK,
+                MISMATCH,
+                READ_FAILED,
+            };
+
+            struct Section
+            {
+                Status headerHash = Status::SKIPPED;
+                Status hashTree = Status::SKIPPED;
+                usize verifiedSize = 0; // Data bytes of the last hash level checked so far
+                std::string error;
+            };
+
+            std::array<Section, 4> sections{};
+            Status contentHash = Status::SKIPPED;
+
+            usize bytesProcessed = 0;
+            f64 seconds = 0.0;
+            bool fromCache = false; // Some results were taken from a VerifyCache instead of being hashed again
+
+            [[nodiscard]] bool isValid() const;
+            [[nodiscard]] f64 getThroughput() const; // MiB/s
+            [[nodiscard]] static const char* getStatusName(Status p_Status);
+        };
+
+        static constexpr usize c_DefaultVerifyBudget = 0x1000000;
+        // Main header plus the four FS headers
+        static constexpr usize c_HeaderSize = 0xC00;
+        // Every field of Probe sits in the second sector of the header, behind the signatures
+        static constexpr usize c_ProbeOffset = 0x200;
+        static constexpr usize c_ProbeSize = 0x200;
+
+        // p_Engine must not be null, it provides the keys and everything verify runs on. p_ContentID is the NCA name
+        // inside its PFS, needed to check the whole-file hash.
+        explicit NCA(FileReader* p_MainFile, Engine* p_Engine, bool p_ShouldOwnFile = true, const std::optional<ByteArray<0x10>>& p_ContentID = std::nullopt);
+        // Same as the constructor with failures returned instead of thrown, for scans over many files where most
+        // failures are expected. An owned p_MainFile is deleted on failure.
+        [[nodiscard]] static utils::Expected<NCA> tryOpen(FileReader* p_MainFile, Engine* p_Engine, bool p_ShouldOwnFile = true,
+                                                          const std::optional<ByteArray<0x10>>& p_ContentID = std::nullopt);
+        // For callers that already read the first c_HeaderSize bytes of p_MainFile, e.g. batched through an IOScheduler
+        [[nodiscard]] static utils::Expected<NCA> tryOpen(FileReader* p_MainFile, const ByteArray<c_HeaderSize>& p_RawHeader, Engine* p_Engine, bool p_ShouldOwnFile = true,
+                                                          const std::optional<ByteArray<0x10>>& p_ContentID = std::nullopt);
+        // Reads and decrypts only the header sector that Probe needs from the NCA at p_Offset of p_File, for classifying
+        // many files. FS headers are left alone and no NCA is constructed. p_HeaderAES is an XTS context with the
+        // header key, one per thread.
+        [[nodiscard]] static utils::Expected<Probe> probe(FileReader& p_File, usize p_Offset, crypto::AES& p_HeaderAES);
+        // Same for callers that already read the c_ProbeSize bytes at c_ProbeOffset
+        [[nodiscard]] static utils::Expected<Probe> probe(const ByteArray<c_ProbeSize>& p_Sector, crypto::AES& p_HeaderAES);
+        [[nodiscard]] static const char* getContentTypeName(ContentType p_Type);
+
         NCA& operator=(const NCA&) = delete;
         NCA(NCA&& other) noexcept;
 
         ~NCA();
 
+        [[nodiscard]] ContentType getContentType() const { return VIEW_FIELD(m_Header, contentType); }
+        [[nodiscard]] u64 getTitleID() const { return VIEW_FIELD(m_Header, titleID); }
+
+        [[nodiscard]] bool hasSection(u8 p_Index) const;
+        [[nodiscard]] bool isPFSSection(u8 p_Index) const;
+        [[nodiscard]] bool isRomFSSection(u8 p_Index) const;
+        [[nodiscard]] bool isPatchSection(u8 p_Index) const;
+
+        // Returns a new decrypted reader over [p_Offset, p_Offset + p_Size) of the section, the caller takes ownership.
+        // Encrypted sections go through the engine's block cache.
+        [[nodiscard]] FileReader* openSection(u8 p_Index, usize p_Offset = 0, usize p_Size = UINT64_MAX);
+        // Returns a new reader over the PFS0 of the section, without its hash table. The caller takes ownership.
+        [[nodiscard]] FileReader* openPFSSection(u8 p_Index);
+        // One-off reads like control data can skip the block cache, their blocks are never read again
+        [[nodiscard]] RomFS openRomFS(u8 p_Index, bool p_UseCache = true);
+        [[nodiscard]] BKTR loadBKTR(u8 p_Index);
+
+        // Layers this update section on top of a base NCA section, p_Base must outlive the returned objects
+        [[nodiscard]] FileReader* openPatchedSection(u8 p_Index, NCA& p_Base, u8 p_BaseIndex, usize p_Offset = 0, usize p_Size = UINT64_MAX);
+        [[nodiscard]] RomFS openPatchedRomFS(u8 p_Index, NCA& p_Base, u8 p_BaseIndex);
+
+        [[nodiscard]] const std::optional<ByteArray<0x10>>& getContentID() const { return m_ContentID; }
+        // Heap bytes held by the parsed NCA, the object itself not included
+        [[nodiscard]] usize getMemoryUsage() const { return m_RawHeader ? c_HeaderSize : 0; }
+
+        // Checks the FS header hashes, every section hash tree and the content hash. Sections are verified
+        // concurrently, all streams together stay within p_MemoryBudget (at least one hash block each). With a cache,
+        // final results of unchanged content are reused and interrupted runs resume from their last checkpoint.
+        [[nodiscard]] VerifyResult verify(usize p_MemoryBudget = c_DefaultVerifyBudget, VerifyCache* p_Cache = nullptr);
+        // Another copy of this content that passed verification in this engine, with the same size and header, so the
+        // same master hash for every section. Its body is not compared, a copy damaged past the header only shows up
+        // when it is verified itself. Nothing if this copy is the verified one or none was verified yet.
+        [[nodiscard]] std::optional<ContentIndex::Location> findVerifiedCopy();
+        // SHA-256 of the decrypted header, FS headers included
+        [[nodiscard]] crypto::SHA256Hash getHeaderHash() const;
+
     private:
+        struct Unloaded {};
+        NCA(Unloaded, FileReader* p_MainFile, Engine* p_Engine, bool p_ShouldOwnFile, const std::optional<ByteArray<0x10>>& p_ContentID);
+        [[nodiscard]] static utils::Expected<NCA> tryOpen(FileReader* p_MainFile, const ByteArray<c_HeaderSize>* p_RawHeader, Engine* p_Engine, bool p_ShouldOwnFile,
+                                                          const std::optional<ByteArray<0x10>>& p_ContentID);
+        [[nodiscard]] utils::Error load(const ByteArray<c_HeaderSize>* p_RawHeader = nullptr);
+
         utils::DecryptResult decryptHeader(const ByteArray<3072>& p_RawData, crypto::AES& p_AES);
         utils::DecryptResult decryptFSEntries(const ByteArray<3072>& p_RawData, crypto::AES& p_AES, bool p_IsHeaderEnctrypted);
 
-        utils::DecryptResult decryptFSData(bool p_IsHeaderEnctrypted);
+        [[nodiscard]] const ByteArray<0x10>& getContentKey();
+        void getSectionRegion(u8 p_Index, usize p_Offset, usize p_Size, usize& p_RegionOffset, usize& p_RegionSize) const;
+        // Same as openSection without the block cache, for one-off sequential scans that would only evict useful blocks
+        [[nodiscard]] FileReader* openUncachedSection(u8 p_Index, usize p_Offset = 0, usize p_Size = UINT64_MAX);
+        void verifySectionTree(u8 p_Index, FileReader& p_Section, usize p_Budget, usize p_ResumeSize, const std::function<void(usize)>& p_OnProgress,
+                               VerifyResult::Section& p_Result, std::atomic<usize>& p_Processed) const;
 
         FileReader* m_File;
         bool m_FileOwned = true;
 
-        Header m_Header;
+        // Decrypted main header followed by the FS headers. Both views point into it, so moving an NCA only moves
+        // the pointer and the header is never copied after decryption.
+        std::unique_ptr<ByteArray<c_HeaderSize>> m_RawHeader;
+        utils::HeaderView<Header, 0x400> m_Header;
         Header::MagicType m_MagicType{ Header::MagicType::INVALID };
+        bool m_IsEncrypted = true;
 
-        std::array<FSEntry, 4> m_Entries{};
+        std::array<utils::HeaderView<FSEntry, 0x200>, 4> m_Entries{};
+        std::optional<ByteArray<0x10>> m_ContentKey;
+        std::optional<ByteArray<0x10>> m_ContentID;
+        u64 m_CacheOwner = 0;
 
         Engine* m_Engine{ nullptr };
     };
@@ -0,0 +1,200 @@
+#include "nso.hpp"
+
+#include <exception>
+#include <iostream>
+
+#include "pfs.hpp"
+#include "../io_scheduler.hpp"
+#include "../../util/compression/lz4.hpp"
+#include "../../util/crypto/sha256.hpp"
+#include "../../util/task_scheduler.hpp"
+
+static constexpr std::array<const char*, 3> c_SegmentNames = { "text", "ro", "data" };
+
+const swroo::filesys::NSO::SegmentHeader& swroo::filesys::NSO::Header::getSegment(const Segment p_Segment) const
+{
+    switch (p_Segment)
+    {
+    case Segment::TEXT: return text;
+    case Segment::RO: return ro;
+    case Segment::DATA: return data;
+    default: throw std::runtime_error("Invalid NSO segment");
+    }
+}
+
+void swroo::filesys::NSO::ImageDeleter::operator()(u8* p_Image) const
+{
+    ::operator delete[](p_Image, std::align_val_t(c_PageSize));
+}
+
+swroo::filesys::NSO::NSO(FileReader* p_File, const bool p_ShouldOwnFile)
+    : m_File(p_File), m_FileOwned(p_ShouldOwnFile), m_Name(p_File->getFilePath().filename().string())
+{
+    try
+    {
+        m_File->read(m_Header, 0);
+        if (m_Header.magic != utils::MagicFromChars('N', 'S', 'O', '0'))
+            throw std::runtime_error("Invalid NSO magic: " + m_Name);
+
+        // Segments must not overlap and must come in order, the image is sized from the data segment and bss
+        usize l_PreviousEnd = 0;
+        for (u8 i = 0; i < static_cast<u8>(Segment::COUNT); ++i)
+        {
+            const SegmentHeader& l_Segment = m_Header.getSegment(static_cast<Segment>(i));
+            const usize l_FileSize = m_Header.isCompressed(static_cast<Segment>(i)) ? m_Header.fileSizes[i] : l_Segment.size;
+            if (l_Segment.memoryOffset < l_PreviousEnd || static_cast<usize>(l_Segment.fileOffset) + l_FileSize > m_File->getFileSize())
+                throw std::runtime_error("Invalid NSO " + std::string(c_SegmentNames[i]) + " segment: " + m_Name);
+            l_PreviousEnd = static_cast<usize>(l_Segment.memoryOffset) + l_Segment.size;
+        }
+        m_ImageSize = (l_PreviousEnd + m_Header.bssSize + c_PageSize - 1) & ~(c_PageSize - 1);
+    }
+    catch (...)
+    {
+        // The destructor does not run for a throwing constructor, an owned file would leak
+        if (m_FileOwned)
+            delete m_File;
+        throw;
+    }
+}
+
+swroo::filesys::NSO::NSO(NSO&& other) noexcept
+    : m_File(other.m_File), m_FileOwned(other.m_FileOwned), m_Header(other.m_Header), m_Name(std::move(other.m_Name)), m_Image(std::move(other.m_Image)),
+      m_ImageSize(other.m_ImageSize), m_Compressed(std::move(other.m_Compressed)), m_Loaded(other.m_Loaded)
+{
+    other.m_File = nullptr;
+    other.m_FileOwned = false;
+}
+
+swroo::filesys::NSO::~NSO()
+{
+    if (m_FileOwned)
+        delete m_File;
+    m_File = nullptr;
+}
+
+std::span<u8> swroo::filesys::NSO::getSegment(const Segment p_Segment)
+{
+    if (!m_Loaded)
+        throw std::runtime_error("NSO is not loaded: " + m_Name);
+
+    const SegmentHeader& l_Segment = m_Header.getSegment(p_Segment);
+    return { m_Image.get() + l_Segment.memoryOffset, l_Segment.size };
+}
+
+void swroo::filesys::NSO::readSegments(IOScheduler& p_Scheduler)
+{
+    m_Image.reset(static_cast<u8*>(::operator new[](m_ImageSize, std::align_val_t(c_PageSize))));
+
+    // Only the gaps between segments and the bss need clearing, the segments are fully overwritten
+    usize l_Cleared = 0;
+    for (u8 i = 0; i < static_cast<u8>(Segment::COUNT); ++i)
+    {
+        const Segment l_Type = static_cast<Segment>(i);
+        const SegmentHeader& l_Segment = m_Header.getSegment(l_Type);
+        std::memset(m_Image.get() + l_Cleared, 0, l_Segment.memoryOffset - l_Cleared);
+        l_Cleared = static_cast<usize>(l_Segment.memoryOffset) + l_Segment.size;
+
+        // Uncompressed segments go straight into the image
+        if (!m_Header.isCompressed(l_Type))
+        {
+            p_Scheduler.enqueue(*m_File, l_Segment.fileOffset, l_Segment.size, m_Image.get() + l_Segment.memoryOffset);
+            continue;
+        }
+
+        m_Compressed[i].resize(m_Header.fileSizes[i]);
+        p_Scheduler.enqueue(*m_File, l_Segment.fileOffset, m_Compressed[i].size(), m_Compressed[i].data());
+    }
+    std::memset(m_Image.get() + l_Cleared, 0, m_ImageSize - l_Cleared);
+}
+
+void swroo::filesys::NSO::decodeSegment(const Segment p_Segment, const bool p_VerifyHash)
+{
+    const u8 l_Index = static_cast<u8>(p_Segment);
+    const SegmentHeader& l_Segment = m_Header.getSegment(p_Segment);
+    u8* l_Output = m_Image.get() + l_Segment.memoryOffset;
+
+    if (m_Header.isCompressed(p_Segment))
+    {
+        const std::vector<u8>& l_Input = m_Compressed[l_Index];
+        if (!compression::LZ4::decompressBlock(l_Input.data(), l_Input.size(), l_Output, l_Segment.size))
+            throw std::runtime_error("Failed to decompress NSO " + std::string(c_SegmentNames[l_Index]) + " segment: " + m_Name);
+    }
+
+    if (p_VerifyHash && m_Header.hasHash(p_Segment) && crypto::SHA256::hash(l_Output, l_Segment.size) != m_Header.hashes[l_Index])
+        throw std::runtime_error("NSO " + std::string(c_SegmentNames[l_Index]) + " segment hash mismatch: " + m_Name);
+}
+
+void swroo::filesys::NSO::load(utils::TaskScheduler& p_Scheduler, const bool p_VerifyHashes)
+{
+    NSO* l_Self = this;
+    loadAll(p_Scheduler, std::span(&l_Self, 1), p_VerifyHashes);
+}
+
+void swroo::filesys::NSO::loadAll(utils::TaskScheduler& p_Scheduler, const std::span<NSO* const> p_NSOs, const bool p_VerifyHashes)
+{
+    // Segments of every NSO are read together in file order, they usually all live in the same ExeFS
+    IOScheduler l_Scheduler;
+    for (NSO* l_NSO : p_NSOs)
+        l_NSO->readSegments(l_Scheduler);
+    l_Scheduler.run();
+
+    // One task per segment that needs any CPU work, the first failure is rethrown once the buffers are released
+    utils::TaskScheduler::TaskGroup l_Tasks(p_Scheduler);
+    for (NSO* l_NSO : p_NSOs)
+    {
+        for (u8 j = 0; j < static_cast<u8>(Segment::COUNT); ++j)
+        {
+            const Segment l_Segment = static_cast<Segment>(j);
+            if (!l_NSO->m_Header.isCompressed(l_Segment) && !(p_VerifyHashes && l_NSO->m_Header.hasHash(l_Segment)))
+                continue;
+
+            l_Tasks.run([l_NSO, l_Segment, p_VerifyHashes] { l_NSO->decodeSegment(l_Segment, p_VerifyHashes); });
+        }
+    }
+
+    std::exception_ptr l_Error;
+    try
+    {
+        l_Tasks.wait();
+    }
+    catch (...)
+    {
+        l_Error = std::current_exception();
+    }
+
+    for (NSO* l_NSO : p_NSOs)
+    {
+        for (std::vector<u8>& l_Compressed : l_NSO->m_Compressed)
+        {
+            l_Compressed.clear();
+            l_Compressed.shrink_to_fit();
+        }
+    }
+
+    if (l_Error)
+        std::rethrow_exception(l_Error);
+
+    for (NSO* l_NSO : p_NSOs)
+        l_NSO->m_Loaded = true;
+}
+
+std::vector<swroo::filesys::NSO> swroo::filesys::NSO::loadExeFS(utils::TaskScheduler& p_Scheduler, const PFS& p_ExeFS, const bool p_VerifyHashes)
+{
+    std::vector<NSO> l_NSOs;
+    for (const PFS::Entry& l_Entry : p_ExeFS.getEntries())
+    {
+        const std::string_view l_Name = l_Entry.name;
+        if (l_Name != "rtld" && l_Name != "main" && l_Name != "sdk" && !l_Name.starts_with("subsdk"))
+            continue;
+
+        NSO& l_NSO = l_NSOs.emplace_back(p_ExeFS.openEntry(l_Entry));
+        l_NSO.m_Name = l_Entry.name;
+        std::cout << "\tNSO " << l_Entry.name << ": " << l_NSO.m_ImageSize << " bytes" << '\n';
+    }
+
+    std::vector<NSO*> l_Pointers;
+    for (NSO& l_NSO : l_NSOs)
+        l_Pointers.push_back(&l_NSO);
+    loadAll(p_Scheduler, l_Pointers, p_VerifyHashes);
+    return l_NSOs;
+}
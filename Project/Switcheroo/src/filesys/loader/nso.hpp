@@ -0,0 +1,127 @@
+#pragma once
+#include "../../util/common.hpp"
+
+#include <memory>
+#include <span>
+#include <string>
+
+#include "../file.hpp"
+
+namespace swroo
+{
+    class IOScheduler;
+
+    namespace utils
+    {
+        class TaskScheduler;
+    }
+}
+
+namespace swroo::filesys
+{
+    class PFS;
+
+    class NSO
+    {
+    public:
+        static constexpr usize c_PageSize = 0x1000;
+
+        enum class Segment : u8 {
+            TEXT,
+            RO,
+            DATA,
+            COUNT,
+        };
+
+#pragma pack(push, 1)
+        struct SegmentHeader
+        {
+            u32 fileOffset;
+            u32 memoryOffset;
+            u32 size;
+        };
+
+        struct RelativeExtent
+        {
+            u32 offset;
+            u32 size;
+        };
+
+        struct Header
+        {
+            enum Flags : u32 {
+                TEXT_COMPRESSED = 1 << 0,
+                RO_COMPRESSED = 1 << 1,
+                DATA_COMPRESSED = 1 << 2,
+                TEXT_HASH = 1 << 3,
+                RO_HASH = 1 << 4,
+                DATA_HASH = 1 << 5,
+            };
+
+            u32 magic;
+            u32 version;
+            ZERO_PADDING(0x4);
+            u32 flags;
+            SegmentHeader text;
+            u32 moduleNameOffset;
+            SegmentHeader ro;
+            u32 moduleNameSize;
+            SegmentHeader data;
+            u32 bssSize;
+            ByteArray<0x20> moduleID;
+            std::array<u32, 3> fileSizes; // Compressed size of each segment
+            ZERO_PADDING(0x1C);
+            RelativeExtent apiInfo; // Relative to the ro segment
+            RelativeExtent dynstr;
+            RelativeExtent dynsym;
+            std::array<ByteArray<0x20>, 3> hashes; // SHA-256 of each decompressed segment
+
+            [[nodiscard]] const SegmentHeader& getSegment(Segment p_Segment) const;
+            [[nodiscard]] bool isCompressed(Segment p_Segment) const { return flags & (TEXT_COMPRESSED << static_cast<u32>(p_Segment)); }
+            [[nodiscard]] bool hasHash(Segment p_Segment) const { return flags & (TEXT_HASH << static_cast<u32>(p_Segment)); }
+        };
+#pragma pack(pop)
+        static_assert(sizeof(Header) == 0x100, "NSO header must be 0x100 bytes");
+
+        explicit NSO(FileReader* p_File, bool p_ShouldOwnFile = true);
+        NSO(const NSO&) = delete;
+        NSO(NSO&& other) noexcept;
+        ~NSO();
+
+        // Decompresses every segment into the image, segments are decoded in parallel on p_Scheduler
+        void load(utils::TaskScheduler& p_Scheduler, bool p_VerifyHashes = false);
+        // Same as load for several NSOs at once, all their segments are decoded in parallel
+        static void loadAll(utils::TaskScheduler& p_Scheduler, std::span<NSO* const> p_NSOs, bool p_VerifyHashes = false);
+        // Opens and loads the NSOs of an ExeFS (rtld, main, sdk, subsdk*), skipping everything else
+        [[nodiscard]] static std::vector<NSO> loadExeFS(utils::TaskScheduler& p_Scheduler, const PFS& p_ExeFS, bool p_VerifyHashes = false);
+
+        [[nodiscard]] const Header& getHeader() const { return m_Header; }
+        [[nodiscard]] const std::string& getName() const { return m_Name; }
+        [[nodiscard]] bool isLoaded() const { return m_Loaded; }
+
+        // Page aligned, covers every segment and the bss
+        [[nodiscard]] std::span<u8> getImage() { return { m_Image.get(), m_ImageSize }; }
+        [[nodiscard]] std::span<u8> getSegment(Segment p_Segment);
+
+    private:
+        struct ImageDeleter
+        {
+            void operator()(u8* p_Image) const;
+        };
+
+        // Only queues the segment reads, the scheduler issues them on the calling thread before any worker starts
+        void readSegments(IOScheduler& p_Scheduler);
+        void decodeSegment(Segment p_Segment, bool p_VerifyHash);
+
+        FileReader* m_File;
+        bool m_FileOwned = true;
+
+        Header m_Header{};
+        std::string m_Name;
+
+        std::unique_ptr<u8[], ImageDeleter> m_Image;
+        usize m_ImageSize = 0;
+        std::array<std::vector<u8>, 3> m_Compressed;
+        bool m_Loaded = false;
+    };
+}
@@ -1,8 +1,40 @@
 #include "pfs.hpp"
 
 #include "../file.hpp"
+#include "../io_scheduler.hpp"
+#include "../ticket.hpp"
+#include "../../engine.hpp"
+#include "../../util/memory_usage.hpp"
 #include <iostream>
 
+// NCA names are their content ID in hex, followed by ".nca" or ".cnmt.nca"
+static std::optional<ByteArray<0x10>> parseContentID(const std::string_view p_Name)
+{
+    ByteArray<0x10> l_ContentID{};
+    if (p_Name.size() <= l_ContentID.size() * 2)
+        return std::nullopt;
+
+    for (usize i = 0; i < l_ContentID.size() * 2; ++i)
+    {
+        const char l_Char = p_Name[i];
+        u8 l_Nibble;
+        if (l_Char >= '0' && l_Char <= '9')
+            l_Nibble = l_Char - '0';
+        else if (l_Char >= 'a' && l_Char <= 'f')
+            l_Nibble = l_Char - 'a' + 10;
+        else if (l_Char >= 'A' && l_Char <= 'F')
+            l_Nibble = l_Char - 'A' + 10;
+        else
+            return std::nullopt;
+
+        l_ContentID[i / 2] |= i % 2 == 0 ? l_Nibble << 4 : l_Nibble;
+    }
+
+    if (p_Name[l_ContentID.size() * 2] != '.')
+        return std::nullopt;
+    return l_ContentID;
+}
+
 swroo::filesys::PFS::Header::MagicType swroo::filesys::PFS::Header::getMagicType() const
 {
     if (magic == utils::MagicFromChars('P', 'F', 'S', '0'))
@@ -18,62 +50,221 @@ const char* swroo::filesys::PFS::Header::getMagicString() const
 }
 
 swroo::filesys::PFS::PFS(FileReader* p_File, Engine* p_Engine, const bool p_ShouldOwnFile)
+    : PFS(Unloaded{}, p_File, p_Engine, p_ShouldOwnFile)
+{
+    if (const utils::Error l_Error = load())
+        throw std::runtime_error(l_Error.toString(m_File->getFilePath()));
+}
+
+swroo::filesys::PFS::PFS(Unloaded, FileReader* p_File, Engine* p_Engine, const bool p_ShouldOwnFile)
     : m_File(p_File), m_FileOwned(p_ShouldOwnFile), m_Engine(p_Engine)
 {
-    std::cout << "\nLoading PFS0 from: " << p_File << '\n';
+}
+
+swroo::utils::Expected<swroo::filesys::PFS> swroo::filesys::PFS::tryOpen(FileReader* p_File, Engine* p_Engine, const bool p_ShouldOwnFile)
+{
+    PFS l_PFS(Unloaded{}, p_File, p_Engine, p_ShouldOwnFile);
+    try
+    {
+        if (const utils::Error l_Error = l_PFS.load())
+            return l_Error;
+    }
+    catch (const std::exception&)
+    {
+        // Everything a scan runs into is checked up front, only real I/O errors still throw
+        return utils::Error{ utils::ErrorCode::READ_FAILED, "PFS" };
+    }
+    return l_PFS;
+}
+
+swroo::utils::Error swroo::filesys::PFS::readHeader(FileReader& p_File, Header& p_Header)
+{
+    if (const utils::Error l_Error = p_File.tryRead(p_Header, 0, "PFS header"))
+        return l_Error;
+
+    if (p_Header.getMagicType() == Header::MagicType::INVALID)
+        return { utils::ErrorCode::BAD_MAGIC, "PFS header", p_Header.magic };
+    return {};
+}
+
+swroo::utils::Generator<swroo::utils::Expected<swroo::filesys::PFS::Entry>> swroo::filesys::PFS::enumerate(FileReader& p_File, const std::stop_token p_StopToken)
+{
+    Header l_Header;
+    if (const utils::Error l_Error = readHeader(p_File, l_Header))
+    {
+        co_yield l_Error;
+        co_return;
+    }
+
+    for (utils::Expected<Entry>& l_Entry : parseEntries(p_File, l_Header, p_StopToken))
+        co_yield std::move(l_Entry);
+}
+
+swroo::utils::Generator<swroo::utils::Expected<swroo::filesys::PFS::Entry>> swroo::filesys::PFS::parseEntries(FileReader& p_File, const Header p_Header, const std::stop_token p_StopToken)
+{
+    // Entries are read this many at a time, so the first ones come out without waiting for the whole table
+    constexpr usize l_BatchSize = 0x40;
+
+    const bool l_IsHFS = p_Header.getMagicType() == Header::MagicType::HFS0;
+    const usize l_EntrySize = l_IsHFS ? sizeof(HFSEntry) : sizeof(PFSEntry);
+    const usize l_StrTabOffset = sizeof(Header) + (p_Header.numEntries * l_EntrySize);
+    const usize l_ContentOffset = l_StrTabOffset + p_Header.strTabSize;
+
+    // Checked before allocating, a corrupt entry count would otherwise ask for gigabytes
+    if (l_ContentOffset > p_File.getFileSize())
+    {
+        co_yield utils::Error{ utils::ErrorCode::TRUNCATED, "PFS metadata", l_ContentOffset };
+        co_return;
+    }
 
-    m_File->read(m_Header);
+    // Names come last in the metadata and are needed before the first entry can be handed out. They are fetched
+    // together with the first batch of entries, which for most PFS is the whole table.
+    std::vector<char> l_StrTab(p_Header.strTabSize);
+    std::vector<u8> l_Batch(l_BatchSize * l_EntrySize);
+    const usize l_FirstCount = std::min<usize>(l_BatchSize, p_Header.numEntries);
+    const FileReader::ReadRequest l_Requests[] = {
+        { sizeof(Header), std::span(l_Batch.data(), l_FirstCount * l_EntrySize) },
+        { l_StrTabOffset, std::span(reinterpret_cast<u8*>(l_StrTab.data()), l_StrTab.size()) },
+    };
+    p_File.readv(l_Requests);
 
-    const Header::MagicType l_MagicType = m_Header.getMagicType();
-    if (l_MagicType == Header::MagicType::INVALID)
+    for (usize l_First = 0; l_First < p_Header.numEntries; l_First += l_BatchSize)
     {
-        throw std::runtime_error("Invalid magic type: " + std::string(m_Header.getMagicString()));
+        const usize l_Count = std::min<usize>(l_BatchSize, p_Header.numEntries - l_First);
+        if (l_First > 0)
+            p_File.readData(l_Batch.data(), l_Count * l_EntrySize, sizeof(Header) + l_First * l_EntrySize);
+
+        for (usize i = 0; i < l_Count; ++i)
+        {
+            if (p_StopToken.stop_requested())
+                co_return;
+
+            const u8* l_Raw = l_Batch.data() + i * l_EntrySize;
+            Entry l_Entry;
+
+            FSEntry l_FSEntry;
+            std::memcpy(&l_FSEntry, l_Raw, sizeof(FSEntry));
+            if (l_IsHFS)
+            {
+                HFSEntry l_HFSEntry;
+                std::memcpy(&l_HFSEntry, l_Raw, sizeof(HFSEntry));
+                l_Entry.hashSize = l_HFSEntry.hashSize;
+                l_Entry.hash = l_HFSEntry.hash;
+            }
+
+            if (l_FSEntry.strtabOffset >= l_StrTab.size())
+            {
+                co_yield utils::Error{ utils::ErrorCode::OUT_OF_RANGE, "PFS string table offset", l_First + i };
+                co_return;
+            }
+
+            const char* l_Name = l_StrTab.data() + l_FSEntry.strtabOffset;
+            l_Entry.name = std::string(l_Name, strnlen(l_Name, l_StrTab.size() - l_FSEntry.strtabOffset));
+            l_Entry.offset = l_ContentOffset + l_FSEntry.offset;
+            l_Entry.size = l_FSEntry.size;
+            co_yield std::move(l_Entry);
+        }
     }
+}
+
+swroo::utils::Error swroo::filesys::PFS::load()
+{
+    std::cout << "\nLoading PFS0 from: " << m_File << '\n';
+
+    if (const utils::Error l_Error = readHeader(*m_File, m_Header))
+        return l_Error;
 
     std::cout << "\tMagic: " << m_Header.getMagicString() << '\n';
     std::cout << "\tNumber of entries: " << m_Header.numEntries << '\n';
     std::cout << "\tString table size: " << m_Header.strTabSize << '\n';
 
-    constexpr usize l_EntriesOffset = sizeof(Header);
+    m_Entries.reserve(std::min<usize>(m_Header.numEntries, m_File->getFileSize() / sizeof(PFSEntry)));
+    for (utils::Expected<Entry>& l_Entry : parseEntries(*m_File, m_Header, {}))
+    {
+        if (!l_Entry)
+            return l_Entry.getError();
 
-    const usize l_EntrySize = l_MagicType == Header::MagicType::PFS0 ? sizeof(PFSEntry) : sizeof(HFSEntry);
-    const usize l_MetadataSize = sizeof(Header) + (m_Header.numEntries * l_EntrySize) + m_Header.strTabSize;
-    const usize l_StrTabOffset = l_EntriesOffset + (m_Header.numEntries * l_EntrySize);
-    const usize l_ContentOffset = l_StrTabOffset + m_Header.strTabSize;
+        const Entry& l_Added = m_Entries.emplace_back(l_Entry.takeValue());
+        std::cout << "\tEntry " << m_Entries.size() - 1 << ": " << l_Added.name << ", Offset: " << l_Added.offset << ", Size: " << l_Added.size << '\n';
+    }
 
-    std::vector<u8> l_Metadata;
-    l_Metadata.resize(l_MetadataSize);
-    m_File->readData(l_Metadata.data(), l_MetadataSize, 0);
-    
-    if (l_Metadata.size() != l_MetadataSize)
+    // Tickets first, the NCAs they unlock may need their title keys
+    for (const Entry& l_Entry : m_Entries)
     {
-        throw std::runtime_error("Failed to read metadata from file: " + p_File->getFilePath().string());
-    }
+        if (!l_Entry.name.ends_with(".tik"))
+            continue;
 
-    std::vector<FSEntry> l_Entries(m_Header.numEntries);
-    std::vector<std::string> l_Strings(m_Header.numEntries);
+        utils::Expected<FileReader*> l_EntryFile = tryOpenEntry(l_Entry);
+        if (!l_EntryFile)
+        {
+            std::cout << "\tSkipping ticket " << l_Entry.name << ": " << l_EntryFile.getError().toString() << '\n';
+            continue;
+        }
 
-    for (usize i = 0; i < m_Header.numEntries; ++i)
-    {
-        const usize l_EntryOffset = l_EntriesOffset + (i * l_EntrySize);
-        m_File->read(l_Entries[i], l_EntryOffset);
-        const usize l_StrOffset = l_StrTabOffset + l_Entries[i].strtabOffset;
-        const usize l_StrSize = std::strlen(reinterpret_cast<const char*>(&l_Metadata[l_StrOffset]));
-        if (l_StrSize > 0)
+        FileReader* l_File = l_EntryFile.getValue();
+        try
         {
-            l_Strings[i].resize(l_StrSize);
-            std::memcpy(l_Strings[i].data(), l_Metadata.data() + l_StrOffset, l_StrSize);
+            const Ticket l_Ticket(*l_File);
+            if (!m_Engine->getKeyManager().importTicket(l_Ticket))
+                std::cout << "\tFailed to unwrap title key of " << l_Entry.name << '\n';
         }
+        catch (const std::exception& l_Exception)
+        {
+            std::cout << "\tSkipping ticket " << l_Entry.name << ": " << l_Exception.what() << '\n';
+        }
+        delete l_File;
+    }
+
+    std::vector<usize> l_NCAEntries;
+    for (usize i = 0; i < m_Entries.size(); ++i)
+    {
+        if (m_Entries[i].name.ends_with(".nca"))
+            l_NCAEntries.push_back(i);
+    }
+
+    // Every NCA header is read in one pass in file order, entry order can jump around the whole file
+    std::vector<ByteArray<NCA::c_HeaderSize>> l_Headers(l_NCAEntries.size());
+    IOScheduler l_Scheduler;
+    for (usize i = 0; i < l_NCAEntries.size(); ++i)
+    {
+        const Entry& l_Entry = m_Entries[l_NCAEntries[i]];
+        if (!SubFileReader::isInRange(*m_File, l_Entry.offset, l_Entry.size))
+            return { utils::ErrorCode::TRUNCATED, "PFS entry", l_NCAEntries[i] };
+        if (l_Entry.size < NCA::c_HeaderSize)
+            return { utils::ErrorCode::TRUNCATED, "NCA header", NCA::c_HeaderSize };
 
-        std::cout << "\tEntry " << i << ": " << l_Strings[i] << ", Offset: " << l_Entries[i].offset << ", Size: " << l_Entries[i].size << '\n';
+        l_Scheduler.enqueue(*m_File, l_Entry.offset, NCA::c_HeaderSize, l_Headers[i].data());
+    }
+    l_Scheduler.run();
+
+    for (usize i = 0; i < l_NCAEntries.size(); ++i)
+    {
+        const Entry& l_Entry = m_Entries[l_NCAEntries[i]];
+        utils::Expected<NCA> l_NCA = NCA::tryOpen(openEntry(l_Entry), l_Headers[i], m_Engine, true, parseContentID(l_Entry.name));
+        if (!l_NCA)
+            return l_NCA.getError();
+        m_NCAs.push_back(l_NCA.takeValue());
+    }
+
+    ContentIndex& l_Index = m_Engine->getContentIndex();
+    for (usize i = 0; i < l_NCAEntries.size(); ++i)
+    {
+        NCA& l_NCA = m_NCAs[i];
+        if (!l_NCA.getContentID().has_value())
+            continue;
 
-        FileReader* l_SubFile = new SubFileReader(*m_File, l_ContentOffset + l_Entries[i].offset, l_Entries[i].size);
-        m_NCAs.emplace_back(l_SubFile, m_Engine);
+        const Entry& l_Entry = m_Entries[l_NCAEntries[i]];
+        const ContentIndex::Location l_Location = ContentIndex::getLocation(*m_File, l_Entry.offset);
+        if (!l_Index.add(*l_NCA.getContentID(), l_Location, l_Entry.size))
+            std::cout << "\t" << l_Entry.name << " does not match the size of other copies, not indexed" << '\n';
+        else if (const std::optional<ContentIndex::Content> l_Content = l_Index.find(*l_NCA.getContentID()); l_Content->locations.size() > 1)
+            std::cout << "\t" << l_Entry.name << " is stored " << l_Content->locations.size() << " times" << '\n';
     }
+    return {};
 }
 
 swroo::filesys::PFS::PFS(PFS&& other) noexcept
-    : m_File(other.m_File), m_FileOwned(other.m_FileOwned), m_Header(other.m_Header), m_NCAs(std::move(other.m_NCAs)), m_Engine(other.m_Engine)
+    : m_File(other.m_File), m_FileOwned(other.m_FileOwned), m_Header(other.m_Header), m_Entries(std::move(other.m_Entries)), m_NCAs(std::move(other.m_NCAs)), m_Engine(other.m_Engine)
 {
     other.m_File = nullptr;
     other.m_FileOwned = false;
@@ -81,6 +272,38 @@ swroo::filesys::PFS::PFS(PFS&& other) noexcept
 
 swroo::filesys::PFS::~PFS()
 {
+    // NCAs hold sub readers over m_File, they must go first
+    m_NCAs.clear();
     if (m_FileOwned)
         delete m_File;
 }
+
+usize swroo::filesys::PFS::getMemoryUsage() const
+{
+    usize l_Usage = utils::getMemoryUsage(m_Entries) + utils::getMemoryUsage(m_NCAs);
+    for (const Entry& l_Entry : m_Entries)
+        l_Usage += utils::getMemoryUsage(l_Entry.name);
+    for (const NCA& l_NCA : m_NCAs)
+        l_Usage += l_NCA.getMemoryUsage();
+    return l_Usage;
+}
+
+const swroo::filesys::PFS::Entry* swroo::filesys::PFS::findEntry(const std::string_view p_Name) const
+{
+    for (const Entry& l_Entry : m_Entries)
+    {
+        if (l_Entry.name == p_Name)
+            return &l_Entry;
+    }
+    return nullptr;
+}
+
+swroo::FileReader* swroo::filesys::PFS::openEntry(const Entry& p_Entry) const
+{
+    return new SubFileReader(*m_File, p_Entry.offset, p_Entry.size);
+}
+
+swroo::utils::Expected<swroo::FileReader*> swroo::filesys::PFS::tryOpenEntry(const Entry& p_Entry) const
+{
+    return SubFileReader::tryOpen(*m_File, p_Entry.offset, p_Entry.size);
+}
@@ -2,9 +2,12 @@
 #include "../../util/common.hpp"
 
 #include <filesystem>
+#include <stop_token>
+#include <string_view>
 
 #include "nca.hpp"
 #include "../file.hpp"
+#include "../../util/generator.hpp"
 
 namespace swroo
 {
@@ -32,16 +35,57 @@ namespace swroo::filesys
         ByteArray<0x20> hash;
     };
 #pragma pack(pop)
+    static_assert(sizeof(FSEntry) == 0x14, "PFS entry must be 0x14 bytes");
+    static_assert(sizeof(PFSEntry) == 0x18, "PFS0 entry must be 0x18 bytes");
+    static_assert(sizeof(HFSEntry) == 0x40, "HFS0 entry must be 0x40 bytes");
 
     class PFS
     {
     public:
+        struct Entry
+        {
+            std::string name;
+            usize offset;
+            usize size;
+
+            // Only filled for HFS0 partitions
+            u32 hashSize = 0;
+            ByteArray<0x20> hash{};
+        };
+
         explicit PFS(FileReader* p_File, Engine* p_Engine, bool p_ShouldOwnFile = true);
+        // Same as the constructor with failures returned instead of thrown, an owned p_File is deleted on failure
+        [[nodiscard]] static utils::Expected<PFS> tryOpen(FileReader* p_File, Engine* p_Engine, bool p_ShouldOwnFile = true);
         PFS(const PFS&) = delete;
         PFS(PFS&& other) noexcept;
         ~PFS();
 
+        [[nodiscard]] const std::vector<Entry>& getEntries() const { return m_Entries; }
+        [[nodiscard]] const Entry* findEntry(std::string_view p_Name) const;
+        [[nodiscard]] std::vector<NCA>& getNCAs() { return m_NCAs; }
+        // Heap bytes held by the entry table and the parsed NCAs, the object itself not included
+        [[nodiscard]] usize getMemoryUsage() const;
+
+        // Returns a new reader over the entry data, the caller takes ownership
+        [[nodiscard]] FileReader* openEntry(const Entry& p_Entry) const;
+        [[nodiscard]] utils::Expected<FileReader*> tryOpenEntry(const Entry& p_Entry) const;
+
+        // Yields the entries of the PFS in p_File one at a time, reading the entry table in small batches and opening
+        // nothing. Stopping the iteration or requesting a stop ends the scan, an error is yielded once as the last item.
+        // Entry offsets are relative to p_File, so SubFileReader::tryOpen(p_File, ...) opens one without a PFS.
+        [[nodiscard]] static utils::Generator<utils::Expected<Entry>> enumerate(FileReader& p_File, std::stop_token p_StopToken = {});
+
     private:
+        friend class PFSWriter;
+        struct Header;
+
+        static utils::Error readHeader(FileReader& p_File, Header& p_Header);
+        static utils::Generator<utils::Expected<Entry>> parseEntries(FileReader& p_File, Header p_Header, std::stop_token p_StopToken);
+
+        struct Unloaded {};
+        PFS(Unloaded, FileReader* p_File, Engine* p_Engine, bool p_ShouldOwnFile);
+        [[nodiscard]] utils::Error load();
+
         FileReader* m_File;
         bool m_FileOwned = true;
 
@@ -56,11 +100,11 @@ namespace swroo::filesys
             [[nodiscard]] MagicType getMagicType() const;
             [[nodiscard]] const char* getMagicString() const;
         } m_Header{};
+        static_assert(sizeof(Header) == 0x10, "PFS header must be 0x10 bytes");
 
+        std::vector<Entry> m_Entries;
         std::vector<NCA> m_NCAs;
 
         Engine* m_Engine{ nullptr };
     };
 }
-
-
@@ -0,0 +1,158 @@
+#include "pfs_writer.hpp"
+
+#include "../../util/crypto/sha256.hpp"
+#include "../../util/task_scheduler.hpp"
+#include <iostream>
+#include <optional>
+
+// Smaller hash ranges are hashed inline, handing them to the scheduler costs more than it saves
+static constexpr usize c_AsyncHashSize = 0x10000;
+
+swroo::filesys::PFSWriter::PFSWriter(const Format p_Format, utils::TaskScheduler* p_Scheduler)
+    : m_Format(p_Format), m_Scheduler(p_Scheduler)
+{
+}
+
+void swroo::filesys::PFSWriter::addEntry(std::string p_Name, FileReader& p_Source, const u32 p_HashSize)
+{
+    m_Sources.push_back({ std::move(p_Name), &p_Source, p_HashSize });
+}
+
+std::vector<swroo::filesys::PFS::Entry> swroo::filesys::PFSWriter::write(const std::filesystem::path& p_Path, const IOMode p_Mode)
+{
+    FileWriter l_Output(p_Path, p_Mode);
+    std::vector<PFS::Entry> l_Entries = write(l_Output);
+    l_Output.finish();
+    return l_Entries;
+}
+
+std::vector<swroo::filesys::PFS::Entry> swroo::filesys::PFSWriter::write(FileWriter& p_Output)
+{
+    const bool l_IsHFS = m_Format == Format::HFS0;
+    const usize l_EntrySize = l_IsHFS ? sizeof(HFSEntry) : sizeof(PFSEntry);
+    const usize l_Base = p_Output.getSize();
+
+    std::string l_StrTab;
+    std::vector<PFS::Entry> l_Entries;
+    l_Entries.reserve(m_Sources.size());
+    usize l_DataSize = 0;
+    for (const Source& l_Source : m_Sources)
+    {
+        PFS::Entry& l_Entry = l_Entries.emplace_back();
+        l_Entry.name = l_Source.name;
+        l_Entry.offset = l_DataSize;
+        l_Entry.size = l_Source.file->getFileSize();
+        if (l_IsHFS)
+            l_Entry.hashSize = static_cast<u32>(std::min<usize>(l_Source.hashSize, l_Entry.size));
+        l_DataSize += l_Entry.size;
+    }
+
+    // Names are written in entry order, strtabOffset comes from where each one lands
+    std::vector<u32> l_NameOffsets;
+    l_NameOffsets.reserve(l_Entries.size());
+    for (const PFS::Entry& l_Entry : l_Entries)
+    {
+        l_NameOffsets.push_back(static_cast<u32>(l_StrTab.size()));
+        l_StrTab.append(l_Entry.name);
+        l_StrTab.push_back('\0');
+    }
+
+    const usize l_Alignment = getMetadataAlignment();
+    const usize l_TableSize = sizeof(PFS::Header) + l_Entries.size() * l_EntrySize;
+    l_StrTab.resize((l_TableSize + l_StrTab.size() + l_Alignment - 1) / l_Alignment * l_Alignment - l_TableSize, '\0');
+    const usize l_ContentOffset = l_TableSize + l_StrTab.size();
+
+    std::vector<u8> l_Metadata(l_ContentOffset);
+    PFS::Header l_Header{};
+    l_Header.magic = l_IsHFS ? utils::MagicFromChars('H', 'F', 'S', '0') : utils::MagicFromChars('P', 'F', 'S', '0');
+    l_Header.numEntries = static_cast<u32>(l_Entries.size());
+    l_Header.strTabSize = static_cast<u32>(l_StrTab.size());
+    std::memcpy(l_Metadata.data(), &l_Header, sizeof(l_Header));
+    std::memcpy(l_Metadata.data() + l_TableSize, l_StrTab.data(), l_StrTab.size());
+
+    // Hashes are still zero here, the entry table is written again once they are known
+    const auto l_WriteEntries = [&]
+    {
+        for (usize i = 0; i < l_Entries.size(); ++i)
+        {
+            const PFS::Entry& l_Entry = l_Entries[i];
+            u8* l_Raw = l_Metadata.data() + sizeof(PFS::Header) + i * l_EntrySize;
+            if (l_IsHFS)
+            {
+                HFSEntry l_HFSEntry{};
+                l_HFSEntry.fsEntry = { l_Entry.offset, l_Entry.size, l_NameOffsets[i] };
+                l_HFSEntry.hashSize = l_Entry.hashSize;
+                l_HFSEntry.hash = l_Entry.hash;
+                std::memcpy(l_Raw, &l_HFSEntry, sizeof(l_HFSEntry));
+            }
+            else
+            {
+                PFSEntry l_PFSEntry{};
+                l_PFSEntry.fsEntry = { l_Entry.offset, l_Entry.size, l_NameOffsets[i] };
+                std::memcpy(l_Raw, &l_PFSEntry, sizeof(l_PFSEntry));
+            }
+        }
+    };
+    l_WriteEntries();
+    p_Output.write(l_Metadata.data(), l_Metadata.size());
+
+    std::cout << "\nWriting " << (l_IsHFS ? "HFS0" : "PFS0") << " to: " << p_Output.getFilePath() << '\n';
+
+    // Two chunks in flight, the previous one is hashed while the next is read and this one is written. At most one
+    // hashing task runs at a time, so a buffer is never refilled while it is still being hashed.
+    utils::BufferPool::Buffer l_Buffers[] = { getDirectIOPool().acquire(), getDirectIOPool().acquire() };
+    crypto::SHA256 l_SHA;
+    // Declared after everything its task uses, leaving by an exception waits for the task before those go away
+    std::optional<utils::TaskScheduler::TaskGroup> l_Hashing;
+    if (m_Scheduler != nullptr)
+        l_Hashing.emplace(*m_Scheduler);
+
+    for (usize i = 0; i < l_Entries.size(); ++i)
+    {
+        PFS::Entry& l_Entry = l_Entries[i];
+        FileReader& l_Source = *m_Sources[i].file;
+
+        usize l_Current = 0;
+        for (usize l_Done = 0; l_Done < l_Entry.size;)
+        {
+            u8* l_Chunk = l_Buffers[l_Current].getData();
+            const usize l_ChunkSize = std::min(l_Buffers[l_Current].getSize(), l_Entry.size - l_Done);
+            l_Source.readData(l_Chunk, l_ChunkSize, l_Done);
+
+            if (l_Done < l_Entry.hashSize)
+            {
+                const usize l_HashSize = std::min<usize>(l_ChunkSize, l_Entry.hashSize - l_Done);
+                // The previous chunk of this entry may still be hashing, updates must stay in order
+                if (l_Hashing.has_value())
+                    l_Hashing->wait();
+
+                if (l_Hashing.has_value() && l_HashSize >= c_AsyncHashSize)
+                    l_Hashing->run([&l_SHA, l_Chunk, l_HashSize] { l_SHA.update(l_Chunk, l_HashSize); });
+                else
+                    l_SHA.update(l_Chunk, l_HashSize);
+            }
+
+            p_Output.write(l_Chunk, l_ChunkSize);
+            l_Done += l_ChunkSize;
+            l_Current ^= 1;
+        }
+        if (l_Hashing.has_value())
+            l_Hashing->wait();
+
+        // Only HFS0 entries hash anything, finalize leaves the state fresh for the next one
+        if (l_IsHFS)
+            l_Entry.hash = l_SHA.finalize();
+        std::cout << "\tEntry " << i << ": " << l_Entry.name << ", Offset: " << l_Base + l_ContentOffset + l_Entry.offset << ", Size: " << l_Entry.size << '\n';
+    }
+
+    if (l_IsHFS)
+    {
+        l_WriteEntries();
+        p_Output.rewrite(l_Base + sizeof(PFS::Header), l_Metadata.data() + sizeof(PFS::Header), l_Entries.size() * l_EntrySize);
+    }
+
+    // The table stores offsets relative to the data, PFS hands out ones relative to the file
+    for (PFS::Entry& l_Entry : l_Entries)
+        l_Entry.offset += l_Base + l_ContentOffset;
+    return l_Entries;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "../../util/common.hpp"
+
+#include <string>
+
+#include "pfs.hpp"
+#include "../file.hpp"
+
+namespace swroo::utils
+{
+    class TaskScheduler;
+}
+
+namespace swroo::filesys
+{
+    // Builds a PFS0 or HFS0 from any number of readers in a single pass. The metadata is laid out before any data is
+    // copied, entries are streamed chunk by chunk and HFS0 hashes are patched into the header at the end. Large hash
+    // ranges are hashed on the scheduler while each chunk is written, small ones and all of them without one inline.
+    class PFSWriter
+    {
+    public:
+        enum class Format : u8
+        {
+            PFS0,
+            HFS0,
+        };
+
+        // What XCI partitions hash of each NCA, the header
+        static constexpr u32 c_DefaultHashSize = 0x200;
+
+        explicit PFSWriter(Format p_Format, utils::TaskScheduler* p_Scheduler = nullptr);
+
+        // p_Source is only read from in write() and must stay open until then. HFS0 entries hash the first p_HashSize
+        // bytes, or the whole entry if it is smaller.
+        void addEntry(std::string p_Name, FileReader& p_Source, u32 p_HashSize = c_DefaultHashSize);
+
+        // Appends the PFS to p_Output. Returns the entries as PFS would read them back, offsets are relative to
+        // p_Output so they stay valid when the PFS is embedded in a larger file.
+        std::vector<PFS::Entry> write(FileWriter& p_Output);
+        std::vector<PFS::Entry> write(const std::filesystem::path& p_Path, IOMode p_Mode = IOMode::BUFFERED);
+
+        [[nodiscard]] usize getEntryCount() const { return m_Sources.size(); }
+
+    private:
+        struct Source
+        {
+            std::string name;
+            FileReader* file;
+            u32 hashSize;
+        };
+
+        // Data starts this aligned, the string table is padded up to it
+        [[nodiscard]] usize getMetadataAlignment() const { return m_Format == Format::HFS0 ? 0x200 : 0x20; }
+
+        Format m_Format;
+        utils::TaskScheduler* m_Scheduler;
+        std::vector<Source> m_Sources;
+    };
+}
@@ -0,0 +1,338 @@
+#include "romfs.hpp"
+
+#include <algorithm>
+
+static constexpr u32 c_IndexMagic = swroo::utils::MagicFromChars('R', 'F', 'S', 'I');
+static constexpr u32 c_IndexVersion = 1;
+static constexpr u32 c_EmptyEntry = 0xFFFFFFFF;
+
+swroo::filesys::RomFS::Index::Index(Index&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+swroo::filesys::RomFS::Index& swroo::filesys::RomFS::Index::operator=(Index&& other) noexcept
+{
+    // Moving the vector keeps its buffer, so the bound pointers stay valid
+    m_Storage = std::move(other.m_Storage);
+    m_Data = other.m_Data;
+    m_Header = other.m_Header;
+    m_Files = other.m_Files;
+    m_Directories = other.m_Directories;
+    m_Buckets = other.m_Buckets;
+    m_Strings = other.m_Strings;
+
+    other.m_Data = {};
+    other.m_Header = nullptr;
+    return *this;
+}
+
+swroo::filesys::RomFS::Index swroo::filesys::RomFS::Index::fromData(const std::span<const u8> p_Data)
+{
+    Index l_Index;
+    l_Index.m_Data = p_Data;
+    l_Index.bind();
+    return l_Index;
+}
+
+swroo::filesys::RomFS::Index swroo::filesys::RomFS::Index::fromData(std::vector<u8>&& p_Data)
+{
+    Index l_Index;
+    l_Index.m_Storage = std::move(p_Data);
+    l_Index.m_Data = l_Index.m_Storage;
+    l_Index.bind();
+    return l_Index;
+}
+
+u32 swroo::filesys::RomFS::Index::hashPath(const std::string_view p_Path)
+{
+    // FNV-1a, with the leading slash implied when missing
+    u32 l_Hash = 0x811C9DC5;
+    if (p_Path.empty() || p_Path[0] != '/')
+        l_Hash = (l_Hash ^ '/') * 0x01000193;
+    for (const char l_Char : p_Path)
+        l_Hash = (l_Hash ^ static_cast<u8>(l_Char)) * 0x01000193;
+    return l_Hash;
+}
+
+void swroo::filesys::RomFS::Index::bind()
+{
+    if (m_Data.size() < sizeof(Header) || reinterpret_cast<uintptr_t>(m_Data.data()) % alignof(u64) != 0)
+        throw std::runtime_error("Invalid RomFS index buffer");
+
+    m_Header = reinterpret_cast<const Header*>(m_Data.data());
+    if (m_Header->magic != c_IndexMagic || m_Header->version != c_IndexVersion)
+        throw std::runtime_error("Invalid RomFS index magic or version");
+
+    // Only files are hashed, a lookup miss ends on an empty bucket and there has to be one
+    if (m_Header->bucketCount == 0 || (m_Header->bucketCount & (m_Header->bucketCount - 1)) != 0 || m_Header->bucketCount <= m_Header->fileCount)
+        throw std::runtime_error("Invalid RomFS index bucket count");
+
+    const usize l_FilesOffset = sizeof(Header);
+    const usize l_DirectoriesOffset = l_FilesOffset + static_cast<usize>(m_Header->fileCount) * sizeof(File);
+    const usize l_BucketsOffset = l_DirectoriesOffset + static_cast<usize>(m_Header->directoryCount) * sizeof(Directory);
+    const usize l_StringsOffset = l_BucketsOffset + static_cast<usize>(m_Header->bucketCount) * sizeof(u32);
+    if (l_StringsOffset + m_Header->stringPoolSize != m_Data.size())
+        throw std::runtime_error("RomFS index size mismatch");
+
+    m_Files = reinterpret_cast<const File*>(m_Data.data() + l_FilesOffset);
+    m_Directories = reinterpret_cast<const Directory*>(m_Data.data() + l_DirectoriesOffset);
+    m_Buckets = reinterpret_cast<const u32*>(m_Data.data() + l_BucketsOffset);
+    m_Strings = reinterpret_cast<const char*>(m_Data.data() + l_StringsOffset);
+
+    for (const File& l_File : getFiles())
+    {
+        if (static_cast<usize>(l_File.pathOffset) + l_File.pathSize > m_Header->stringPoolSize)
+            throw std::runtime_error("RomFS index path out of bounds");
+    }
+    for (const Directory& l_Directory : getDirectories())
+    {
+        if (static_cast<usize>(l_Directory.pathOffset) + l_Directory.pathSize > m_Header->stringPoolSize)
+            throw std::runtime_error("RomFS index path out of bounds");
+    }
+    for (u32 i = 0; i < m_Header->bucketCount; ++i)
+    {
+        if (m_Buckets[i] > m_Header->fileCount)
+            throw std::runtime_error("RomFS index bucket out of bounds");
+    }
+}
+
+const swroo::filesys::RomFS::Index::File* swroo::filesys::RomFS::Index::findFile(const std::string_view p_Path) const
+{
+    if (!m_Header)
+        return nullptr;
+
+    const bool l_ImpliedSlash = p_Path.empty() || p_Path[0] != '/';
+    const u32 l_Hash = hashPath(p_Path);
+    const u32 l_Mask = m_Header->bucketCount - 1;
+
+    // Bounded all the same, bind cannot tell whether the empty buckets are where they should be
+    u32 l_Bucket = l_Hash & l_Mask;
+    for (u32 i = 0; i < m_Header->bucketCount; ++i, l_Bucket = (l_Bucket + 1) & l_Mask)
+    {
+        const u32 l_Slot = m_Buckets[l_Bucket];
+        if (l_Slot == 0)
+            return nullptr;
+
+        const File& l_File = m_Files[l_Slot - 1];
+        if (l_File.pathHash != l_Hash)
+            continue;
+
+        const std::string_view l_Path = getPath(l_File);
+        if (l_ImpliedSlash ? l_Path.substr(1) == p_Path : l_Path == p_Path)
+            return &l_File;
+    }
+    return nullptr;
+}
+
+std::span<const swroo::filesys::RomFS::Index::File> swroo::filesys::RomFS::Index::getFiles() const
+{
+    if (!m_Header)
+        return {};
+    return { m_Files, m_Header->fileCount };
+}
+
+std::span<const swroo::filesys::RomFS::Index::Directory> swroo::filesys::RomFS::Index::getDirectories() const
+{
+    if (!m_Header)
+        return {};
+    return { m_Directories, m_Header->directoryCount };
+}
+
+std::string_view swroo::filesys::RomFS::Index::getPath(const File& p_File) const
+{
+    return { m_Strings + p_File.pathOffset, p_File.pathSize };
+}
+
+std::string_view swroo::filesys::RomFS::Index::getPath(const Directory& p_Directory) const
+{
+    return { m_Strings + p_Directory.pathOffset, p_Directory.pathSize };
+}
+
+u64 swroo::filesys::RomFS::Index::getDataOffset() const
+{
+    return m_Header ? m_Header->dataOffset : 0;
+}
+
+swroo::filesys::RomFS::Index swroo::filesys::RomFS::Index::Builder::build()
+{
+    std::ranges::sort(files, [](const FileSource& p_A, const FileSource& p_B) { return p_A.offset < p_B.offset; });
+
+    usize l_StringPoolSize = 0;
+    for (const FileSource& l_File : files)
+        l_StringPoolSize += l_File.path.size();
+    for (const std::string& l_Directory : directories)
+        l_StringPoolSize += l_Directory.size();
+
+    if (l_StringPoolSize > UINT32_MAX || files.size() > UINT32_MAX / 2)
+        throw std::runtime_error("RomFS is too large to index");
+
+    u32 l_BucketCount = 1;
+    while (l_BucketCount < files.size() * 2)
+        l_BucketCount <<= 1;
+
+    const usize l_Size = sizeof(Header) + files.size() * sizeof(File) + directories.size() * sizeof(Directory) + l_BucketCount * sizeof(u32) + l_StringPoolSize;
+    std::vector<u8> l_Data(l_Size, 0);
+
+    Header* l_Header = reinterpret_cast<Header*>(l_Data.data());
+    *l_Header = {
+        .magic = c_IndexMagic,
+        .version = c_IndexVersion,
+        .dataOffset = dataOffset,
+        .fileCount = static_cast<u32>(files.size()),
+        .directoryCount = static_cast<u32>(directories.size()),
+        .bucketCount = l_BucketCount,
+        .stringPoolSize = static_cast<u32>(l_StringPoolSize)
+    };
+
+    File* l_Files = reinterpret_cast<File*>(l_Data.data() + sizeof(Header));
+    Directory* l_Directories = reinterpret_cast<Directory*>(l_Files + files.size());
+    u32* l_Buckets = reinterpret_cast<u32*>(l_Directories + directories.size());
+    char* l_Strings = reinterpret_cast<char*>(l_Buckets + l_BucketCount);
+
+    u32 l_StringOffset = 0;
+    auto l_Intern = [&](const std::string& p_String) -> u32
+    {
+        const u32 l_Offset = l_StringOffset;
+        std::memcpy(l_Strings + l_Offset, p_String.data(), p_String.size());
+        l_StringOffset += static_cast<u32>(p_String.size());
+        return l_Offset;
+    };
+
+    for (usize i = 0; i < files.size(); ++i)
+    {
+        File& l_File = l_Files[i];
+        l_File.offset = files[i].offset;
+        l_File.size = files[i].size;
+        l_File.pathOffset = l_Intern(files[i].path);
+        l_File.pathSize = static_cast<u32>(files[i].path.size());
+        l_File.pathHash = hashPath(files[i].path);
+
+        u32 l_Bucket = l_File.pathHash & (l_BucketCount - 1);
+        while (l_Buckets[l_Bucket] != 0)
+            l_Bucket = (l_Bucket + 1) & (l_BucketCount - 1);
+        l_Buckets[l_Bucket] = static_cast<u32>(i + 1);
+    }
+
+    for (usize i = 0; i < directories.size(); ++i)
+    {
+        l_Directories[i].pathOffset = l_Intern(directories[i]);
+        l_Directories[i].pathSize = static_cast<u32>(directories[i].size());
+    }
+
+    return fromData(std::move(l_Data));
+}
+
+swroo::filesys::RomFS::RomFS(FileReader* p_File, const bool p_ShouldOwnFile)
+    : m_File(p_File), m_FileOwned(p_ShouldOwnFile)
+{
+    buildIndex();
+}
+
+swroo::filesys::RomFS::RomFS(FileReader* p_File, Index&& p_Index, const bool p_ShouldOwnFile)
+    : m_File(p_File), m_FileOwned(p_ShouldOwnFile), m_Index(std::move(p_Index))
+{
+}
+
+swroo::filesys::RomFS::RomFS(RomFS&& other) noexcept
+    : m_File(other.m_File), m_FileOwned(other.m_FileOwned), m_Index(std::move(other.m_Index))
+{
+    other.m_File = nullptr;
+    other.m_FileOwned = false;
+}
+
+swroo::filesys::RomFS::~RomFS()
+{
+    if (m_FileOwned)
+        delete m_File;
+}
+
+swroo::FileReader* swroo::filesys::RomFS::openFile(const Index::File& p_File) const
+{
+    return new SubFileReader(*m_File, m_Index.getDataOffset() + p_File.offset, p_File.size);
+}
+
+void swroo::filesys::RomFS::buildIndex()
+{
+    Header l_Header;
+    m_File->read(l_Header, 0);
+
+    if (l_Header.headerSize != sizeof(Header))
+        throw std::runtime_error("Invalid RomFS header size: " + m_File->getFilePath().string());
+
+    const usize l_FileSize = m_File->getFileSize();
+    // Sizes are compared against what is left behind each offset, offset plus size can wrap on crafted headers
+    if (l_Header.dirMetaTableOffset > l_FileSize || l_Header.dirMetaTableSize > l_FileSize - l_Header.dirMetaTableOffset ||
+        l_Header.fileMetaTableOffset > l_FileSize || l_Header.fileMetaTableSize > l_FileSize - l_Header.fileMetaTableOffset)
+        throw std::runtime_error("RomFS metadata tables are out of bounds: " + m_File->getFilePath().string());
+
+    // Both tables are read once, the tree is then walked in memory
+    std::vector<u8> l_DirTable(l_Header.dirMetaTableSize);
+    std::vector<u8> l_FileTable(l_Header.fileMetaTableSize);
+    m_File->readData(l_DirTable.data(), l_DirTable.size(), l_Header.dirMetaTableOffset);
+    m_File->readData(l_FileTable.data(), l_FileTable.size(), l_Header.fileMetaTableOffset);
+
+    auto l_GetDirectory = [&](const u32 p_Offset, std::string_view& p_Name) -> DirectoryEntry
+    {
+        DirectoryEntry l_Entry;
+        if (static_cast<usize>(p_Offset) + sizeof(DirectoryEntry) > l_DirTable.size())
+            throw std::runtime_error("RomFS directory entry out of bounds");
+        std::memcpy(&l_Entry, l_DirTable.data() + p_Offset, sizeof(DirectoryEntry));
+        if (static_cast<usize>(p_Offset) + sizeof(DirectoryEntry) + l_Entry.nameSize > l_DirTable.size())
+            throw std::runtime_error("RomFS directory name out of bounds");
+        p_Name = { reinterpret_cast<const char*>(l_DirTable.data() + p_Offset + sizeof(DirectoryEntry)), l_Entry.nameSize };
+        return l_Entry;
+    };
+
+    auto l_GetFile = [&](const u32 p_Offset, std::string_view& p_Name) -> FileEntry
+    {
+        FileEntry l_Entry;
+        if (static_cast<usize>(p_Offset) + sizeof(FileEntry) > l_FileTable.size())
+            throw std::runtime_error("RomFS file entry out of bounds");
+        std::memcpy(&l_Entry, l_FileTable.data() + p_Offset, sizeof(FileEntry));
+        if (static_cast<usize>(p_Offset) + sizeof(FileEntry) + l_Entry.nameSize > l_FileTable.size())
+            throw std::runtime_error("RomFS file name out of bounds");
+        p_Name = { reinterpret_cast<const char*>(l_FileTable.data() + p_Offset + sizeof(FileEntry)), l_Entry.nameSize };
+        return l_Entry;
+    };
+
+    Index::Builder l_Builder;
+    l_Builder.dataOffset = l_Header.dataOffset;
+
+    // Every entry takes at least its fixed part, which bounds the walk on malformed tables
+    const usize l_MaxEntries = l_DirTable.size() / sizeof(DirectoryEntry) + l_FileTable.size() / sizeof(FileEntry);
+
+    std::vector<std::pair<u32, std::string>> l_Pending;
+    l_Pending.emplace_back(0, "");
+    while (!l_Pending.empty())
+    {
+        auto [l_DirOffset, l_DirPath] = std::move(l_Pending.back());
+        l_Pending.pop_back();
+
+        std::string_view l_Name;
+        const DirectoryEntry l_Dir = l_GetDirectory(l_DirOffset, l_Name);
+        l_Builder.directories.push_back(l_DirPath.empty() ? "/" : l_DirPath);
+
+        for (u32 l_FileOffset = l_Dir.childFile; l_FileOffset != c_EmptyEntry;)
+        {
+            const FileEntry l_File = l_GetFile(l_FileOffset, l_Name);
+            l_Builder.files.push_back({ l_DirPath + "/" + std::string(l_Name), l_File.offset, l_File.size });
+            l_FileOffset = l_File.sibling;
+
+            if (l_Builder.files.size() + l_Builder.directories.size() > l_MaxEntries)
+                throw std::runtime_error("RomFS metadata contains a cycle");
+        }
+
+        for (u32 l_ChildOffset = l_Dir.childDirectory; l_ChildOffset != c_EmptyEntry;)
+        {
+            const DirectoryEntry l_Child = l_GetDirectory(l_ChildOffset, l_Name);
+            l_Pending.emplace_back(l_ChildOffset, l_DirPath + "/" + std::string(l_Name));
+            l_ChildOffset = l_Child.sibling;
+
+            if (l_Pending.size() + l_Builder.directories.size() > l_MaxEntries)
+                throw std::runtime_error("RomFS metadata contains a cycle");
+        }
+    }
+
+    m_Index = l_Builder.build();
+}
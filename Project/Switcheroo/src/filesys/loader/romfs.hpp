@@ -0,0 +1,161 @@
+#pragma once
+#include "../../util/common.hpp"
+
+#include <span>
+#include <string_view>
+
+#include "../file.hpp"
+
+namespace swroo::filesys
+{
+    class RomFS
+    {
+    public:
+        // Flat lookup tables built once per section. Everything is stored as offsets inside a single
+        // buffer, so the in-memory layout is also the persisted one and can be used from a mapped file.
+        class Index
+        {
+        public:
+#pragma pack(push, 1)
+            struct File
+            {
+                u64 offset; // Relative to the RomFS data region
+                u64 size;
+                u32 pathOffset;
+                u32 pathSize;
+                u32 pathHash;
+                ZERO_PADDING(0x4);
+            };
+
+            struct Directory
+            {
+                u32 pathOffset;
+                u32 pathSize;
+            };
+#pragma pack(pop)
+
+            Index() = default;
+            Index(const Index&) = delete;
+            Index& operator=(const Index&) = delete;
+            Index(Index&& other) noexcept;
+            Index& operator=(Index&& other) noexcept;
+
+            // The returned index views p_Data, which must outlive it
+            [[nodiscard]] static Index fromData(std::span<const u8> p_Data);
+            [[nodiscard]] static Index fromData(std::vector<u8>&& p_Data);
+
+            // Paths are absolute ("/dir/file"), the leading slash is optional. Does not allocate.
+            [[nodiscard]] const File* findFile(std::string_view p_Path) const;
+
+            [[nodiscard]] std::span<const File> getFiles() const;
+            [[nodiscard]] std::span<const Directory> getDirectories() const;
+            [[nodiscard]] std::string_view getPath(const File& p_File) const;
+            [[nodiscard]] std::string_view getPath(const Directory& p_Directory) const;
+
+            [[nodiscard]] u64 getDataOffset() const;
+            [[nodiscard]] std::span<const u8> getData() const { return m_Data; }
+
+        private:
+            friend class RomFS;
+
+            struct Header
+            {
+                u32 magic;
+                u32 version;
+                u64 dataOffset;
+                u32 fileCount;
+                u32 directoryCount;
+                u32 bucketCount;
+                u32 stringPoolSize;
+            };
+
+            struct Builder
+            {
+                struct FileSource
+                {
+                    std::string path;
+                    u64 offset;
+                    u64 size;
+                };
+
+                u64 dataOffset = 0;
+                std::vector<FileSource> files;
+                std::vector<std::string> directories;
+
+                [[nodiscard]] Index build();
+            };
+
+            [[nodiscard]] static u32 hashPath(std::string_view p_Path);
+            void bind();
+
+            std::vector<u8> m_Storage;
+            std::span<const u8> m_Data;
+
+            const Header* m_Header{ nullptr };
+            const File* m_Files{ nullptr };
+            const Directory* m_Directories{ nullptr };
+            const u32* m_Buckets{ nullptr };
+            const char* m_Strings{ nullptr };
+        };
+
+        // p_File must cover the RomFS level of the section (IVFC level 5), already decrypted
+        explicit RomFS(FileReader* p_File, bool p_ShouldOwnFile = true);
+        explicit RomFS(FileReader* p_File, Index&& p_Index, bool p_ShouldOwnFile = true);
+        RomFS(const RomFS&) = delete;
+        RomFS(RomFS&& other) noexcept;
+        ~RomFS();
+
+        [[nodiscard]] const Index& getIndex() const { return m_Index; }
+        [[nodiscard]] const Index::File* findFile(const std::string_view p_Path) const { return m_Index.findFile(p_Path); }
+
+        // Returns a new reader over the file data, the caller takes ownership
+        [[nodiscard]] FileReader* openFile(const Index::File& p_File) const;
+
+    private:
+#pragma pack(push, 1)
+        struct Header
+        {
+            u64 headerSize;
+            u64 dirHashTableOffset;
+            u64 dirHashTableSize;
+            u64 dirMetaTableOffset;
+            u64 dirMetaTableSize;
+            u64 fileHashTableOffset;
+            u64 fileHashTableSize;
+            u64 fileMetaTableOffset;
+            u64 fileMetaTableSize;
+            u64 dataOffset;
+        };
+
+        struct DirectoryEntry
+        {
+            u32 parent;
+            u32 sibling;
+            u32 childDirectory;
+            u32 childFile;
+            u32 nextHash;
+            u32 nameSize;
+        };
+
+        struct FileEntry
+        {
+            u32 parent;
+            u32 sibling;
+            u64 offset;
+            u64 size;
+            u32 nextHash;
+            u32 nameSize;
+        };
+#pragma pack(pop)
+        static_assert(sizeof(Header) == 0x50);
+        static_assert(sizeof(DirectoryEntry) == 0x18);
+        static_assert(sizeof(FileEntry) == 0x20);
+
+        void buildIndex();
+
+        FileReader* m_File;
+        bool m_FileOwned = true;
+
+        Index m_Index;
+    };
+}
@@ -0,0 +1,98 @@
+#include "xci.hpp"
+
+#include <iostream>
+
+bool swroo::filesys::XCI::Header::isValid() const
+{
+    return magic == utils::MagicFromChars('H', 'E', 'A', 'D');
+}
+
+swroo::filesys::XCI::XCI(FileReader* p_File, Engine* p_Engine, const bool p_ShouldOwnFile)
+    : m_File(p_File), m_FileOwned(p_ShouldOwnFile), m_Engine(p_Engine)
+{
+    std::cout << "\nLoading XCI from: " << p_File->getFilePath() << '\n';
+
+    m_File->read(m_Header, 0);
+    if (!m_Header.isValid())
+        throw std::runtime_error("Invalid XCI header magic: " + p_File->getFilePath().string());
+
+    std::cout << "\tPackage ID: " << std::hex << m_Header.packageID << std::dec << '\n';
+    std::cout << "\tRoot HFS0 offset: " << m_Header.partitionFsHeaderAddress << ", Size: " << m_Header.partitionFsHeaderSize << '\n';
+
+    const usize l_FileSize = m_File->getFileSize();
+    if (m_Header.partitionFsHeaderAddress >= l_FileSize)
+        throw std::runtime_error("XCI root partition is out of bounds: " + p_File->getFilePath().string());
+
+    // The root HFS0 only holds the four partition entries, nothing below it is touched until requested
+    FileReader* l_RootFile = new SubFileReader(*m_File, m_Header.partitionFsHeaderAddress, l_FileSize - m_Header.partitionFsHeaderAddress);
+    m_Root.emplace(l_RootFile, m_Engine);
+}
+
+swroo::filesys::XCI::XCI(XCI&& other) noexcept
+    : m_File(other.m_File), m_FileOwned(other.m_FileOwned), m_Header(other.m_Header), m_Root(std::move(other.m_Root)), m_Partitions(std::move(other.m_Partitions)), m_Engine(other.m_Engine)
+{
+    other.m_File = nullptr;
+    other.m_FileOwned = false;
+}
+
+swroo::filesys::XCI::~XCI()
+{
+    // Partitions and root hold sub readers over m_File, they must go first
+    for (std::optional<PFS>& l_Partition : m_Partitions)
+        l_Partition.reset();
+    m_Root.reset();
+
+    if (m_FileOwned)
+        delete m_File;
+}
+
+usize swroo::filesys::XCI::getMemoryUsage() const
+{
+    usize l_Usage = m_Root.has_value() ? m_Root->getMemoryUsage() : 0;
+    std::lock_guard l_Lock(m_PartitionMutex);
+    for (const std::optional<PFS>& l_Partition : m_Partitions)
+    {
+        if (l_Partition.has_value())
+            l_Usage += l_Partition->getMemoryUsage();
+    }
+    return l_Usage;
+}
+
+bool swroo::filesys::XCI::hasPartition(const Partition p_Partition) const
+{
+    return m_Root->findEntry(getPartitionName(p_Partition)) != nullptr;
+}
+
+bool swroo::filesys::XCI::isPartitionLoaded(const Partition p_Partition) const
+{
+    std::lock_guard l_Lock(m_PartitionMutex);
+    return m_Partitions[static_cast<u8>(p_Partition)].has_value();
+}
+
+swroo::filesys::PFS& swroo::filesys::XCI::getPartition(const Partition p_Partition)
+{
+    // A loaded partition never moves, the reference stays valid after the lock is released
+    std::lock_guard l_Lock(m_PartitionMutex);
+    std::optional<PFS>& l_Partition = m_Partitions[static_cast<u8>(p_Partition)];
+    if (l_Partition.has_value())
+        return *l_Partition;
+
+    const PFS::Entry* l_Entry = m_Root->findEntry(getPartitionName(p_Partition));
+    if (!l_Entry)
+        throw std::runtime_error("XCI does not contain partition: " + std::string(getPartitionName(p_Partition)));
+
+    l_Partition.emplace(m_Root->openEntry(*l_Entry), m_Engine);
+    return *l_Partition;
+}
+
+const char* swroo::filesys::XCI::getPartitionName(const Partition p_Partition)
+{
+    switch (p_Partition)
+    {
+    case Partition::UPDATE: return "update";
+    case Partition::NORMAL: return "normal";
+    case Partition::SECURE: return "secure";
+    case Partition::LOGO:   return "logo";
+    default:                return "";
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "../../util/common.hpp"
+
+#include <mutex>
+#include <optional>
+
+#include "pfs.hpp"
+#include "../file.hpp"
+
+namespace swroo
+{
+    class Engine;
+}
+
+namespace swroo::filesys
+{
+    class XCI
+    {
+    public:
+        enum class Partition : u8
+        {
+            UPDATE,
+            NORMAL,
+            SECURE,
+            LOGO,
+            COUNT
+        };
+
+        explicit XCI(FileReader* p_File, Engine* p_Engine, bool p_ShouldOwnFile = true);
+        XCI(const XCI&) = delete;
+        XCI(XCI&& other) noexcept;
+        ~XCI();
+
+        [[nodiscard]] u64 getPackageID() const { return m_Header.packageID; }
+        [[nodiscard]] const PFS& getRootPartition() const { return *m_Root; }
+
+        [[nodiscard]] bool hasPartition(Partition p_Partition) const;
+
+        // Partitions are only parsed the first time they are requested
+        [[nodiscard]] PFS& getPartition(Partition p_Partition);
+        [[nodiscard]] bool isPartitionLoaded(Partition p_Partition) const;
+
+        // Heap bytes held by the root and every loaded partition, the object itself not included
+        [[nodiscard]] usize getMemoryUsage() const;
+
+        [[nodiscard]] static const char* getPartitionName(Partition p_Partition);
+
+    private:
+        FileReader* m_File;
+        bool m_FileOwned = true;
+
+#pragma pack(push, 1)
+        struct Header {
+            ByteArray<0x100> headerSig;
+            u32 magic;
+            u32 romAreaStartPage;
+            u32 backupAreaStartPage;
+            u8 keyIndex;
+            u8 romSize;
+            u8 headerVersion;
+            u8 flags;
+            u64 packageID;
+            u32 validDataEndPage;
+            PADDING(0x4);
+            ByteArray<0x10> iv;
+            u64 partitionFsHeaderAddress;
+            u64 partitionFsHeaderSize;
+            ByteArray<0x20> partitionFsHeaderHash;
+            ByteArray<0x20> initialDataHash;
+            u32 selSec;
+            u32 selT1Key;
+            u32 selKey;
+            u32 limArea;
+            ByteArray<0x70> encryptedCardInfo;
+
+            [[nodiscard]] bool isValid() const;
+        } m_Header{};
+#pragma pack(pop)
+        static_assert(sizeof(Header) == 0x200);
+
+        std::optional<PFS> m_Root;
+        std::array<std::optional<PFS>, static_cast<u8>(Partition::COUNT)> m_Partitions;
+        // XCIs are shared through the registry, partitions may be requested from several threads at once
+        mutable std::mutex m_PartitionMutex;
+
+        Engine* m_Engine{ nullptr };
+    };
+}
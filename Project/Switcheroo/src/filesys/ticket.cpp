@@ -0,0 +1,35 @@
+#include "ticket.hpp"
+
+#include <string>
+
+swroo::filesys::Ticket::Ticket(FileReader& p_File)
+{
+    p_File.read(m_SignatureType, 0);
+
+    // The signature is padded so the ticket data starts on a 0x40 boundary
+    const usize l_DataOffset = sizeof(u32) + getSignatureSize(m_SignatureType);
+    if (l_DataOffset + sizeof(Data) > p_File.getFileSize())
+        throw std::runtime_error("Ticket is too small: " + p_File.getFilePath().string());
+
+    p_File.read(m_Data, l_DataOffset);
+    if (m_Data.titleKeyType != TitleKeyType::COMMON && m_Data.titleKeyType != TitleKeyType::PERSONALIZED)
+        throw std::runtime_error("Unknown ticket title key type: " + std::to_string(static_cast<u8>(m_Data.titleKeyType)));
+}
+
+usize swroo::filesys::Ticket::getSignatureSize(const u32 p_SignatureType)
+{
+    switch (p_SignatureType)
+    {
+    case 0x10000: // RSA-4096 SHA-1
+    case 0x10003: // RSA-4096 SHA-256
+        return 0x200 + 0x3C;
+    case 0x10001: // RSA-2048 SHA-1
+    case 0x10004: // RSA-2048 SHA-256
+        return 0x100 + 0x3C;
+    case 0x10002: // ECDSA SHA-1
+    case 0x10005: // ECDSA SHA-256
+        return 0x3C + 0x40;
+    default:
+        throw std::runtime_error("Unknown ticket signature type: " + std::to_string(p_SignatureType));
+    }
+}
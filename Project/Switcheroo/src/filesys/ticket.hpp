@@ -0,0 +1,53 @@
+#pragma once
+#include "../util/common.hpp"
+
+#include "file.hpp"
+
+namespace swroo::filesys
+{
+    // ES ticket, as shipped in NSPs next to the NCAs it unlocks
+    class Ticket
+    {
+    public:
+        enum class TitleKeyType : u8 {
+            COMMON = 0,
+            PERSONALIZED = 1,
+        };
+
+#pragma pack(push, 1)
+        struct Data
+        {
+            std::array<char, 0x40> issuer;
+            ByteArray<0x100> titleKeyBlock; // Common: the title key in the first 0x10 bytes, personalized: RSA-OAEP wrapped
+            u8 formatVersion;
+            TitleKeyType titleKeyType;
+            u16 ticketVersion;
+            u8 licenseType;
+            u8 masterKeyRevision;
+            u16 propertyMask;
+            ZERO_PADDING(0x8);
+            u64 ticketID;
+            u64 deviceID;
+            ByteArray<0x10> rightsID;
+            u32 accountID;
+            u32 sectionsSize;
+            u32 sectionsOffset;
+            u16 sectionCount;
+            u16 sectionEntrySize;
+        };
+#pragma pack(pop)
+        static_assert(sizeof(Data) == 0x180, "Ticket data must be 0x180 bytes");
+
+        explicit Ticket(FileReader& p_File);
+
+        [[nodiscard]] const Data& getData() const { return m_Data; }
+        [[nodiscard]] const ByteArray<0x10>& getRightsID() const { return m_Data.rightsID; }
+        [[nodiscard]] bool isPersonalized() const { return m_Data.titleKeyType == TitleKeyType::PERSONALIZED; }
+
+    private:
+        [[nodiscard]] static usize getSignatureSize(u32 p_SignatureType);
+
+        u32 m_SignatureType = 0;
+        Data m_Data{};
+    };
+}
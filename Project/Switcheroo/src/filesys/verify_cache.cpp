@@ -0,0 +1,130 @@
+#include "verify_cache.hpp"
+
+#include <fstream>
+#include <iostream>
+
+swroo::filesys::VerifyCache::VerifyCache(const std::filesystem::path& p_Path)
+    : m_Path(p_Path), m_LastFlush(std::chrono::steady_clock::now())
+{
+    std::ifstream l_File(m_Path, std::ios::binary);
+    if (!l_File.is_open())
+        return;
+
+    Header l_Header{};
+    l_File.read(reinterpret_cast<char*>(&l_Header), sizeof(Header));
+    if (l_File.fail() || l_Header.magic != utils::MagicFromChars('S', 'W', 'V', 'C') || l_Header.version != c_Version || l_Header.recordSize != sizeof(Record))
+    {
+        std::cout << "Ignoring invalid verification cache: " << m_Path << '\n';
+        return;
+    }
+
+    // The count is checked against the file before anything is sized from it
+    std::error_code l_Error;
+    const usize l_FileSize = std::filesystem::file_size(m_Path, l_Error);
+    if (l_Error || l_FileSize < sizeof(Header) || static_cast<usize>(l_Header.recordCount) * sizeof(Record) > l_FileSize - sizeof(Header))
+    {
+        std::cout << "Ignoring truncated verification cache: " << m_Path << '\n';
+        return;
+    }
+
+    std::vector<Record> l_Records(l_Header.recordCount);
+    l_File.read(reinterpret_cast<char*>(l_Records.data()), static_cast<std::streamsize>(l_Records.size() * sizeof(Record)));
+    if (l_File.fail())
+    {
+        std::cout << "Ignoring truncated verification cache: " << m_Path << '\n';
+        return;
+    }
+
+    for (const Record& l_Record : l_Records)
+        m_Records[l_Record.contentID] = l_Record;
+}
+
+swroo::filesys::VerifyCache::~VerifyCache()
+{
+    try
+    {
+        save();
+    }
+    catch (const std::exception& l_Exception)
+    {
+        std::cout << "Failed to save verification cache: " << l_Exception.what() << '\n';
+    }
+}
+
+std::optional<swroo::filesys::VerifyCache::Identity> swroo::filesys::VerifyCache::getIdentity(const std::filesystem::path& p_File, const u64 p_NCASize)
+{
+    std::error_code l_Error;
+    const u64 l_FileSize = std::filesystem::file_size(p_File, l_Error);
+    if (l_Error)
+        return std::nullopt;
+
+    const std::filesystem::file_time_type l_FileTime = std::filesystem::last_write_time(p_File, l_Error);
+    if (l_Error)
+        return std::nullopt;
+
+    return Identity{ l_FileSize, static_cast<i64>(l_FileTime.time_since_epoch().count()), p_NCASize };
+}
+
+swroo::filesys::VerifyCache::Record swroo::filesys::VerifyCache::begin(const ByteArray<0x10>& p_ContentID, const Identity& p_Identity)
+{
+    std::lock_guard l_Lock(m_Mutex);
+
+    auto l_It = m_Records.find(p_ContentID);
+    if (l_It != m_Records.end() && l_It->second.identity == p_Identity)
+        return l_It->second;
+
+    Record l_Record{};
+    l_Record.contentID = p_ContentID;
+    l_Record.identity = p_Identity;
+    m_Records[p_ContentID] = l_Record;
+    m_Dirty = true;
+    return l_Record;
+}
+
+void swroo::filesys::VerifyCache::update(const ByteArray<0x10>& p_ContentID, const std::function<void(Record&)>& p_Update, const bool p_Flush)
+{
+    std::lock_guard l_Lock(m_Mutex);
+
+    auto l_It = m_Records.find(p_ContentID);
+    if (l_It == m_Records.end())
+        throw std::runtime_error("Verification cache update without a record");
+
+    p_Update(l_It->second);
+    m_Dirty = true;
+
+    if (p_Flush || std::chrono::steady_clock::now() - m_LastFlush >= c_FlushInterval)
+        saveLocked();
+}
+
+void swroo::filesys::VerifyCache::save()
+{
+    std::lock_guard l_Lock(m_Mutex);
+    saveLocked();
+}
+
+void swroo::filesys::VerifyCache::saveLocked()
+{
+    m_LastFlush = std::chrono::steady_clock::now();
+    if (!m_Dirty)
+        return;
+
+    // Write next to the cache and swap it in, so an interruption never leaves a half written file behind
+    std::filesystem::path l_TempPath = m_Path;
+    l_TempPath += ".tmp";
+    {
+        std::ofstream l_File(l_TempPath, std::ios::binary | std::ios::trunc);
+        if (!l_File.is_open())
+            throw std::runtime_error("Failed to open verification cache: " + l_TempPath.string());
+
+        const Header l_Header{ utils::MagicFromChars('S', 'W', 'V', 'C'), c_Version, static_cast<u32>(m_Records.size()), sizeof(Record) };
+        l_File.write(reinterpret_cast<const char*>(&l_Header), sizeof(Header));
+        for (const auto& [l_ContentID, l_Record] : m_Records)
+            l_File.write(reinterpret_cast<const char*>(&l_Record), sizeof(Record));
+
+        if (l_File.fail())
+            throw std::runtime_error("Failed to write verification cache: " + l_TempPath.string());
+    }
+
+    std::filesystem::rename(l_TempPath, m_Path);
+    m_Dirty = false;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "../util/common.hpp"
+#include "../util/crypto/sha256.hpp"
+#include "content_index.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace swroo::filesys
+{
+    // Remembers NCA verification results across runs, keyed by content ID. Partial results are checkpointed
+    // while verifying so an interrupted run can resume from the last completed block range.
+    class VerifyCache
+    {
+    public:
+        // Identifies the file an NCA was read from, any change means the content has to be verified again
+        struct Identity
+        {
+            u64 fileSize;
+            i64 fileTime;
+            u64 ncaSize;
+
+            bool operator==(const Identity&) const = default;
+        };
+
+#pragma pack(push, 1)
+        struct SectionState
+        {
+            u8 status; // NCA::VerifyResult::Status
+            u64 progress; // Data bytes of the last hash level verified from the start
+        };
+
+        struct Record
+        {
+            ByteArray<0x10> contentID;
+            Identity identity;
+            i64 verifiedAt; // Unix time, 0 while the verification is incomplete
+            std::array<SectionState, 4> sections;
+            u8 contentStatus;
+            crypto::SHA256::State contentState; // Whole-file hash progress
+        };
+#pragma pack(pop)
+
+        explicit VerifyCache(const std::filesystem::path& p_Path);
+        VerifyCache(const VerifyCache&) = delete;
+        ~VerifyCache();
+
+        [[nodiscard]] static std::optional<Identity> getIdentity(const std::filesystem::path& p_File, u64 p_NCASize);
+
+        // Returns the record for p_ContentID, or a fresh one if the identity changed since it was stored
+        [[nodiscard]] Record begin(const ByteArray<0x10>& p_ContentID, const Identity& p_Identity);
+        // Applies p_Update to the stored record, the file is rewritten at most once per flush interval unless p_Flush is set
+        void update(const ByteArray<0x10>& p_ContentID, const std::function<void(Record&)>& p_Update, bool p_Flush = false);
+
+        void save();
+
+    private:
+        struct Header
+        {
+            u32 magic;
+            u32 version;
+            u32 recordCount;
+            u32 recordSize;
+        };
+
+        static constexpr u32 c_Version = 1;
+        static constexpr std::chrono::seconds c_FlushInterval{ 2 };
+
+        void saveLocked();
+
+        std::filesystem::path m_Path;
+        std::unordered_map<ByteArray<0x10>, Record, ContentIDHash> m_Records;
+
+        std::mutex m_Mutex;
+        std::chrono::steady_clock::time_point m_LastFlush;
+        bool m_Dirty = false;
+    };
+}
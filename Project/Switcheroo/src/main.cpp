@@ -1,19 +1,134 @@
 
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
 
+#include "bench.hpp"
 #include "engine.hpp"
+#include "filesys/verify_cache.hpp"
 #include "filesys/loader/pfs.hpp"
 
+static bool verifyNCAs(swroo::Engine& p_Engine, swroo::filesys::PFS& p_PFS, swroo::filesys::VerifyCache& p_Cache)
+{
+    using swroo::filesys::NCA;
+
+    bool l_AllValid = true;
+    for (NCA& l_NCA : p_PFS.getNCAs())
+    {
+        // Duplicates whose header matches a verified copy are not hashed again, they are neither OK nor CORRUPT
+        if (const std::optional<swroo::filesys::ContentIndex::Location> l_Copy = l_NCA.findVerifiedCopy())
+        {
+            std::cout << "NCA SKIPPED, same header as the verified copy in " << l_Copy->file << " at " << l_Copy->offset << ", data not hashed" << '\n';
+            continue;
+        }
+
+        const NCA::VerifyResult l_Result = l_NCA.verify(NCA::c_DefaultVerifyBudget, &p_Cache);
+        l_AllValid &= l_Result.isValid();
+
+        std::cout << "NCA " << (l_Result.isValid() ? "OK" : "CORRUPT") << ", content hash: " << NCA::VerifyResult::getStatusName(l_Result.contentHash)
+                  << ", " << l_Result.bytesProcessed << " bytes in " << l_Result.seconds << "s (" << l_Result.getThroughput() << " MiB/s)" << (l_Result.fromCache ? " [cached]" : "") << '\n';
+        for (usize i = 0; i < l_Result.sections.size(); ++i)
+        {
+            const NCA::VerifyResult::Section& l_Section = l_Result.sections[i];
+            if (l_Section.headerHash == NCA::VerifyResult::Status::SKIPPED && l_Section.hashTree == NCA::VerifyResult::Status::SKIPPED)
+                continue;
+
+            std::cout << "\tSection " << i << ": header " << NCA::VerifyResult::getStatusName(l_Section.headerHash)
+                      << ", hash tree " << NCA::VerifyResult::getStatusName(l_Section.hashTree);
+            if (!l_Section.error.empty())
+                std::cout << " (" << l_Section.error << ")";
+            std::cout << '\n';
+        }
+    }
+
+    const swroo::filesys::ContentIndex::Stats l_Stats = p_Engine.getContentIndex().getStats();
+    if (l_Stats.copyCount > l_Stats.contentCount)
+        std::cout << l_Stats.copyCount - l_Stats.contentCount << " duplicate NCAs, " << l_Stats.reclaimableSize << " bytes reclaimable" << '\n';
+    return l_AllValid;
+}
+
+// Classifies every file under p_Path from its headers alone, one line per NCA
+static void listContents(swroo::Engine& p_Engine, const std::filesystem::path& p_Path)
+{
+    using swroo::filesys::NCA;
+
+    std::vector<std::filesystem::path> l_Paths;
+    if (std::filesystem::is_directory(p_Path))
+    {
+        for (const std::filesystem::directory_entry& l_Entry : std::filesystem::recursive_directory_iterator(p_Path, std::filesystem::directory_options::skip_permission_denied))
+        {
+            if (l_Entry.is_regular_file())
+                l_Paths.push_back(l_Entry.path());
+        }
+    }
+    else
+    {
+        l_Paths.push_back(p_Path);
+    }
+
+    const std::vector<swroo::utils::Expected<swroo::Engine::FileProbe>> l_Results = p_Engine.probeFiles(l_Paths);
+    usize l_Unknown = 0;
+    for (usize i = 0; i < l_Paths.size(); ++i)
+    {
+        if (!l_Results[i])
+        {
+            ++l_Unknown;
+            continue;
+        }
+
+        const swroo::Engine::FileProbe& l_File = l_Results[i].getValue();
+        for (const swroo::Engine::FileProbe::Content& l_Content : l_File.contents)
+        {
+            std::cout << swroo::Engine::FileProbe::getTypeName(l_File.type) << ' ' << l_Paths[i].string();
+            if (!l_Content.name.empty())
+                std::cout << ':' << l_Content.name;
+
+            if (!l_Content.probe)
+            {
+                std::cout << ' ' << l_Content.probe.getError().toString() << '\n';
+                continue;
+            }
+
+            const NCA::Probe& l_Probe = l_Content.probe.getValue();
+            std::cout << ' ' << NCA::getContentTypeName(l_Probe.contentType) << ' ' << std::hex << std::setfill('0') << std::setw(16) << l_Probe.titleID
+                      << std::dec << " keygen " << static_cast<u32>(l_Probe.keyGeneration) << " rights ";
+            if (l_Probe.hasRightsID())
+            {
+                for (const u8 l_Byte : l_Probe.rightsID)
+                    std::cout << std::hex << std::setw(2) << static_cast<u32>(l_Byte);
+                std::cout << std::dec;
+            }
+            else
+            {
+                std::cout << '-';
+            }
+            std::cout << std::setfill(' ') << '\n';
+        }
+    }
+
+    std::cout << l_Paths.size() << " files, " << l_Unknown << " not recognized" << '\n';
+}
+
 i32 main(const i32 argc, char** argv)
 {
-    if (argc < 3)
+    if (argc == 3 && std::string_view(argv[1]) == "--bench" && std::string_view(argv[2]) == "sha256")
     {
-        std::cerr << "Usage: " << argv[0] << " <path_to_pfs> <path_to_key_folder>" << '\n';
+        swroo::bench::runSHA256();
+        return 0;
+    }
+
+    const bool l_Verify = argc >= 2 && std::string_view(argv[1]) == "--verify";
+    const bool l_List = argc >= 2 && std::string_view(argv[1]) == "--ls";
+    const i32 l_FirstArg = l_Verify || l_List ? 2 : 1;
+    if (argc < l_FirstArg + 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--verify] <path_to_pfs|path_to_xci> <path_to_key_folder>" << '\n';
+        std::cerr << "       " << argv[0] << " --ls <path_to_file|path_to_folder> <path_to_key_folder>" << '\n';
+        std::cerr << "       " << argv[0] << " --bench sha256" << '\n';
         return 1;
     }
 
-    const std::filesystem::path l_FilePath = argv[1];
+    const std::filesystem::path l_FilePath = argv[l_FirstArg];
     // Check if the file exists
     if (!std::filesystem::exists(l_FilePath))
     {
@@ -21,14 +136,45 @@ i32 main(const i32 argc, char** argv)
         return 1;
     }
     // Generate keys
-    std::filesystem::path l_ProdKeysPath = argv[2];
+    std::filesystem::path l_ProdKeysPath = argv[l_FirstArg + 1];
     l_ProdKeysPath /= "prod.keys";
-    std::filesystem::path l_TitleKeysPath = argv[2];
+    std::filesystem::path l_TitleKeysPath = argv[l_FirstArg + 1];
     l_TitleKeysPath /= "title.keys";
 
     swroo::Engine l_Engine(l_ProdKeysPath, l_TitleKeysPath);
-    swroo::filesys::PFS l_PFS = l_Engine.loadFPS0(l_FilePath);
+    if (l_List)
+    {
+        listContents(l_Engine, l_FilePath);
+        return 0;
+    }
+
+    // Verification results are kept next to the keys so unchanged content is not hashed again
+    std::filesystem::path l_VerifyCachePath = argv[l_FirstArg + 1];
+    l_VerifyCachePath /= "verify.cache";
+    std::optional<swroo::filesys::VerifyCache> l_VerifyCache;
+    if (l_Verify)
+        l_VerifyCache.emplace(l_VerifyCachePath);
+    // Verification reads every byte once, there is no point in caching it
+    const swroo::IOMode l_IOMode = l_Verify ? swroo::IOMode::DIRECT : swroo::IOMode::BUFFERED;
+
+    if (l_FilePath.extension() == ".xci")
+    {
+        const std::shared_ptr<swroo::filesys::XCI> l_XCI = l_Engine.loadXCI(l_FilePath, l_IOMode);
+        std::cout << "XCI loaded successfully!" << '\n';
+        if (l_Verify)
+            return verifyNCAs(l_Engine, l_XCI->getPartition(swroo::filesys::XCI::Partition::SECURE), *l_VerifyCache) ? 0 : 2;
+        return 0;
+    }
+
+    swroo::utils::Expected<std::shared_ptr<swroo::filesys::PFS>> l_PFS = l_Engine.tryLoadPFS0(l_FilePath, l_IOMode);
+    if (!l_PFS)
+    {
+        std::cerr << l_PFS.getError().toString(l_FilePath) << '\n';
+        return 1;
+    }
 
     std::cout << "PFS0 loaded successfully!" << '\n';
+    if (l_Verify)
+        return verifyNCAs(l_Engine, *l_PFS.getValue(), *l_VerifyCache) ? 0 : 2;
     return 0;
 }
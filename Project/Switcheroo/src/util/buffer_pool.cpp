@@ -0,0 +1,203 @@
+#include "buffer_pool.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+static usize alignUp(const usize p_Value, const usize p_Alignment)
+{
+    return (p_Value + p_Alignment - 1) / p_Alignment * p_Alignment;
+}
+
+static void raiseTo(std::atomic<usize>& p_Peak, const usize p_Value)
+{
+    usize l_Peak = p_Peak.load(std::memory_order_relaxed);
+    while (l_Peak < p_Value && !p_Peak.compare_exchange_weak(l_Peak, p_Value, std::memory_order_relaxed))
+    {
+    }
+}
+
+swroo::utils::BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+    : m_Pool(other.m_Pool), m_Data(other.m_Data)
+{
+    other.m_Data = nullptr;
+}
+
+swroo::utils::BufferPool::Buffer::~Buffer()
+{
+    if (m_Data != nullptr)
+        m_Pool->recycle(m_Data);
+}
+
+swroo::utils::BufferPool::BufferPool(const usize p_BufferSize, const usize p_Alignment, const usize p_MaxFree, const bool p_HugePages)
+    : m_BufferSize(p_BufferSize), m_Alignment(p_Alignment), m_MaxFreePerShard(std::max<usize>((p_MaxFree + c_ShardCount - 1) / c_ShardCount, 1)),
+      m_HugePages(p_HugePages), m_Shards(std::make_unique<Shard[]>(c_ShardCount))
+{
+#ifdef _WIN32
+    // Large pages need SeLockMemoryPrivilege, which most accounts lack. One allocation tells, and is kept as the first free buffer.
+    if (m_HugePages)
+    {
+        const usize l_LargePage = GetLargePageMinimum();
+        void* l_Data = l_LargePage != 0 && m_Alignment <= l_LargePage
+            ? VirtualAlloc(nullptr, alignUp(m_BufferSize, l_LargePage), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE)
+            : nullptr;
+        m_HugePages = l_Data != nullptr;
+        if (m_HugePages)
+        {
+            m_Shards[0].free.push_back(static_cast<u8*>(l_Data));
+            m_Allocated = 1;
+            m_PeakAllocated = 1;
+        }
+    }
+#elif !defined(__linux__)
+    m_HugePages = false;
+#endif
+}
+
+swroo::utils::BufferPool::~BufferPool()
+{
+    for (usize i = 0; i < c_ShardCount; ++i)
+    {
+        for (u8* l_Data : m_Shards[i].free)
+            free(l_Data);
+    }
+}
+
+swroo::utils::BufferPool::Shard& swroo::utils::BufferPool::getShard()
+{
+    return m_Shards[std::hash<std::thread::id>{}(std::this_thread::get_id()) % c_ShardCount];
+}
+
+swroo::utils::BufferPool::Buffer swroo::utils::BufferPool::acquire()
+{
+    ++m_Acquires;
+    raiseTo(m_PeakInUse, ++m_InUse);
+
+    // Own shard first, then whatever another thread left behind
+    Shard& l_Own = getShard();
+    for (usize i = 0; i < c_ShardCount; ++i)
+    {
+        Shard& l_Shard = i == 0 ? l_Own : m_Shards[(&l_Own - m_Shards.get() + i) % c_ShardCount];
+        std::lock_guard l_Lock(l_Shard.mutex);
+        if (!l_Shard.free.empty())
+        {
+            u8* l_Data = l_Shard.free.back();
+            l_Shard.free.pop_back();
+            return Buffer(*this, l_Data);
+        }
+    }
+
+    ++m_Allocations;
+    raiseTo(m_PeakAllocated, ++m_Allocated);
+    return Buffer(*this, allocate());
+}
+
+u8* swroo::utils::BufferPool::allocate()
+{
+    if (!m_HugePages)
+        return static_cast<u8*>(::operator new[](m_BufferSize, std::align_val_t(m_Alignment)));
+
+#ifdef _WIN32
+    void* l_Data = VirtualAlloc(nullptr, alignUp(m_BufferSize, GetLargePageMinimum()), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (l_Data == nullptr)
+        throw std::bad_alloc();
+    return static_cast<u8*>(l_Data);
+#elif defined(__linux__)
+    // mmap only aligns to pages, so map one huge page more than needed and cut the ends off
+    const usize l_Alignment = std::max(m_Alignment, c_HugePageSize);
+    const usize l_Size = alignUp(m_BufferSize, c_HugePageSize);
+    void* l_Mapping = mmap(nullptr, l_Size + l_Alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (l_Mapping == MAP_FAILED)
+        throw std::bad_alloc();
+
+    u8* l_Start = static_cast<u8*>(l_Mapping);
+    u8* l_Data = reinterpret_cast<u8*>(alignUp(reinterpret_cast<usize>(l_Start), l_Alignment));
+    if (l_Data > l_Start)
+        munmap(l_Start, l_Data - l_Start);
+    munmap(l_Data + l_Size, l_Start + l_Size + l_Alignment - (l_Data + l_Size));
+
+    // Only a hint, the kernel backs the range with regular pages when it has no huge ones free
+    madvise(l_Data, l_Size, MADV_HUGEPAGE);
+    return l_Data;
+#else
+    return nullptr;
+#endif
+}
+
+void swroo::utils::BufferPool::recycle(u8* p_Data)
+{
+    --m_InUse;
+    {
+        Shard& l_Shard = getShard();
+        std::lock_guard l_Lock(l_Shard.mutex);
+        if (l_Shard.free.size() < m_MaxFreePerShard)
+        {
+            l_Shard.free.push_back(p_Data);
+            return;
+        }
+    }
+    free(p_Data);
+}
+
+void swroo::utils::BufferPool::free(u8* p_Data)
+{
+    --m_Allocated;
+    if (!m_HugePages)
+    {
+        ::operator delete[](p_Data, std::align_val_t(m_Alignment));
+        return;
+    }
+
+#ifdef _WIN32
+    VirtualFree(p_Data, 0, MEM_RELEASE);
+#elif defined(__linux__)
+    munmap(p_Data, alignUp(m_BufferSize, c_HugePageSize));
+#endif
+}
+
+swroo::utils::BufferPool::Stats swroo::utils::BufferPool::getStats() const
+{
+    return {
+        m_BufferSize,
+        m_Allocated.load(),
+        m_PeakAllocated.load(),
+        m_InUse.load(),
+        m_PeakInUse.load(),
+        m_Acquires.load(),
+        m_Allocations.load(),
+        m_HugePages,
+    };
+}
+
+usize swroo::utils::BufferPool::getMemoryUsage() const
+{
+    // Huge page buffers take whole huge pages
+    const usize l_Size = m_HugePages ? alignUp(m_BufferSize, c_HugePageSize) : m_BufferSize;
+    return m_Allocated.load() * l_Size;
+}
+
+usize swroo::utils::BufferPool::trim()
+{
+    usize l_Freed = 0;
+    for (usize i = 0; i < c_ShardCount; ++i)
+    {
+        std::vector<u8*> l_Free;
+        {
+            std::lock_guard l_Lock(m_Shards[i].mutex);
+            l_Free.swap(m_Shards[i].free);
+        }
+        for (u8* l_Data : l_Free)
+            free(l_Data);
+        l_Freed += l_Free.size();
+    }
+    return l_Freed;
+}
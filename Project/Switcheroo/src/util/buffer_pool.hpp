@@ -0,0 +1,98 @@
+#pragma once
+#include "common.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace swroo::utils
+{
+    // Hands out fixed size, aligned buffers and keeps released ones around for the next caller, for I/O paths that
+    // would otherwise allocate on every call. Free buffers sit in per-thread shards, a thread takes from its own shard
+    // first and only looks at the others when it is empty. Thread safe.
+    class BufferPool
+    {
+    public:
+        static constexpr usize c_ShardCount = 8;
+        static constexpr usize c_HugePageSize = 0x200000;
+
+        // Goes back to its pool when destroyed
+        class Buffer
+        {
+        public:
+            Buffer(const Buffer&) = delete;
+            Buffer& operator=(const Buffer&) = delete;
+            Buffer(Buffer&& other) noexcept;
+            ~Buffer();
+
+            [[nodiscard]] u8* getData() const { return m_Data; }
+            [[nodiscard]] usize getSize() const { return m_Pool->getBufferSize(); }
+
+        private:
+            friend class BufferPool;
+            Buffer(BufferPool& p_Pool, u8* p_Data) : m_Pool(&p_Pool), m_Data(p_Data) {}
+
+            BufferPool* m_Pool;
+            u8* m_Data;
+        };
+
+        struct Stats
+        {
+            usize bufferSize;
+            usize allocated;     // Buffers currently owned by the pool, in use or free
+            usize peakAllocated;
+            usize inUse;
+            usize peakInUse;
+            u64 acquires;
+            u64 allocations;     // Acquires that could not reuse a free buffer
+            bool hugePages;
+
+            [[nodiscard]] usize getPeakSize() const { return peakAllocated * bufferSize; }
+        };
+
+        // Up to p_MaxFree released buffers are kept, the rest are freed. With p_HugePages, buffers are backed by huge
+        // pages where the system allows it (transparent huge pages on Linux, large pages on Windows with the lock
+        // memory privilege) and by regular pages otherwise.
+        explicit BufferPool(usize p_BufferSize, usize p_Alignment, usize p_MaxFree = 0x10, bool p_HugePages = false);
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+        ~BufferPool();
+
+        [[nodiscard]] Buffer acquire();
+
+        [[nodiscard]] usize getBufferSize() const { return m_BufferSize; }
+        [[nodiscard]] usize getAlignment() const { return m_Alignment; }
+        [[nodiscard]] Stats getStats() const;
+        // Bytes allocated for buffers in use and free ones
+        [[nodiscard]] usize getMemoryUsage() const;
+
+        // Frees every buffer that is not in use, returns how many
+        usize trim();
+
+    private:
+        struct alignas(64) Shard
+        {
+            std::mutex mutex;
+            std::vector<u8*> free;
+        };
+
+        [[nodiscard]] Shard& getShard();
+        [[nodiscard]] u8* allocate();
+        void recycle(u8* p_Data);
+        void free(u8* p_Data);
+
+        usize m_BufferSize;
+        usize m_Alignment;
+        usize m_MaxFreePerShard;
+        bool m_HugePages;
+
+        std::unique_ptr<Shard[]> m_Shards;
+
+        std::atomic<usize> m_Allocated = 0;
+        std::atomic<usize> m_PeakAllocated = 0;
+        std::atomic<usize> m_InUse = 0;
+        std::atomic<usize> m_PeakInUse = 0;
+        std::atomic<u64> m_Acquires = 0;
+        std::atomic<u64> m_Allocations = 0;
+    };
+}
@@ -0,0 +1,97 @@
+#include "lz4.hpp"
+
+// Match lengths are stored minus this, shorter matches are never encoded
+static constexpr usize c_MinMatch = 4;
+static constexpr usize c_WildCopySize = 0x10;
+
+static bool readLength(const u8*& p_Input, const u8* p_InputEnd, usize& p_Length)
+{
+    u8 l_Byte;
+    do
+    {
+        if (p_Input >= p_InputEnd)
+            return false;
+        l_Byte = *p_Input++;
+        p_Length += l_Byte;
+    } while (l_Byte == 0xFF);
+    return true;
+}
+
+bool swroo::compression::LZ4::decompressBlock(const u8* p_Input, const usize p_InputSize, u8* p_Output, const usize p_OutputSize)
+{
+    const u8* l_Input = p_Input;
+    const u8* const l_InputEnd = p_Input + p_InputSize;
+    u8* l_Output = p_Output;
+    u8* const l_OutputEnd = p_Output + p_OutputSize;
+
+    while (l_Input < l_InputEnd)
+    {
+        const u8 l_Token = *l_Input++;
+
+        usize l_LiteralSize = l_Token >> 4;
+        if (l_LiteralSize == 0xF && !readLength(l_Input, l_InputEnd, l_LiteralSize))
+            return false;
+
+        if (l_LiteralSize > static_cast<usize>(l_InputEnd - l_Input) || l_LiteralSize > static_cast<usize>(l_OutputEnd - l_Output))
+            return false;
+
+        // Short literal runs are by far the most common, copy a fixed 16 bytes when both sides have room for it
+        if (l_LiteralSize <= c_WildCopySize && static_cast<usize>(l_InputEnd - l_Input) >= c_WildCopySize && static_cast<usize>(l_OutputEnd - l_Output) >= c_WildCopySize)
+            std::memcpy(l_Output, l_Input, c_WildCopySize);
+        else
+            std::memcpy(l_Output, l_Input, l_LiteralSize);
+        l_Input += l_LiteralSize;
+        l_Output += l_LiteralSize;
+
+        // The last sequence only has literals
+        if (l_Input == l_InputEnd)
+            break;
+
+        if (l_InputEnd - l_Input < 2)
+            return false;
+        const usize l_MatchOffset = static_cast<usize>(l_Input[0]) | static_cast<usize>(l_Input[1]) << 8;
+        l_Input += 2;
+        if (l_MatchOffset == 0 || l_MatchOffset > static_cast<usize>(l_Output - p_Output))
+            return false;
+
+        usize l_MatchSize = l_Token & 0xF;
+        if (l_MatchSize == 0xF && !readLength(l_Input, l_InputEnd, l_MatchSize))
+            return false;
+        l_MatchSize += c_MinMatch;
+
+        if (l_MatchSize > static_cast<usize>(l_OutputEnd - l_Output))
+            return false;
+
+        const u8* l_Match = l_Output - l_MatchOffset;
+        u8* const l_MatchEnd = l_Output + l_MatchSize;
+        if (l_MatchOffset >= c_WildCopySize && static_cast<usize>(l_OutputEnd - l_Output) >= l_MatchSize + c_WildCopySize)
+        {
+            // Far enough back that 16 byte chunks never overlap what they are copying, overshoot is rewritten later
+            while (l_Output < l_MatchEnd)
+            {
+                std::memcpy(l_Output, l_Match, c_WildCopySize);
+                l_Output += c_WildCopySize;
+                l_Match += c_WildCopySize;
+            }
+            l_Output = l_MatchEnd;
+        }
+        else if (l_MatchOffset >= 8 && static_cast<usize>(l_OutputEnd - l_Output) >= l_MatchSize + 8)
+        {
+            while (l_Output < l_MatchEnd)
+            {
+                std::memcpy(l_Output, l_Match, 8);
+                l_Output += 8;
+                l_Match += 8;
+            }
+            l_Output = l_MatchEnd;
+        }
+        else
+        {
+            // Overlapping matches repeat the last l_MatchOffset bytes, which needs a byte by byte copy
+            while (l_Output < l_MatchEnd)
+                *l_Output++ = *l_Match++;
+        }
+    }
+
+    return l_Output == l_OutputEnd;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "../common.hpp"
+
+namespace swroo::compression
+{
+    class LZ4
+    {
+    public:
+        // Decodes a raw LZ4 block (no frame header). Fails unless the block decodes to exactly p_OutputSize bytes,
+        // never reads or writes outside of the given buffers.
+        [[nodiscard]] static bool decompressBlock(const u8* p_Input, usize p_InputSize, u8* p_Output, usize p_OutputSize);
+    };
+}
@@ -3,16 +3,28 @@
 #include <stdexcept>
 #include <mbedtls/cipher.h>
 
+static mbedtls_cipher_type_t getCipherType(const swroo::crypto::AES::Mode p_Mode)
+{
+    switch (p_Mode)
+    {
+    case swroo::crypto::AES::Mode::XTS: return MBEDTLS_CIPHER_AES_128_XTS;
+    case swroo::crypto::AES::Mode::ECB: return MBEDTLS_CIPHER_AES_128_ECB;
+    case swroo::crypto::AES::Mode::CTR: return MBEDTLS_CIPHER_AES_128_CTR;
+    }
+    return MBEDTLS_CIPHER_NONE;
+}
 
-swroo::crypto::AES::AES(const u8* p_Key)
+swroo::crypto::AES::AES(const u8* p_Key, const Mode p_Mode)
+    : m_Mode(p_Mode)
 {
     mbedtls_cipher_init(&m_Ctx);
 
-    const mbedtls_cipher_info_t* l_CipherInfo = mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_XTS);
+    const mbedtls_cipher_info_t* l_CipherInfo = mbedtls_cipher_info_from_type(getCipherType(p_Mode));
     if (!l_CipherInfo || mbedtls_cipher_setup(&m_Ctx, l_CipherInfo) != 0)
         throw std::runtime_error("Failed to setup AES cipher context");
 
-    if (mbedtls_cipher_setkey(&m_Ctx, p_Key, 256, MBEDTLS_DECRYPT) != 0)
+    const i32 l_KeyBits = p_Mode == Mode::XTS ? 256 : 128;
+    if (mbedtls_cipher_setkey(&m_Ctx, p_Key, l_KeyBits, MBEDTLS_DECRYPT) != 0)
         throw std::runtime_error("Failed to set AES key");
 }
 
@@ -23,7 +35,7 @@ swroo::crypto::AES::~AES()
 
 bool swroo::crypto::AES::decryptXTS(const u8* p_In, u8* p_Out, const usize p_Size, const TweakCallback& p_TweakProvider, const usize p_SectorSize, const usize p_SectorOffset)
 {
-    if (p_Size % p_SectorSize != 0) 
+    if (m_Mode != Mode::XTS || p_Size % p_SectorSize != 0) 
         return false; // must be a whole number of sectors
 
     const usize l_NumSectors = p_Size / p_SectorSize;
@@ -41,3 +53,35 @@ bool swroo::crypto::AES::decryptXTS(const u8* p_In, u8* p_Out, const usize p_Siz
 
     return true;
 }
+
+bool swroo::crypto::AES::decryptECB(const u8* p_In, u8* p_Out, const usize p_Size)
+{
+    constexpr usize l_BlockSize = 0x10;
+    if (m_Mode != Mode::ECB || p_Size % l_BlockSize != 0)
+        return false;
+
+    // mbedtls only takes a single block per update call in ECB mode
+    for (usize l_Offset = 0; l_Offset < p_Size; l_Offset += l_BlockSize)
+    {
+        usize out_len = 0;
+        if (mbedtls_cipher_update(&m_Ctx, p_In + l_Offset, l_BlockSize, p_Out + l_Offset, &out_len) != 0 || out_len != l_BlockSize)
+            return false;
+    }
+
+    return true;
+}
+
+bool swroo::crypto::AES::decryptCTR(const u8* p_In, u8* p_Out, const usize p_Size, const ByteArray<0x10>& p_Counter)
+{
+    if (m_Mode != Mode::CTR)
+        return false;
+
+    if (mbedtls_cipher_set_iv(&m_Ctx, p_Counter.data(), p_Counter.size()) != 0 || mbedtls_cipher_reset(&m_Ctx) != 0)
+        return false;
+
+    usize out_len = 0;
+    if (mbedtls_cipher_update(&m_Ctx, p_In, p_Size, p_Out, &out_len) != 0 || out_len != p_Size)
+        return false;
+
+    return true;
+}
@@ -9,14 +9,29 @@ namespace swroo::crypto
     class AES
     {
     public:
-        explicit AES(const u8* p_Key);
+        enum class Mode : u8
+        {
+            XTS, // 256 bit key (two 128 bit halves)
+            ECB,
+            CTR,
+        };
+
+        explicit AES(const u8* p_Key, Mode p_Mode = Mode::XTS);
+        AES(const AES&) = delete;
+        AES& operator=(const AES&) = delete;
         ~AES();
 
         using TweakCallback = std::function<ByteArray<16>(u64 sector)>;
 
         bool decryptXTS(const u8* p_In, u8* p_Out, usize p_Size, const TweakCallback& p_TweakProvider, usize p_SectorSize, usize p_SectorOffset = 0);
+        bool decryptECB(const u8* p_In, u8* p_Out, usize p_Size);
+        // The key schedule is kept, only the counter is reloaded on every call
+        bool decryptCTR(const u8* p_In, u8* p_Out, usize p_Size, const ByteArray<0x10>& p_Counter);
+
+        [[nodiscard]] Mode getMode() const { return m_Mode; }
 
     private:
         mbedtls_cipher_context_t m_Ctx;
+        Mode m_Mode;
     };
 }
@@ -0,0 +1,90 @@
+#include "rsa.hpp"
+
+#include <stdexcept>
+
+#include "sha256.hpp"
+
+// XORs the MGF1 (SHA-256) mask generated from p_Seed into p_Data
+static void applyMGF1(const u8* p_Seed, const usize p_SeedSize, u8* p_Data, const usize p_Size)
+{
+    std::vector<u8> l_Input(p_SeedSize + sizeof(u32));
+    std::memcpy(l_Input.data(), p_Seed, p_SeedSize);
+
+    for (u32 l_Counter = 0, l_Done = 0; l_Done < p_Size; ++l_Counter)
+    {
+        l_Input[p_SeedSize + 0] = static_cast<u8>(l_Counter >> 24);
+        l_Input[p_SeedSize + 1] = static_cast<u8>(l_Counter >> 16);
+        l_Input[p_SeedSize + 2] = static_cast<u8>(l_Counter >> 8);
+        l_Input[p_SeedSize + 3] = static_cast<u8>(l_Counter);
+
+        const swroo::crypto::SHA256Hash l_Mask = swroo::crypto::SHA256::hash(l_Input.data(), l_Input.size());
+        const usize l_Size = std::min<usize>(l_Mask.size(), p_Size - l_Done);
+        for (usize i = 0; i < l_Size; ++i)
+            p_Data[l_Done + i] ^= l_Mask[i];
+        l_Done += static_cast<u32>(l_Size);
+    }
+}
+
+swroo::crypto::RSA::RSA(const ByteArray<c_KeySize>& p_Modulus, const ByteArray<c_KeySize>& p_PrivateExponent,
+                        const ByteArray<c_PublicExponentSize>& p_PublicExponent)
+{
+    mbedtls_rsa_init(&m_Context);
+    mbedtls_entropy_init(&m_Entropy);
+    mbedtls_ctr_drbg_init(&m_Random);
+
+    constexpr char l_Personalization[] = "swroo::crypto::RSA";
+    if (mbedtls_rsa_import_raw(&m_Context, p_Modulus.data(), p_Modulus.size(), nullptr, 0, nullptr, 0,
+                               p_PrivateExponent.data(), p_PrivateExponent.size(), p_PublicExponent.data(), p_PublicExponent.size()) != 0 ||
+        mbedtls_rsa_complete(&m_Context) != 0 || mbedtls_rsa_get_len(&m_Context) != c_KeySize ||
+        mbedtls_ctr_drbg_seed(&m_Random, mbedtls_entropy_func, &m_Entropy,
+                              reinterpret_cast<const u8*>(l_Personalization), sizeof(l_Personalization) - 1) != 0)
+    {
+        mbedtls_ctr_drbg_free(&m_Random);
+        mbedtls_entropy_free(&m_Entropy);
+        mbedtls_rsa_free(&m_Context);
+        throw std::runtime_error("Failed to load RSA key");
+    }
+}
+
+swroo::crypto::RSA::~RSA()
+{
+    mbedtls_ctr_drbg_free(&m_Random);
+    mbedtls_entropy_free(&m_Entropy);
+    mbedtls_rsa_free(&m_Context);
+}
+
+bool swroo::crypto::RSA::decryptRaw(const u8* p_Input, ByteArray<c_KeySize>& p_Output)
+{
+    // Rejects inputs not below n, and blinds both the base and the exponent with values from the DRBG
+    return mbedtls_rsa_private(&m_Context, mbedtls_ctr_drbg_random, &m_Random, p_Input, p_Output.data()) == 0;
+}
+
+std::optional<std::vector<u8>> swroo::crypto::RSA::decryptOAEP(const u8* p_Input)
+{
+    // EM = 0x00 || maskedSeed || maskedDB, DB = lHash || PS (zeros) || 0x01 || M
+    constexpr usize l_HashSize = sizeof(SHA256Hash);
+    ByteArray<c_KeySize> l_Block;
+    if (!decryptRaw(p_Input, l_Block) || l_Block[0] != 0)
+        return std::nullopt;
+
+    u8* l_Seed = l_Block.data() + 1;
+    u8* l_DB = l_Seed + l_HashSize;
+    constexpr usize l_DBSize = c_KeySize - l_HashSize - 1;
+
+    applyMGF1(l_DB, l_DBSize, l_Seed, l_HashSize);
+    applyMGF1(l_Seed, l_HashSize, l_DB, l_DBSize);
+
+    constexpr u8 l_EmptyLabel = 0;
+    const SHA256Hash l_LabelHash = SHA256::hash(&l_EmptyLabel, 0);
+    if (std::memcmp(l_DB, l_LabelHash.data(), l_HashSize) != 0)
+        return std::nullopt;
+
+    usize l_Position = l_HashSize;
+    while (l_Position < l_DBSize && l_DB[l_Position] == 0)
+        ++l_Position;
+    if (l_Position == l_DBSize || l_DB[l_Position] != 0x01)
+        return std::nullopt;
+
+    ++l_Position;
+    return std::vector<u8>(l_DB + l_Position, l_DB + l_DBSize);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/rsa.h>
+#include <optional>
+
+#include "../common.hpp"
+
+namespace swroo::crypto
+{
+    // RSA-2048 private key operations, only what unwrapping personalized title keys needs
+    class RSA
+    {
+    public:
+        static constexpr usize c_KeySize = 0x100;
+
+        static constexpr usize c_PublicExponentSize = 0x4;
+
+        explicit RSA(const ByteArray<c_KeySize>& p_Modulus, const ByteArray<c_KeySize>& p_PrivateExponent,
+                     const ByteArray<c_PublicExponentSize>& p_PublicExponent);
+        RSA(const RSA&) = delete;
+        RSA& operator=(const RSA&) = delete;
+        ~RSA();
+
+        // m = c^d mod n, big endian on both sides, blinded so the timing does not depend on the key
+        bool decryptRaw(const u8* p_Input, ByteArray<c_KeySize>& p_Output);
+        // RSAES-OAEP with SHA-256 for both the label hash and MGF1, and an empty label
+        [[nodiscard]] std::optional<std::vector<u8>> decryptOAEP(const u8* p_Input);
+
+    private:
+        mbedtls_rsa_context m_Context; // The primes are derived from n, d and e so the CRT path can be used
+        mbedtls_entropy_context m_Entropy;
+        mbedtls_ctr_drbg_context m_Random; // Blinding values
+    };
+}
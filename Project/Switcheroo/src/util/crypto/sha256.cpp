@@ -0,0 +1,543 @@
+#include "sha256.hpp"
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SWROO_SHA256_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SWROO_TARGET(x)
+#else
+#include <cpuid.h>
+#define SWROO_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+using SHA256State = std::array<u32, 8>;
+
+static constexpr SHA256State c_InitialState = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+alignas(64) static constexpr std::array<u32, 64> c_RoundConstants = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static u32 loadBE32(const u8* p_Data)
+{
+    return static_cast<u32>(p_Data[0]) << 24 | static_cast<u32>(p_Data[1]) << 16 | static_cast<u32>(p_Data[2]) << 8 | static_cast<u32>(p_Data[3]);
+}
+
+static void storeBE32(u8* p_Data, const u32 p_Value)
+{
+    p_Data[0] = static_cast<u8>(p_Value >> 24);
+    p_Data[1] = static_cast<u8>(p_Value >> 16);
+    p_Data[2] = static_cast<u8>(p_Value >> 8);
+    p_Data[3] = static_cast<u8>(p_Value);
+}
+
+static swroo::crypto::SHA256Hash stateToHash(const SHA256State& p_State)
+{
+    swroo::crypto::SHA256Hash l_Hash;
+    for (u32 i = 0; i < 8; ++i)
+        storeBE32(l_Hash.data() + i * 4, p_State[i]);
+    return l_Hash;
+}
+
+// Builds the padded tail of a message (one or two blocks), returns the number of blocks written
+static usize buildTail(const u8* p_Data, const usize p_Size, const u64 p_TotalSize, ByteArray<0x80>& p_Tail)
+{
+    p_Tail.fill(0);
+    if (p_Size > 0)
+        std::memcpy(p_Tail.data(), p_Data, p_Size);
+    p_Tail[p_Size] = 0x80;
+
+    const usize l_Blocks = p_Size < 56 ? 1 : 2;
+    const u64 l_Bits = p_TotalSize * 8;
+    for (u32 i = 0; i < 8; ++i)
+        p_Tail[l_Blocks * 0x40 - 1 - i] = static_cast<u8>(l_Bits >> (i * 8));
+    return l_Blocks;
+}
+
+static u32 rotr(const u32 p_Value, const u32 p_Shift)
+{
+    return (p_Value >> p_Shift) | (p_Value << (32 - p_Shift));
+}
+
+static void compressScalar(SHA256State& p_State, const u8* p_Data, usize p_Blocks)
+{
+    std::array<u32, 64> l_W;
+    for (; p_Blocks > 0; --p_Blocks, p_Data += 0x40)
+    {
+        for (u32 i = 0; i < 16; ++i)
+            l_W[i] = loadBE32(p_Data + i * 4);
+        for (u32 i = 16; i < 64; ++i)
+        {
+            const u32 l_S0 = rotr(l_W[i - 15], 7) ^ rotr(l_W[i - 15], 18) ^ (l_W[i - 15] >> 3);
+            const u32 l_S1 = rotr(l_W[i - 2], 17) ^ rotr(l_W[i - 2], 19) ^ (l_W[i - 2] >> 10);
+            l_W[i] = l_W[i - 16] + l_S0 + l_W[i - 7] + l_S1;
+        }
+
+        u32 a = p_State[0], b = p_State[1], c = p_State[2], d = p_State[3];
+        u32 e = p_State[4], f = p_State[5], g = p_State[6], h = p_State[7];
+        for (u32 i = 0; i < 64; ++i)
+        {
+            const u32 l_T1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + c_RoundConstants[i] + l_W[i];
+            const u32 l_T2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + l_T1;
+            d = c; c = b; b = a; a = l_T1 + l_T2;
+        }
+
+        p_State[0] += a; p_State[1] += b; p_State[2] += c; p_State[3] += d;
+        p_State[4] += e; p_State[5] += f; p_State[6] += g; p_State[7] += h;
+    }
+}
+
+#ifdef SWROO_SHA256_X86
+SWROO_TARGET("sha,sse4.1")
+static void compressSHANI(SHA256State& p_State, const u8* p_Data, usize p_Blocks)
+{
+    const __m128i l_ByteSwap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+
+    // The instructions work on the ABEF/CDGH split of the state
+    __m128i l_Tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&p_State[0])), 0xB1);
+    __m128i l_State1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&p_State[4])), 0x1B);
+    __m128i l_State0 = _mm_alignr_epi8(l_Tmp, l_State1, 8);
+    l_State1 = _mm_blend_epi16(l_State1, l_Tmp, 0xF0);
+
+    for (; p_Blocks > 0; --p_Blocks, p_Data += 0x40)
+    {
+        const __m128i l_SavedState0 = l_State0;
+        const __m128i l_SavedState1 = l_State1;
+
+        // Four rounds per step, the schedule for step i + 1 and the first half of step i + 3 are computed alongside
+        __m128i l_Msg[4];
+        for (u32 i = 0; i < 16; ++i)
+        {
+            __m128i& l_Current = l_Msg[i % 4];
+            if (i < 4)
+                l_Current = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Data + i * 0x10)), l_ByteSwap);
+
+            __m128i l_Rounds = _mm_add_epi32(l_Current, _mm_load_si128(reinterpret_cast<const __m128i*>(&c_RoundConstants[i * 4])));
+            l_State1 = _mm_sha256rnds2_epu32(l_State1, l_State0, l_Rounds);
+
+            if (i >= 3 && i < 15)
+            {
+                __m128i& l_Next = l_Msg[(i + 1) % 4];
+                l_Next = _mm_add_epi32(l_Next, _mm_alignr_epi8(l_Current, l_Msg[(i + 3) % 4], 4));
+                l_Next = _mm_sha256msg2_epu32(l_Next, l_Current);
+            }
+
+            l_Rounds = _mm_shuffle_epi32(l_Rounds, 0x0E);
+            l_State0 = _mm_sha256rnds2_epu32(l_State0, l_State1, l_Rounds);
+
+            if (i >= 1 && i < 13)
+                l_Msg[(i + 3) % 4] = _mm_sha256msg1_epu32(l_Msg[(i + 3) % 4], l_Current);
+        }
+
+        l_State0 = _mm_add_epi32(l_State0, l_SavedState0);
+        l_State1 = _mm_add_epi32(l_State1, l_SavedState1);
+    }
+
+    l_Tmp = _mm_shuffle_epi32(l_State0, 0x1B);
+    l_State1 = _mm_shuffle_epi32(l_State1, 0xB1);
+    l_State0 = _mm_blend_epi16(l_Tmp, l_State1, 0xF0);
+    l_State1 = _mm_alignr_epi8(l_State1, l_Tmp, 8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&p_State[0]), l_State0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&p_State[4]), l_State1);
+}
+
+SWROO_TARGET("avx2")
+static __m256i rotr8(const __m256i p_Value, const i32 p_Shift)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(p_Value, p_Shift), _mm256_slli_epi32(p_Value, 32 - p_Shift));
+}
+
+// One block for each of the eight lanes, the state is word major (p_State[word] holds that word for every lane).
+// Lanes whose bit is clear in p_ActiveMask keep their state.
+SWROO_TARGET("avx2")
+static void compressAVX2(__m256i* p_State, const u8* const* p_Blocks, const i32 p_ActiveMask)
+{
+    const __m256i l_ByteSwap = _mm256_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL, 0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+
+    // Load and transpose, l_W[i] holds word i of every lane
+    __m256i l_W[16];
+    for (u32 i = 0; i < 16; i += 4)
+    {
+        // Lanes 0-3 in the low halves, 4-7 in the high halves
+        __m256i l_Rows[4];
+        for (u32 l_Lane = 0; l_Lane < 4; ++l_Lane)
+        {
+            const __m128i l_Low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Blocks[l_Lane] + i * 4));
+            const __m128i l_High = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p_Blocks[l_Lane + 4] + i * 4));
+            l_Rows[l_Lane] = _mm256_inserti128_si256(_mm256_castsi128_si256(l_Low), l_High, 1);
+        }
+
+        const __m256i l_T0 = _mm256_unpacklo_epi32(l_Rows[0], l_Rows[1]);
+        const __m256i l_T1 = _mm256_unpackhi_epi32(l_Rows[0], l_Rows[1]);
+        const __m256i l_T2 = _mm256_unpacklo_epi32(l_Rows[2], l_Rows[3]);
+        const __m256i l_T3 = _mm256_unpackhi_epi32(l_Rows[2], l_Rows[3]);
+
+        // The 32 bit lanes come out as 0, 1, 2, 3 | 4, 5, 6, 7
+        l_W[i + 0] = _mm256_shuffle_epi8(_mm256_unpacklo_epi64(l_T0, l_T2), l_ByteSwap);
+        l_W[i + 1] = _mm256_shuffle_epi8(_mm256_unpackhi_epi64(l_T0, l_T2), l_ByteSwap);
+        l_W[i + 2] = _mm256_shuffle_epi8(_mm256_unpacklo_epi64(l_T1, l_T3), l_ByteSwap);
+        l_W[i + 3] = _mm256_shuffle_epi8(_mm256_unpackhi_epi64(l_T1, l_T3), l_ByteSwap);
+    }
+
+    __m256i a = p_State[0], b = p_State[1], c = p_State[2], d = p_State[3];
+    __m256i e = p_State[4], f = p_State[5], g = p_State[6], h = p_State[7];
+
+    for (u32 i = 0; i < 64; ++i)
+    {
+        __m256i l_Word;
+        if (i < 16)
+        {
+            l_Word = l_W[i];
+        }
+        else
+        {
+            const __m256i l_W15 = l_W[(i - 15) % 16];
+            const __m256i l_W2 = l_W[(i - 2) % 16];
+            const __m256i l_S0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(l_W15, 7), rotr8(l_W15, 18)), _mm256_srli_epi32(l_W15, 3));
+            const __m256i l_S1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(l_W2, 17), rotr8(l_W2, 19)), _mm256_srli_epi32(l_W2, 10));
+            l_Word = _mm256_add_epi32(_mm256_add_epi32(l_W[i % 16], l_S0), _mm256_add_epi32(l_W[(i - 7) % 16], l_S1));
+            l_W[i % 16] = l_Word;
+        }
+
+        const __m256i l_Sigma1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(e, 6), rotr8(e, 11)), rotr8(e, 25));
+        const __m256i l_Choose = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        const __m256i l_Constant = _mm256_set1_epi32(static_cast<i32>(c_RoundConstants[i]));
+        const __m256i l_T1 = _mm256_add_epi32(_mm256_add_epi32(h, l_Sigma1), _mm256_add_epi32(_mm256_add_epi32(l_Choose, l_Word), l_Constant));
+        const __m256i l_Sigma0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(a, 2), rotr8(a, 13)), rotr8(a, 22));
+        const __m256i l_Majority = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        const __m256i l_T2 = _mm256_add_epi32(l_Sigma0, l_Majority);
+
+        h = g; g = f; f = e; e = _mm256_add_epi32(d, l_T1);
+        d = c; c = b; b = a; a = _mm256_add_epi32(l_T1, l_T2);
+    }
+
+    const __m256i l_LaneBits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+    const __m256i l_Mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(p_ActiveMask), l_LaneBits), l_LaneBits);
+
+    const __m256i l_Result[8] = { a, b, c, d, e, f, g, h };
+    for (u32 i = 0; i < 8; ++i)
+        p_State[i] = _mm256_blendv_epi8(p_State[i], _mm256_add_epi32(p_State[i], l_Result[i]), l_Mask);
+}
+
+SWROO_TARGET("avx2")
+static void hashBatchAVX2(const std::span<const u8>* p_Inputs, const usize p_Count, swroo::crypto::SHA256Hash* p_Outputs)
+{
+    static constexpr ByteArray<0x40> l_Dummy{};
+
+    std::array<ByteArray<0x80>, 8> l_Tails;
+    std::array<usize, 8> l_FullBlocks{};
+    std::array<usize, 8> l_TotalBlocks{};
+    usize l_MaxBlocks = 0;
+    for (usize l_Lane = 0; l_Lane < p_Count; ++l_Lane)
+    {
+        const std::span<const u8>& l_Input = p_Inputs[l_Lane];
+        l_FullBlocks[l_Lane] = l_Input.size() / 0x40;
+        const usize l_TailSize = l_Input.size() % 0x40;
+        l_TotalBlocks[l_Lane] = l_FullBlocks[l_Lane] + buildTail(l_Input.data() + l_Input.size() - l_TailSize, l_TailSize, l_Input.size(), l_Tails[l_Lane]);
+        l_MaxBlocks = std::max(l_MaxBlocks, l_TotalBlocks[l_Lane]);
+    }
+
+    __m256i l_State[8];
+    for (u32 i = 0; i < 8; ++i)
+        l_State[i] = _mm256_set1_epi32(static_cast<i32>(c_InitialState[i]));
+
+    // Lanes that ran out of blocks are fed a dummy block and masked out
+    for (usize l_Block = 0; l_Block < l_MaxBlocks; ++l_Block)
+    {
+        std::array<const u8*, 8> l_Blocks;
+        i32 l_ActiveMask = 0;
+        for (usize l_Lane = 0; l_Lane < 8; ++l_Lane)
+        {
+            if (l_Lane >= p_Count || l_Block >= l_TotalBlocks[l_Lane])
+            {
+                l_Blocks[l_Lane] = l_Dummy.data();
+                continue;
+            }
+
+            if (l_Block < l_FullBlocks[l_Lane])
+                l_Blocks[l_Lane] = p_Inputs[l_Lane].data() + l_Block * 0x40;
+            else
+                l_Blocks[l_Lane] = l_Tails[l_Lane].data() + (l_Block - l_FullBlocks[l_Lane]) * 0x40;
+            l_ActiveMask |= 1 << l_Lane;
+        }
+        compressAVX2(l_State, l_Blocks.data(), l_ActiveMask);
+    }
+
+    alignas(32) std::array<std::array<u32, 8>, 8> l_Words;
+    for (u32 i = 0; i < 8; ++i)
+        _mm256_store_si256(reinterpret_cast<__m256i*>(l_Words[i].data()), l_State[i]);
+
+    for (usize l_Lane = 0; l_Lane < p_Count; ++l_Lane)
+    {
+        SHA256State l_LaneState;
+        for (u32 i = 0; i < 8; ++i)
+            l_LaneState[i] = l_Words[i][l_Lane];
+        p_Outputs[l_Lane] = stateToHash(l_LaneState);
+    }
+}
+#endif
+
+static void compressBlocks(SHA256State& p_State, const u8* p_Data, const usize p_Blocks, const swroo::crypto::SHA256::Backend p_Backend)
+{
+#ifdef SWROO_SHA256_X86
+    if (p_Backend == swroo::crypto::SHA256::Backend::SHA_NI)
+    {
+        compressSHANI(p_State, p_Data, p_Blocks);
+        return;
+    }
+#endif
+    compressScalar(p_State, p_Data, p_Blocks);
+}
+
+static swroo::crypto::SHA256Hash hashSingle(const u8* p_Data, const usize p_Size, const swroo::crypto::SHA256::Backend p_Backend)
+{
+    SHA256State l_State = c_InitialState;
+
+    const usize l_Blocks = p_Size / 0x40;
+    if (l_Blocks > 0)
+        compressBlocks(l_State, p_Data, l_Blocks, p_Backend);
+
+    ByteArray<0x80> l_Tail;
+    const usize l_TailBlocks = buildTail(p_Data + l_Blocks * 0x40, p_Size % 0x40, p_Size, l_Tail);
+    compressBlocks(l_State, l_Tail.data(), l_TailBlocks, p_Backend);
+
+    return stateToHash(l_State);
+}
+
+static bool detectBackend(const swroo::crypto::SHA256::Backend p_Backend)
+{
+    if (p_Backend == swroo::crypto::SHA256::Backend::SCALAR)
+        return true;
+
+#ifdef SWROO_SHA256_X86
+    std::array<u32, 4> l_Leaf1{};
+    std::array<u32, 4> l_Leaf7{};
+#ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(l_Leaf1.data()), 1);
+    __cpuidex(reinterpret_cast<int*>(l_Leaf7.data()), 7, 0);
+#else
+    __cpuid(1, l_Leaf1[0], l_Leaf1[1], l_Leaf1[2], l_Leaf1[3]);
+    __cpuid_count(7, 0, l_Leaf7[0], l_Leaf7[1], l_Leaf7[2], l_Leaf7[3]);
+#endif
+    const bool l_SSSE3 = (l_Leaf1[2] & (1u << 9)) != 0;
+    const bool l_SSE41 = (l_Leaf1[2] & (1u << 19)) != 0;
+    const bool l_OSXSave = (l_Leaf1[2] & (1u << 27)) != 0;
+
+    if (p_Backend == swroo::crypto::SHA256::Backend::SHA_NI)
+        return l_SSSE3 && l_SSE41 && (l_Leaf7[1] & (1u << 29)) != 0;
+
+    if (p_Backend == swroo::crypto::SHA256::Backend::AVX2)
+    {
+        if (!l_OSXSave || (l_Leaf7[1] & (1u << 5)) == 0)
+            return false;
+
+        // The OS also has to save the YMM registers
+#ifdef _MSC_VER
+        return (_xgetbv(0) & 0x6) == 0x6;
+#else
+        u32 l_XCR0Low, l_XCR0High;
+        __asm__("xgetbv" : "=a"(l_XCR0Low), "=d"(l_XCR0High) : "c"(0));
+        return (l_XCR0Low & 0x6) == 0x6;
+#endif
+    }
+#endif
+    return false;
+}
+
+static swroo::crypto::SHA256::Backend pickBackend()
+{
+    if (detectBackend(swroo::crypto::SHA256::Backend::SHA_NI))
+        return swroo::crypto::SHA256::Backend::SHA_NI;
+    return swroo::crypto::SHA256::Backend::SCALAR;
+}
+
+static swroo::crypto::SHA256::Backend pickBatchBackend()
+{
+    const bool l_HasSHANI = detectBackend(swroo::crypto::SHA256::Backend::SHA_NI);
+    const bool l_HasAVX2 = detectBackend(swroo::crypto::SHA256::Backend::AVX2);
+    if (!l_HasAVX2)
+        return l_HasSHANI ? swroo::crypto::SHA256::Backend::SHA_NI : swroo::crypto::SHA256::Backend::SCALAR;
+    if (!l_HasSHANI)
+        return swroo::crypto::SHA256::Backend::AVX2;
+
+#ifdef SWROO_SHA256_X86
+    // Which one wins depends on the microarchitecture (SHA-NI latency varies a lot between vendors), so time both
+    // on a small batch once
+    static constexpr usize l_BlockSize = 0x1000;
+    std::vector<u8> l_Data(l_BlockSize * 8, 0x5A);
+    std::array<std::span<const u8>, 8> l_Inputs;
+    for (usize i = 0; i < l_Inputs.size(); ++i)
+        l_Inputs[i] = std::span<const u8>(l_Data.data() + i * l_BlockSize, l_BlockSize);
+    std::array<swroo::crypto::SHA256Hash, 8> l_Outputs;
+
+    auto l_Measure = [&](const auto& p_Callback)
+    {
+        std::chrono::steady_clock::duration l_Best = std::chrono::steady_clock::duration::max();
+        for (u32 l_Run = 0; l_Run < 4; ++l_Run)
+        {
+            const std::chrono::steady_clock::time_point l_Start = std::chrono::steady_clock::now();
+            p_Callback();
+            l_Best = std::min(l_Best, std::chrono::steady_clock::now() - l_Start);
+        }
+        return l_Best;
+    };
+
+    const std::chrono::steady_clock::duration l_SHANITime = l_Measure([&]
+    {
+        for (usize i = 0; i < l_Inputs.size(); ++i)
+            l_Outputs[i] = hashSingle(l_Inputs[i].data(), l_Inputs[i].size(), swroo::crypto::SHA256::Backend::SHA_NI);
+    });
+    const std::chrono::steady_clock::duration l_AVX2Time = l_Measure([&]
+    {
+        hashBatchAVX2(l_Inputs.data(), l_Inputs.size(), l_Outputs.data());
+    });
+
+    return l_AVX2Time < l_SHANITime ? swroo::crypto::SHA256::Backend::AVX2 : swroo::crypto::SHA256::Backend::SHA_NI;
+#else
+    return swroo::crypto::SHA256::Backend::SCALAR;
+#endif
+}
+
+swroo::crypto::SHA256::Backend swroo::crypto::SHA256::m_Backend = pickBackend();
+swroo::crypto::SHA256::Backend swroo::crypto::SHA256::m_BatchBackend = pickBatchBackend();
+
+swroo::crypto::SHA256::SHA256()
+{
+    reset();
+}
+
+void swroo::crypto::SHA256::reset()
+{
+    m_State = c_InitialState;
+    m_BufferSize = 0;
+    m_TotalSize = 0;
+}
+
+void swroo::crypto::SHA256::update(const u8* p_Data, usize p_Size)
+{
+    m_TotalSize += p_Size;
+
+    if (m_BufferSize > 0)
+    {
+        const usize l_Fill = std::min(p_Size, m_Buffer.size() - m_BufferSize);
+        std::memcpy(m_Buffer.data() + m_BufferSize, p_Data, l_Fill);
+        m_BufferSize += l_Fill;
+        p_Data += l_Fill;
+        p_Size -= l_Fill;
+
+        if (m_BufferSize < m_Buffer.size())
+            return;
+
+        compressBlocks(m_State, m_Buffer.data(), 1, m_Backend);
+        m_BufferSize = 0;
+    }
+
+    const usize l_Blocks = p_Size / 0x40;
+    if (l_Blocks > 0)
+        compressBlocks(m_State, p_Data, l_Blocks, m_Backend);
+
+    m_BufferSize = p_Size % 0x40;
+    if (m_BufferSize > 0)
+        std::memcpy(m_Buffer.data(), p_Data + l_Blocks * 0x40, m_BufferSize);
+}
+
+swroo::crypto::SHA256Hash swroo::crypto::SHA256::finalize()
+{
+    ByteArray<0x80> l_Tail;
+    const usize l_Blocks = buildTail(m_Buffer.data(), m_BufferSize, m_TotalSize, l_Tail);
+    compressBlocks(m_State, l_Tail.data(), l_Blocks, m_Backend);
+
+    const SHA256Hash l_Hash = stateToHash(m_State);
+    reset();
+    return l_Hash;
+}
+
+swroo::crypto::SHA256::State swroo::crypto::SHA256::getState() const
+{
+    if (m_BufferSize != 0)
+        throw std::runtime_error("SHA256 state is not on a block boundary");
+    return State{ m_State, m_TotalSize };
+}
+
+void swroo::crypto::SHA256::setState(const State& p_State)
+{
+    if (p_State.size % m_Buffer.size() != 0)
+        throw std::runtime_error("SHA256 state is not on a block boundary");
+
+    m_State = p_State.hash;
+    m_TotalSize = p_State.size;
+    m_BufferSize = 0;
+}
+
+swroo::crypto::SHA256Hash swroo::crypto::SHA256::hash(const u8* p_Data, const usize p_Size)
+{
+    return hashSingle(p_Data, p_Size, m_Backend);
+}
+
+void swroo::crypto::SHA256::hashBatch(const std::span<const std::span<const u8>> p_Inputs, const std::span<SHA256Hash> p_Outputs)
+{
+    if (p_Outputs.size() < p_Inputs.size())
+        throw std::runtime_error("SHA256 batch output is smaller than the input");
+
+#ifdef SWROO_SHA256_X86
+    if (m_BatchBackend == Backend::AVX2)
+    {
+        for (usize i = 0; i < p_Inputs.size(); i += 8)
+            hashBatchAVX2(p_Inputs.data() + i, std::min<usize>(8, p_Inputs.size() - i), p_Outputs.data() + i);
+        return;
+    }
+#endif
+
+    for (usize i = 0; i < p_Inputs.size(); ++i)
+        p_Outputs[i] = hashSingle(p_Inputs[i].data(), p_Inputs[i].size(), m_BatchBackend);
+}
+
+bool swroo::crypto::SHA256::isBackendSupported(const Backend p_Backend)
+{
+    return detectBackend(p_Backend);
+}
+
+const char* swroo::crypto::SHA256::getBackendName(const Backend p_Backend)
+{
+    switch (p_Backend)
+    {
+    case Backend::SCALAR: return "scalar";
+    case Backend::SHA_NI: return "SHA-NI";
+    case Backend::AVX2:   return "AVX2 x8";
+    }
+    return "unknown";
+}
+
+bool swroo::crypto::SHA256::setBackend(const Backend p_Backend)
+{
+    // The multi-buffer path has no single stream form
+    if (p_Backend == Backend::AVX2 || !detectBackend(p_Backend))
+        return false;
+
+    m_Backend = p_Backend;
+    return true;
+}
+
+bool swroo::crypto::SHA256::setBatchBackend(const Backend p_Backend)
+{
+    if (!detectBackend(p_Backend))
+        return false;
+
+    m_BatchBackend = p_Backend;
+    return true;
+}
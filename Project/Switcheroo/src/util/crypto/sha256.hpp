@@ -0,0 +1,60 @@
+#pragma once
+#include <span>
+
+#include "../common.hpp"
+
+namespace swroo::crypto
+{
+    using SHA256Hash = ByteArray<0x20>;
+
+    class SHA256
+    {
+    public:
+        enum class Backend : u8
+        {
+            SCALAR,
+            SHA_NI,
+            AVX2, // Multi-buffer, only used for batches
+        };
+
+        // Chaining state after a whole number of 64 byte blocks, enough to resume hashing later
+        struct State
+        {
+            std::array<u32, 8> hash;
+            u64 size;
+        };
+
+        SHA256();
+
+        void reset();
+        void update(const u8* p_Data, usize p_Size);
+        [[nodiscard]] SHA256Hash finalize();
+
+        // getState throws if the data so far does not end on a block boundary
+        [[nodiscard]] State getState() const;
+        void setState(const State& p_State);
+
+        [[nodiscard]] static SHA256Hash hash(const u8* p_Data, usize p_Size);
+
+        // Hashes independent buffers, eight at a time on the multi-buffer path. p_Outputs must be at least as long as p_Inputs.
+        static void hashBatch(std::span<const std::span<const u8>> p_Inputs, std::span<SHA256Hash> p_Outputs);
+
+        [[nodiscard]] static bool isBackendSupported(Backend p_Backend);
+        [[nodiscard]] static Backend getBackend() { return m_Backend; }
+        [[nodiscard]] static Backend getBatchBackend() { return m_BatchBackend; }
+        [[nodiscard]] static const char* getBackendName(Backend p_Backend);
+
+        // Overrides the runtime detection, mostly meant for benchmarking. Returns false if unsupported.
+        static bool setBackend(Backend p_Backend);
+        static bool setBatchBackend(Backend p_Backend);
+
+    private:
+        static Backend m_Backend;
+        static Backend m_BatchBackend;
+
+        std::array<u32, 8> m_State{};
+        ByteArray<0x40> m_Buffer{};
+        usize m_BufferSize = 0;
+        u64 m_TotalSize = 0;
+    };
+}
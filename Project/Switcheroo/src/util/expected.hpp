@@ -0,0 +1,88 @@
+#pragma once
+#include "common.hpp"
+
+#include <filesystem>
+#include <string>
+#include <variant>
+
+namespace swroo::utils
+{
+    enum class ErrorCode : u8
+    {
+        NONE,
+        OPEN_FAILED,
+        READ_FAILED,
+        TRUNCATED,    // The file ends before data it says is there, usually a partial download
+        OUT_OF_RANGE, // An offset or size points outside of its parent
+        BAD_MAGIC,
+        MISSING_KEY,
+        DECRYPT_FAILED,
+        UNSUPPORTED,
+    };
+
+    // Returned by value from the non-throwing loader paths, the message is only built when someone asks for it
+    struct Error
+    {
+        static constexpr u64 c_NoValue = UINT64_MAX;
+
+        ErrorCode code = ErrorCode::NONE;
+        const char* source = nullptr; // Static string naming what failed
+        u64 value = c_NoValue;        // Depends on the code: entry index, magic, required size...
+
+        explicit operator bool() const { return code != ErrorCode::NONE; }
+
+        [[nodiscard]] static const char* getCodeName(ErrorCode p_Code);
+        [[nodiscard]] std::string toString(const std::filesystem::path& p_Path = {}) const;
+    };
+
+    // Either a value or the Error that prevented creating it, std::expected is C++23
+    template<typename T>
+    class Expected
+    {
+    public:
+        Expected(T p_Value) : m_Value(std::in_place_index<0>, std::move(p_Value)) {}
+        Expected(const Error& p_Error) : m_Value(std::in_place_index<1>, p_Error) {}
+
+        [[nodiscard]] bool hasValue() const { return m_Value.index() == 0; }
+        explicit operator bool() const { return hasValue(); }
+
+        [[nodiscard]] T& getValue() { return std::get<0>(m_Value); }
+        [[nodiscard]] const T& getValue() const { return std::get<0>(m_Value); }
+        [[nodiscard]] const Error& getError() const { return std::get<1>(m_Value); }
+
+        // Moves the value out, only valid when hasValue() is true
+        [[nodiscard]] T takeValue() { return std::move(std::get<0>(m_Value)); }
+
+    private:
+        std::variant<T, Error> m_Value;
+    };
+
+    inline const char* Error::getCodeName(const ErrorCode p_Code)
+    {
+        switch (p_Code)
+        {
+        case ErrorCode::NONE:           return "No error";
+        case ErrorCode::OPEN_FAILED:    return "Failed to open";
+        case ErrorCode::READ_FAILED:    return "Failed to read";
+        case ErrorCode::TRUNCATED:      return "Truncated";
+        case ErrorCode::OUT_OF_RANGE:   return "Out of range";
+        case ErrorCode::BAD_MAGIC:      return "Invalid magic";
+        case ErrorCode::MISSING_KEY:    return "Missing key";
+        case ErrorCode::DECRYPT_FAILED: return "Failed to decrypt";
+        case ErrorCode::UNSUPPORTED:    return "Unsupported";
+        }
+        return "Unknown error";
+    }
+
+    inline std::string Error::toString(const std::filesystem::path& p_Path) const
+    {
+        std::string l_Message = getCodeName(code);
+        if (source != nullptr)
+            l_Message += std::string(" ") + source;
+        if (value != c_NoValue)
+            l_Message += " (" + std::to_string(value) + ")";
+        if (!p_Path.empty())
+            l_Message += ": " + p_Path.string();
+        return l_Message;
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+namespace swroo::utils
+{
+    // Minimal stand-in for C++23 std::generator. The body runs lazily, one co_yield per iteration step, and destroying
+    // the generator while it is suspended abandons the rest of the work.
+    template<typename T>
+    class Generator
+    {
+    public:
+        struct promise_type
+        {
+            T* m_Value = nullptr;
+            std::exception_ptr m_Exception;
+
+            Generator get_return_object() { return Generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+
+            // The yielded object stays alive in the coroutine frame until the next resume
+            std::suspend_always yield_value(T& p_Value) noexcept
+            {
+                m_Value = std::addressof(p_Value);
+                return {};
+            }
+            std::suspend_always yield_value(T&& p_Value) noexcept
+            {
+                m_Value = std::addressof(p_Value);
+                return {};
+            }
+
+            void return_void() {}
+            void unhandled_exception() { m_Exception = std::current_exception(); }
+
+            template<typename U>
+            void await_transform(U&&) = delete;
+        };
+
+        class Iterator
+        {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using difference_type = std::ptrdiff_t;
+            using value_type = T;
+
+            Iterator() = default;
+            explicit Iterator(const std::coroutine_handle<promise_type> p_Handle) : m_Handle(p_Handle) {}
+
+            T& operator*() const { return *m_Handle.promise().m_Value; }
+            T* operator->() const { return m_Handle.promise().m_Value; }
+
+            Iterator& operator++()
+            {
+                resume(m_Handle);
+                return *this;
+            }
+            void operator++(int) { ++*this; }
+
+            bool operator==(std::default_sentinel_t) const { return !m_Handle || m_Handle.done(); }
+
+        private:
+            std::coroutine_handle<promise_type> m_Handle{};
+        };
+
+        Generator(const Generator&) = delete;
+        Generator& operator=(const Generator&) = delete;
+        Generator(Generator&& other) noexcept : m_Handle(std::exchange(other.m_Handle, {})) {}
+        ~Generator()
+        {
+            if (m_Handle)
+                m_Handle.destroy();
+        }
+
+        // Runs the body up to the first co_yield, can only be called once
+        Iterator begin()
+        {
+            resume(m_Handle);
+            return Iterator(m_Handle);
+        }
+        std::default_sentinel_t end() const { return {}; }
+
+    private:
+        explicit Generator(const std::coroutine_handle<promise_type> p_Handle) : m_Handle(p_Handle) {}
+
+        static void resume(const std::coroutine_handle<promise_type> p_Handle)
+        {
+            p_Handle.resume();
+            if (p_Handle.promise().m_Exception)
+                std::rethrow_exception(std::exchange(p_Handle.promise().m_Exception, {}));
+        }
+
+        std::coroutine_handle<promise_type> m_Handle;
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "common.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+namespace swroo::utils
+{
+    // Every format read here is little endian, values are swapped on hosts that are not
+    template<typename T>
+    [[nodiscard]] T loadLE(const u8* p_Data)
+    {
+        static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "Only integers and enums have a byte order");
+
+        T l_Value;
+        std::memcpy(&l_Value, p_Data, sizeof(T));
+        if constexpr (std::endian::native == std::endian::big && sizeof(T) > 1)
+        {
+            auto l_Bytes = std::bit_cast<std::array<u8, sizeof(T)>>(l_Value);
+            std::ranges::reverse(l_Bytes);
+            l_Value = std::bit_cast<T>(l_Bytes);
+        }
+        return l_Value;
+    }
+
+    // Typed, read-only view of an on-disk header inside a byte buffer, so the header is never copied out of the
+    // buffer it was read or decrypted into. Size is the on-disk size and is checked against T when the view type is
+    // named. The buffer must outlive the view and be aligned for T.
+    template<typename T, usize Size = sizeof(T)>
+    class HeaderView
+    {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_standard_layout_v<T>, "Header views need plain structs");
+        static_assert(sizeof(T) == Size, "Header struct does not match its on-disk size");
+
+    public:
+        using Type = T;
+        static constexpr usize c_Size = Size;
+
+        HeaderView() = default;
+        explicit HeaderView(const u8* p_Data) : m_Data(p_Data) {}
+        explicit HeaderView(const std::span<const u8, Size> p_Data) : m_Data(p_Data.data()) {}
+
+        // Scalar field at a compile time offset, byte swapped if needed. Use VIEW_FIELD to name it instead.
+        template<usize Offset, typename F>
+        [[nodiscard]] F get() const
+        {
+            static_assert(Offset + sizeof(F) <= Size, "Field is outside of the header");
+            return loadLE<F>(m_Data + Offset);
+        }
+
+        // The struct as stored, for arrays, nested structs and member functions
+        [[nodiscard]] const T& operator*() const
+        {
+            static_assert(std::endian::native == std::endian::little, "Whole structs can only be viewed on little endian hosts, use get");
+            return *reinterpret_cast<const T*>(m_Data);
+        }
+        [[nodiscard]] const T* operator->() const { return &**this; }
+
+        [[nodiscard]] std::span<const u8, Size> getData() const { return std::span<const u8, Size>(m_Data, Size); }
+        [[nodiscard]] bool isValid() const { return m_Data != nullptr; }
+
+    private:
+        const u8* m_Data{ nullptr };
+    };
+}
+
+// Reads p_Field of the struct behind a HeaderView, with its offset and type taken from the declaration
+#define VIEW_FIELD(p_View, p_Field) (p_View).template get<offsetof(typename std::remove_cvref_t<decltype(p_View)>::Type, p_Field), \
+                                                          decltype(std::remove_cvref_t<decltype(p_View)>::Type::p_Field)>()
@@ -0,0 +1,33 @@
+#pragma once
+#include "common.hpp"
+
+#include <string>
+
+namespace swroo::utils
+{
+    // Estimates of the heap memory held by standard containers, for memory accounting. The object itself is not
+    // counted, neither is allocator overhead. Hash containers are charged a node per element plus the bucket array.
+
+    template<typename T>
+    [[nodiscard]] usize getMemoryUsage(const std::vector<T>& p_Vector)
+    {
+        return p_Vector.capacity() * sizeof(T);
+    }
+
+    template<typename C>
+    [[nodiscard]] usize getMemoryUsage(const std::basic_string<C>& p_String)
+    {
+        // Short strings live inside the object
+        const u8* l_Object = reinterpret_cast<const u8*>(&p_String);
+        const u8* l_Data = reinterpret_cast<const u8*>(p_String.data());
+        if (l_Data >= l_Object && l_Data < l_Object + sizeof(p_String))
+            return 0;
+        return (p_String.capacity() + 1) * sizeof(C);
+    }
+
+    template<typename Map>
+    [[nodiscard]] usize getHashMapMemoryUsage(const Map& p_Map)
+    {
+        return p_Map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*)) + p_Map.bucket_count() * sizeof(void*);
+    }
+}
@@ -0,0 +1,264 @@
+#include "task_scheduler.hpp"
+
+#include <chrono>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Which scheduler the current thread works for, if any, and the index of its deque there
+static thread_local const swroo::utils::TaskScheduler* s_CurrentScheduler = nullptr;
+static thread_local usize s_CurrentWorker = 0;
+
+swroo::utils::TaskScheduler::TaskGroup::TaskGroup(TaskScheduler& p_Scheduler, const Priority p_Priority)
+    : m_Scheduler(p_Scheduler), m_Priority(p_Priority), m_State(std::make_shared<GroupState>())
+{
+}
+
+swroo::utils::TaskScheduler::TaskGroup::~TaskGroup()
+{
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+    }
+}
+
+void swroo::utils::TaskScheduler::TaskGroup::run(Task p_Task)
+{
+    ++m_State->pending;
+    m_Scheduler.submit({ std::move(p_Task), m_State }, m_Priority);
+}
+
+void swroo::utils::TaskScheduler::TaskGroup::wait()
+{
+    const usize l_Worker = m_Scheduler.getCurrentWorker();
+    while (m_State->pending > 0)
+    {
+        if (m_Scheduler.runOne(l_Worker, m_Priority))
+            continue;
+
+        // Everything left is running elsewhere. New tasks may still show up, so the wait is short.
+        std::unique_lock l_Lock(m_State->mutex);
+        m_State->done.wait_for(l_Lock, std::chrono::milliseconds(1), [this] { return m_State->pending == 0; });
+    }
+
+    std::exception_ptr l_Error;
+    {
+        std::lock_guard l_Lock(m_State->mutex);
+        l_Error = std::exchange(m_State->error, nullptr);
+    }
+    if (l_Error)
+        std::rethrow_exception(l_Error);
+}
+
+void swroo::utils::TaskScheduler::TaskGroup::cancel()
+{
+    m_State->cancelled = true;
+}
+
+bool swroo::utils::TaskScheduler::TaskGroup::isCancelled() const
+{
+    return m_State->cancelled;
+}
+
+swroo::utils::TaskScheduler::TaskScheduler(const usize p_ThreadCount, const bool p_PinThreads)
+    : m_ThreadCount(p_ThreadCount != 0 ? p_ThreadCount : std::max(1u, std::thread::hardware_concurrency())),
+      m_Workers(std::make_unique<Worker[]>(m_ThreadCount))
+{
+    const usize l_CoreCount = std::max(1u, std::thread::hardware_concurrency());
+    m_Threads.reserve(m_ThreadCount);
+    for (usize i = 0; i < m_ThreadCount; ++i)
+    {
+        m_Threads.emplace_back([this, i] { workerMain(i); });
+        if (p_PinThreads && m_ThreadCount <= l_CoreCount)
+            pin(m_Threads.back(), i);
+    }
+}
+
+swroo::utils::TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard l_Lock(m_SleepMutex);
+        m_Stopping = true;
+    }
+    m_Wake.notify_all();
+
+    for (std::thread& l_Thread : m_Threads)
+        l_Thread.join();
+}
+
+void swroo::utils::TaskScheduler::parallelFor(const usize p_Count, const std::function<void(usize)>& p_Body, const Priority p_Priority)
+{
+    // One task per worker that pulls indices until none are left, rather than one task per index
+    std::atomic<usize> l_Next = 0;
+    TaskGroup l_Group(*this, p_Priority);
+    for (usize i = 0; i < std::min(p_Count, m_ThreadCount); ++i)
+    {
+        l_Group.run([&l_Next, p_Count, &p_Body]
+        {
+            for (usize j = l_Next++; j < p_Count; j = l_Next++)
+                p_Body(j);
+        });
+    }
+    l_Group.wait();
+}
+
+swroo::utils::TaskScheduler::Stats swroo::utils::TaskScheduler::getStats() const
+{
+    return { m_Executed.load(), m_Stolen.load(), m_Skipped.load() };
+}
+
+usize swroo::utils::TaskScheduler::getCurrentWorker() const
+{
+    return s_CurrentScheduler == this ? s_CurrentWorker : c_NoWorker;
+}
+
+void swroo::utils::TaskScheduler::submit(Item p_Item, const Priority p_Priority)
+{
+    // Workers keep what they spawn, it is likely to touch the same data. Everyone else spreads tasks round robin.
+    usize l_Worker = getCurrentWorker();
+    if (l_Worker == c_NoWorker)
+        l_Worker = m_NextWorker++ % m_ThreadCount;
+
+    {
+        // Counted under the lock, nobody can take the task before it is counted
+        std::lock_guard l_Lock(m_Workers[l_Worker].mutex);
+        m_Workers[l_Worker].lanes[static_cast<u8>(p_Priority)].push_back(std::move(p_Item));
+        ++m_Queued;
+    }
+
+    // Taking the lock orders this with a worker that checked m_Queued and is about to sleep
+    {
+        std::lock_guard l_Lock(m_SleepMutex);
+    }
+    m_Wake.notify_one();
+}
+
+bool swroo::utils::TaskScheduler::take(const usize p_Worker, const Priority p_Lowest, Item& p_Item)
+{
+    for (u8 l_Lane = 0; l_Lane <= static_cast<u8>(p_Lowest); ++l_Lane)
+    {
+        // Own deque from the back
+        if (p_Worker != c_NoWorker)
+        {
+            Worker& l_Own = m_Workers[p_Worker];
+            std::lock_guard l_Lock(l_Own.mutex);
+            std::deque<Item>& l_Deque = l_Own.lanes[l_Lane];
+            if (!l_Deque.empty())
+            {
+                p_Item = std::move(l_Deque.back());
+                l_Deque.pop_back();
+                --m_Queued;
+                return true;
+            }
+        }
+
+        // Everyone else's from the front, starting with the next worker so thieves spread out
+        const usize l_Start = p_Worker != c_NoWorker ? p_Worker + 1 : m_NextWorker.load();
+        for (usize i = 0; i < m_ThreadCount; ++i)
+        {
+            const usize l_Victim = (l_Start + i) % m_ThreadCount;
+            if (l_Victim == p_Worker)
+                continue;
+
+            Worker& l_Other = m_Workers[l_Victim];
+            std::lock_guard l_Lock(l_Other.mutex);
+            std::deque<Item>& l_Deque = l_Other.lanes[l_Lane];
+            if (!l_Deque.empty())
+            {
+                p_Item = std::move(l_Deque.front());
+                l_Deque.pop_front();
+                --m_Queued;
+                ++m_Stolen;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool swroo::utils::TaskScheduler::runOne(const usize p_Worker, const Priority p_Lowest)
+{
+    if (m_Queued == 0)
+        return false;
+
+    Item l_Item;
+    if (!take(p_Worker, p_Lowest, l_Item))
+        return false;
+
+    execute(l_Item);
+    return true;
+}
+
+void swroo::utils::TaskScheduler::execute(Item& p_Item)
+{
+    GroupState& l_Group = *p_Item.group;
+    if (l_Group.cancelled)
+    {
+        ++m_Skipped;
+    }
+    else
+    {
+        try
+        {
+            p_Item.task();
+        }
+        catch (...)
+        {
+            std::lock_guard l_Lock(l_Group.mutex);
+            if (!l_Group.error)
+                l_Group.error = std::current_exception();
+        }
+        ++m_Executed;
+    }
+
+    // The task may own captures that reference the waiter's scope, it goes before the waiter is released
+    p_Item.task = nullptr;
+    if (--l_Group.pending == 0)
+    {
+        std::lock_guard l_Lock(l_Group.mutex);
+        l_Group.done.notify_all();
+    }
+}
+
+void swroo::utils::TaskScheduler::workerMain(const usize p_Index)
+{
+    s_CurrentScheduler = this;
+    s_CurrentWorker = p_Index;
+
+    while (true)
+    {
+        if (runOne(p_Index, Priority::BACKGROUND))
+            continue;
+
+        std::unique_lock l_Lock(m_SleepMutex);
+        m_Wake.wait(l_Lock, [this] { return m_Stopping || m_Queued > 0; });
+        if (m_Stopping && m_Queued == 0)
+            return;
+    }
+}
+
+void swroo::utils::TaskScheduler::pin(std::thread& p_Thread, const usize p_Core)
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(p_Thread.native_handle(), static_cast<DWORD_PTR>(1) << (p_Core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+    cpu_set_t l_Set;
+    CPU_ZERO(&l_Set);
+    CPU_SET(p_Core % CPU_SETSIZE, &l_Set);
+    pthread_setaffinity_np(p_Thread.native_handle(), sizeof(l_Set), &l_Set);
+#else
+    // macOS has no hard affinity, only hints per thread group
+    (void)p_Thread;
+    (void)p_Core;
+#endif
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include "common.hpp"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace swroo::utils
+{
+    // Worker threads for everything an Engine runs in parallel. Every worker has a deque per priority lane, runs its
+    // newest task first and steals the oldest tasks of other workers once its own deques are empty. Lanes are drained in
+    // order across all workers, so interactive work overtakes queued background work at the next task boundary.
+    // Thread safe.
+    class TaskScheduler
+    {
+        struct GroupState;
+
+    public:
+        enum class Priority : u8
+        {
+            INTERACTIVE,
+            NORMAL,
+            BACKGROUND,
+            COUNT
+        };
+
+        using Task = std::function<void()>;
+
+        // Tasks that are waited on and cancelled together. The destructor waits too, so tasks may use locals of the
+        // scope the group lives in, but only wait reports their exceptions.
+        class TaskGroup
+        {
+        public:
+            explicit TaskGroup(TaskScheduler& p_Scheduler, Priority p_Priority = Priority::NORMAL);
+            TaskGroup(const TaskGroup&) = delete;
+            TaskGroup& operator=(const TaskGroup&) = delete;
+            ~TaskGroup();
+
+            void run(Task p_Task);
+            // Returns once every task ran or was skipped and rethrows the first exception one of them threw. The calling
+            // thread runs queued tasks of this priority or higher meanwhile, waiting inside a task cannot deadlock.
+            void wait();
+            // Tasks that did not start yet are skipped, running ones may check isCancelled to stop early
+            void cancel();
+            [[nodiscard]] bool isCancelled() const;
+
+        private:
+            TaskScheduler& m_Scheduler;
+            Priority m_Priority;
+            std::shared_ptr<GroupState> m_State;
+        };
+
+        struct Stats
+        {
+            u64 executed;
+            u64 stolen;  // Taken from the deque of another worker, or by a thread that is no worker
+            u64 skipped; // Dropped because their group was cancelled
+        };
+
+        // 0 threads for one per core. With p_PinThreads, every worker is bound to a core of its own where there are enough.
+        explicit TaskScheduler(usize p_ThreadCount = 0, bool p_PinThreads = false);
+        TaskScheduler(const TaskScheduler&) = delete;
+        TaskScheduler& operator=(const TaskScheduler&) = delete;
+        // Runs everything still queued, then joins the workers
+        ~TaskScheduler();
+
+        // Calls p_Body for every index in [0, p_Count), on the workers and the calling thread. Returns once every index
+        // was processed, rethrowing the first exception p_Body threw.
+        void parallelFor(usize p_Count, const std::function<void(usize)>& p_Body, Priority p_Priority = Priority::NORMAL);
+
+        [[nodiscard]] usize getThreadCount() const { return m_ThreadCount; }
+        [[nodiscard]] Stats getStats() const;
+
+    private:
+        struct GroupState
+        {
+            std::atomic<usize> pending = 0;
+            std::atomic<bool> cancelled = false;
+
+            std::mutex mutex;
+            std::condition_variable done;
+            std::exception_ptr error;
+        };
+
+        struct Item
+        {
+            Task task;
+            std::shared_ptr<GroupState> group;
+        };
+
+        struct alignas(64) Worker
+        {
+            std::mutex mutex;
+            std::array<std::deque<Item>, static_cast<u8>(Priority::COUNT)> lanes;
+        };
+
+        static constexpr usize c_NoWorker = UINT64_MAX;
+
+        void submit(Item p_Item, Priority p_Priority);
+        // Runs one queued task of p_Lowest priority or higher on the calling thread, false if there was none.
+        // p_Worker is the deque of the calling thread, c_NoWorker if it has none.
+        bool runOne(usize p_Worker, Priority p_Lowest);
+        [[nodiscard]] bool take(usize p_Worker, Priority p_Lowest, Item& p_Item);
+        void execute(Item& p_Item);
+        void workerMain(usize p_Index);
+        [[nodiscard]] usize getCurrentWorker() const;
+
+        static void pin(std::thread& p_Thread, usize p_Core);
+
+        usize m_ThreadCount;
+        std::unique_ptr<Worker[]> m_Workers;
+        std::vector<std::thread> m_Threads;
+
+        std::atomic<usize> m_Queued = 0;
+        std::atomic<usize> m_NextWorker = 0;
+        std::mutex m_SleepMutex;
+        std::condition_variable m_Wake;
+        bool m_Stopping = false;
+
+        std::atomic<u64> m_Executed = 0;
+        std::atomic<u64> m_Stolen = 0;
+        std::atomic<u64> m_Skipped = 0;
+    };
+}